@@ -1,8 +1,7 @@
 #include "apu.h"
 #include "memory.h"
+#include "profile.h"
 
-#include <iostream>
-#include <cstring>
 #include <algorithm>
 #include <ostream>
 #include <istream>
@@ -17,7 +16,10 @@ void APU::saveState(std::ostream& out) const {
     W(pwr);
     W(frameSeqCounter);
     W(frameSeqStep);
-    W(sampleAccum);
+    W(blipTime);
+    W(levelL); W(levelR);
+    blipL.saveState(out);
+    blipR.saveState(out);
 }
 
 bool APU::loadState(std::istream& in) {
@@ -25,18 +27,30 @@ bool APU::loadState(std::istream& in) {
         return static_cast<bool>(
             in.read(reinterpret_cast<char*>(&x), sizeof(x)));
     };
-    if (!R(ch1) || !R(ch2) || !R(ch3) || !R(ch4)) return false;
-    if (!R(nr50) || !R(nr51)) return false;
-    uint8_t pwr = 0;
-    if (!R(pwr)) return false;
+    // Read into locals so a rejected chunk leaves the channels as they were.
+    Square c1, c2;
+    Wave   c3;
+    Noise  c4;
+    uint8_t r50 = 0, r51 = 0, pwr = 0;
+    int     seqCounter = 0, seqStep = 0;
+    uint32_t time = 0;
+    int     inL[4], inR[4];
+    if (!R(c1) || !R(c2) || !R(c3) || !R(c4)) return false;
+    if (!R(r50) || !R(r51) || !R(pwr)) return false;
+    if (!R(seqCounter) || !R(seqStep) || !R(time)) return false;
+    if (!R(inL) || !R(inR)) return false;
+    if (time > MAX_PENDING_CYCLES) return false;
+    if (!blipL.loadState(in) || !blipR.loadState(in)) return false;
+    ch1 = c1; ch2 = c2; ch3 = c3; ch4 = c4;
+    nr50 = r50; nr51 = r51;
     powered = pwr != 0;
-    if (!R(frameSeqCounter) || !R(frameSeqStep) || !R(sampleAccum)) return false;
-    // Drain audio ring buffer so we don't play stale samples.
-    if (device) SDL_LockAudioDevice(device);
-    writeIdx.store(0);
-    readIdx.store(0);
-    std::memset(ring, 0, sizeof(ring));
-    if (device) SDL_UnlockAudioDevice(device);
+    frameSeqCounter = seqCounter;
+    frameSeqStep = seqStep;
+    blipTime = time;
+    std::copy(inL, inL + 4, levelL);
+    std::copy(inR, inR + 4, levelR);
+    // Drop pending samples so we don't play stale audio.
+    sampleFrames = 0;
     return true;
 }
 
@@ -49,34 +63,6 @@ APU::APU(Memory& mem) : memory(mem) {
     reset();
 }
 
-APU::~APU() {
-    if (device) {
-        SDL_CloseAudioDevice(device);
-        device = 0;
-    }
-}
-
-bool APU::init() {
-    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-        std::cerr << "SDL audio init failed: " << SDL_GetError() << '\n';
-        return false;
-    }
-    SDL_AudioSpec want{}, have{};
-    want.freq     = SAMPLE_RATE;
-    want.format   = AUDIO_S16SYS;
-    want.channels = 2;
-    want.samples  = 1024;
-    want.callback = &APU::audioCallback;
-    want.userdata = this;
-    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
-    if (device == 0) {
-        std::cerr << "SDL_OpenAudioDevice failed: " << SDL_GetError() << '\n';
-        return false;
-    }
-    SDL_PauseAudioDevice(device, 0);
-    return true;
-}
-
 void APU::reset() {
     ch1 = Square{};
     ch2 = Square{};
@@ -88,77 +74,77 @@ void APU::reset() {
     powered = true;
     frameSeqCounter = 0;
     frameSeqStep = 0;
-    sampleAccum = 0.0;
-    writeIdx = 0;
-    readIdx = 0;
-    std::memset(ring, 0, sizeof(ring));
+    sampleFrames = 0;
+    blipL.clear();
+    blipR.clear();
+    blipTime = 0;
+    for (int ch = 0; ch < 4; ++ch) levelL[ch] = levelR[ch] = 0;
 }
 
-void APU::audioCallback(void* userdata, Uint8* stream, int len) {
-    APU* apu = static_cast<APU*>(userdata);
-    int16_t* out = reinterpret_cast<int16_t*>(stream);
-    int frames = len / (2 * sizeof(int16_t));
-    int r = apu->readIdx.load(std::memory_order_acquire);
-    int w = apu->writeIdx.load(std::memory_order_acquire);
-    int available = (w - r + BUFFER_FRAMES) % BUFFER_FRAMES;
-    int take = std::min(frames, available);
-    for (int i = 0; i < take; ++i) {
-        out[i * 2]     = apu->ring[r * 2];
-        out[i * 2 + 1] = apu->ring[r * 2 + 1];
-        r = (r + 1) % BUFFER_FRAMES;
-    }
-    for (int i = take; i < frames; ++i) {
-        out[i * 2]     = 0;
-        out[i * 2 + 1] = 0;
+void APU::step(int cycles) {
+    // Advance in segments that end at the next frame sequencer clock, so
+    // the output does not depend on how the caller chunks `cycles` (the
+    // core catches the APU up lazily). Sampling itself costs nothing here:
+    // channels only report edges to the blip buffers.
+    GB_PROF_SCOPE(Apu);
+    while (cycles > 0) {
+        int seg = cycles;
+        if (powered && 8192 - frameSeqCounter < seg) seg = 8192 - frameSeqCounter;
+
+        if (powered) {
+            // Channel timers
+            tickSquare(ch1, 0, seg);
+            tickSquare(ch2, 1, seg);
+            tickWave(ch3, seg);
+            tickNoise(ch4, seg);
+        }
+        blipTime += static_cast<uint32_t>(seg);
+
+        if (powered) {
+            // Frame sequencer @ 512 Hz: every 8192 CPU cycles.
+            frameSeqCounter += seg;
+            if (frameSeqCounter >= 8192) {
+                frameSeqCounter -= 8192;
+                stepFrameSequencer();
+                updateLevels();
+            }
+        }
+        cycles -= seg;
     }
-    apu->readIdx.store(r, std::memory_order_release);
+    // Nobody is collecting samples; keep the blip buffers from overflowing.
+    if (blipTime >= MAX_PENDING_CYCLES) endFrame();
 }
 
-void APU::pushSample(int16_t l, int16_t r) {
-    int w = writeIdx.load(std::memory_order_relaxed);
-    int rd = readIdx.load(std::memory_order_acquire);
-    int next = (w + 1) % BUFFER_FRAMES;
-    if (next == rd) {
-        // buffer full — drop sample
-        return;
-    }
-    ring[w * 2]     = l;
-    ring[w * 2 + 1] = r;
-    writeIdx.store(next, std::memory_order_release);
+void APU::endFrame() {
+    GB_PROF_SCOPE(Apu);
+    blipL.endFrame(blipTime);
+    blipR.endFrame(blipTime);
+    blipTime = 0;
+
+    int n = blipL.samplesAvailable();
+    if (n > BUFFER_FRAMES - sampleFrames) sampleFrames = 0; // buffer full — start over
+    int16_t* out = samples + sampleFrames * 2;
+    blipL.readSamples(out, n, 2);
+    blipR.readSamples(out + 1, n, 2);
+    if (muted) std::fill(out, out + n * 2, int16_t(0));
+    sampleFrames += n;
 }
 
-void APU::step(int cycles) {
-    if (!powered) {
-        // Still produce silent samples to keep audio flowing.
-        sampleAccum += cycles;
-        const double period = static_cast<double>(CPU_FREQ) / SAMPLE_RATE;
-        while (sampleAccum >= period) {
-            sampleAccum -= period;
-            pushSample(0, 0);
-        }
-        return;
-    }
-
-    // Channel timers
-    tickSquare(ch1, cycles);
-    tickSquare(ch2, cycles);
-    tickWave(ch3, cycles);
-    tickNoise(ch4, cycles);
-
-    // Frame sequencer @ 512 Hz: every 8192 CPU cycles.
-    frameSeqCounter += cycles;
-    while (frameSeqCounter >= 8192) {
-        frameSeqCounter -= 8192;
-        stepFrameSequencer();
-    }
+void APU::setLevel(int ch, int level, uint32_t time) {
+    // Each channel: 0..15, scaled by the NR50 master volume (1..8).
+    constexpr int amp = 380;
+    int l = (nr51 & (0x10 << ch)) ? level * (((nr50 >> 4) & 0x07) + 1) * amp / 32 : 0;
+    int r = (nr51 & (0x01 << ch)) ? level * ((nr50 & 0x07) + 1) * amp / 32 : 0;
+    if (l != levelL[ch]) { blipL.addDelta(time, l - levelL[ch]); levelL[ch] = l; }
+    if (r != levelR[ch]) { blipR.addDelta(time, r - levelR[ch]); levelR[ch] = r; }
+}
 
-    // Sampling
-    sampleAccum += cycles;
-    const double period = static_cast<double>(CPU_FREQ) / SAMPLE_RATE;
-    while (sampleAccum >= period) {
-        sampleAccum -= period;
-        produceSample();
-    }
+void APU::updateLevels() {
+    // Volume, enable and panning changes take effect at the current time.
+    setLevel(0, squareOutput(ch1), blipTime);
+    setLevel(1, squareOutput(ch2), blipTime);
+    setLevel(2, waveOutput(ch3), blipTime);
+    setLevel(3, noiseOutput(ch4), blipTime);
 }
 
 void APU::stepFrameSequencer() {
@@ -230,14 +216,18 @@ void APU::clockSweep() {
     }
 }
 
-void APU::tickSquare(Square& c, int cycles) {
+// Each timer reload is an edge at blipTime + cycles + freqTimer (freqTimer
+// has gone non-positive by however far the segment overshot it).
+void APU::tickSquare(Square& c, int ch, int cycles) {
     if (!c.enabled) return;
     c.freqTimer -= cycles;
     while (c.freqTimer <= 0) {
+        uint32_t when = blipTime + static_cast<uint32_t>(cycles + c.freqTimer);
         int period = (2048 - c.frequency) * 4;
         if (period <= 0) period = 1;
         c.freqTimer += period;
         c.dutyPos = (c.dutyPos + 1) & 7;
+        setLevel(ch, squareOutput(c), when);
     }
 }
 
@@ -245,12 +235,14 @@ void APU::tickWave(Wave& c, int cycles) {
     if (!c.enabled) return;
     c.freqTimer -= cycles;
     while (c.freqTimer <= 0) {
+        uint32_t when = blipTime + static_cast<uint32_t>(cycles + c.freqTimer);
         int period = (2048 - c.frequency) * 2;
         if (period <= 0) period = 1;
         c.freqTimer += period;
         c.wavePos = (c.wavePos + 1) & 31;
         uint8_t byte = c.waveRAM[c.wavePos >> 1];
         c.sampleBuffer = (c.wavePos & 1) ? (byte & 0x0F) : (byte >> 4);
+        setLevel(2, waveOutput(c), when);
     }
 }
 
@@ -258,6 +250,7 @@ void APU::tickNoise(Noise& c, int cycles) {
     if (!c.enabled) return;
     c.freqTimer -= cycles;
     while (c.freqTimer <= 0) {
+        uint32_t when = blipTime + static_cast<uint32_t>(cycles + c.freqTimer);
         int period = NOISE_DIVISORS[c.divisorCode] << c.shift;
         if (period <= 0) period = 1;
         c.freqTimer += period;
@@ -267,6 +260,7 @@ void APU::tickNoise(Noise& c, int cycles) {
         if (c.widthMode) {
             c.lfsr = (c.lfsr & ~(1 << 6)) | (bit << 6);
         }
+        setLevel(3, noiseOutput(c), when);
     }
 }
 
@@ -294,43 +288,6 @@ int APU::noiseOutput(const Noise& c) const {
     return sample * c.volume;
 }
 
-void APU::produceSample() {
-    int s1 = squareOutput(ch1);
-    int s2 = squareOutput(ch2);
-    int s3 = waveOutput(ch3);
-    int s4 = noiseOutput(ch4);
-
-    int left = 0, right = 0;
-    if (nr51 & 0x10) left  += s1;
-    if (nr51 & 0x20) left  += s2;
-    if (nr51 & 0x40) left  += s3;
-    if (nr51 & 0x80) left  += s4;
-    if (nr51 & 0x01) right += s1;
-    if (nr51 & 0x02) right += s2;
-    if (nr51 & 0x04) right += s3;
-    if (nr51 & 0x08) right += s4;
-
-    int leftVol  = ((nr50 >> 4) & 0x07) + 1;
-    int rightVol = (nr50 & 0x07) + 1;
-
-    // Each channel: 0..15. Sum 0..60. Center on 0, scale.
-    // Convert to signed centered around 0: subtract midline only if any channel is on?
-    // Standard approach: treat each sample as 0..15 (unsigned DAC), mix unsigned, then convert.
-    // We'll center: ((sample/15)*2 - 1) * volume * masterVol
-    // Approximate with fixed-point: amp ~= 2200 per channel max.
-    int amp = 380; // per-channel scale; 4 channels * 15 * 380 * 8 ~ 182400, fits in 16-bit signed if /4
-    int outL = left  * leftVol  * amp / 32;
-    int outR = right * rightVol * amp / 32;
-    if (muted) { outL = 0; outR = 0; }
-    // Clamp
-    if (outL >  32000) outL =  32000;
-    if (outL < -32000) outL = -32000;
-    if (outR >  32000) outR =  32000;
-    if (outR < -32000) outR = -32000;
-
-    pushSample(static_cast<int16_t>(outL), static_cast<int16_t>(outR));
-}
-
 void APU::triggerCh1() {
     ch1.enabled = ch1.dacOn;
     if (ch1.lengthCounter == 0) ch1.lengthCounter = 64;
@@ -548,4 +505,5 @@ void APU::writeRegister(uint8_t reg, uint8_t val) {
             break;
         }
     }
+    updateLevels();
 }
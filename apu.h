@@ -1,21 +1,37 @@
 #pragma once
 
 #include <cstdint>
-#include <atomic>
 #include <iosfwd>
-#include <SDL.h>
+
+#include "blip.h"
 
 class Memory;
 
 class APU {
 public:
+    static constexpr int SAMPLE_RATE   = 44100;
+    static constexpr int BUFFER_FRAMES = 4096;
+
     explicit APU(Memory& mem);
-    ~APU();
 
-    bool init();
     void reset();
     void step(int cycles);
 
+    // Lazy catch-up: advance to cycle `t` of the core's timeline.
+    void sync(uint64_t t) {
+        if (t > synced) { step(static_cast<int>(t - synced)); synced = t; }
+    }
+    void resetSync(uint64_t t) { synced = t; }
+
+    // Converts everything synthesized since the previous call into samples.
+    // Run once per frame, after the final sync().
+    void endFrame();
+
+    // Interleaved stereo samples produced since the last clearSamples().
+    const int16_t* getSamples() const { return samples; }
+    int  sampleCount() const { return sampleFrames; }
+    void clearSamples() { sampleFrames = 0; }
+
     uint8_t readRegister(uint8_t reg) const;
     void    writeRegister(uint8_t reg, uint8_t val);
 
@@ -27,20 +43,25 @@ public:
 
 private:
     Memory& memory;
+    uint64_t synced = 0;
 
-    SDL_AudioDeviceID device = 0;
-
-    static constexpr int  SAMPLE_RATE   = 44100;
     static constexpr int  CPU_FREQ      = 4194304;
-    static constexpr int  BUFFER_FRAMES = 4096;
 
-    int16_t ring[BUFFER_FRAMES * 2]{};
-    std::atomic<int> writeIdx{0};
-    std::atomic<int> readIdx{0};
+    int16_t samples[BUFFER_FRAMES * 2]{};
+    int     sampleFrames = 0;
 
     int   frameSeqCounter = 0;
     int   frameSeqStep    = 0;
-    double sampleAccum    = 0.0;
+
+    // Channel output changes are timestamped (in cycles since the last
+    // endFrame) into one band-limited buffer per side, instead of being
+    // point-sampled at 44.1 kHz.
+    static constexpr uint32_t MAX_PENDING_CYCLES = 4 * 70224;
+    BlipBuffer blipL{CPU_FREQ, SAMPLE_RATE, BUFFER_FRAMES};
+    BlipBuffer blipR{CPU_FREQ, SAMPLE_RATE, BUFFER_FRAMES};
+    uint32_t   blipTime = 0;
+    int        levelL[4]{}; // last amplitude sent per channel
+    int        levelR[4]{};
 
     bool powered = true;
 
@@ -112,7 +133,7 @@ private:
     void clockEnvelope();
     void clockSweep();
 
-    void tickSquare(Square& c, int cycles);
+    void tickSquare(Square& c, int ch, int cycles);
     void tickWave(Wave& c, int cycles);
     void tickNoise(Noise& c, int cycles);
 
@@ -126,8 +147,6 @@ private:
     int waveOutput(const Wave& c) const;
     int noiseOutput(const Noise& c) const;
 
-    void produceSample();
-    void pushSample(int16_t l, int16_t r);
-
-    static void audioCallback(void* userdata, Uint8* stream, int len);
+    void setLevel(int ch, int level, uint32_t time);
+    void updateLevels();
 };
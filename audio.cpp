@@ -0,0 +1,139 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+AudioOutput::~AudioOutput() {
+    if (device) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+}
+
+bool AudioOutput::init(int sampleRate) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        std::cerr << "SDL audio init failed: " << SDL_GetError() << '\n';
+        return false;
+    }
+    SDL_AudioSpec want{}, have{};
+    want.freq     = sampleRate;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples  = DEVICE_FRAMES;
+    want.callback = &AudioOutput::audioCallback;
+    want.userdata = this;
+    // The resampler bridges any rate mismatch, so take what the device likes.
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have,
+                                 SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (device == 0) {
+        std::cerr << "SDL_OpenAudioDevice failed: " << SDL_GetError() << '\n';
+        return false;
+    }
+    inputRate  = sampleRate;
+    outputRate = have.freq;
+    targetFill = std::min(outputRate * TARGET_LATENCY_MS / 1000.0, RING_FRAMES / 2.0);
+    resetResampler();
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void AudioOutput::resetResampler() {
+    phase = 0.0;
+    avgFill = targetFill;
+    prevL = prevR = 0;
+    decimCount = 0;
+    decimL = decimR = 0;
+}
+
+void AudioOutput::clear() {
+    // Drain the ring so we don't play stale samples.
+    if (device) SDL_LockAudioDevice(device);
+    writeIdx.store(0);
+    readIdx.store(0);
+    std::memset(ring, 0, sizeof(ring));
+    resetResampler();
+    if (device) SDL_UnlockAudioDevice(device);
+}
+
+void AudioOutput::setSpeed(int factor) {
+    factor = std::max(factor, 1);
+    if (factor == speed) return;
+    speed = factor;
+    decimCount = 0;
+    decimL = decimR = 0;
+}
+
+int AudioOutput::bufferedFrames() const {
+    uint32_t w = writeIdx.load(std::memory_order_relaxed);
+    uint32_t r = readIdx.load(std::memory_order_acquire);
+    return static_cast<int>(w - r);
+}
+
+void AudioOutput::audioCallback(void* userdata, Uint8* stream, int len) {
+    AudioOutput* self = static_cast<AudioOutput*>(userdata);
+    int16_t* out = reinterpret_cast<int16_t*>(stream);
+    int frames = len / (2 * sizeof(int16_t));
+    uint32_t r = self->readIdx.load(std::memory_order_relaxed);
+    uint32_t w = self->writeIdx.load(std::memory_order_acquire);
+    int take = std::min(frames, static_cast<int>(w - r));
+    // Count the callback that runs dry partway through, so each stall is
+    // one underrun and an idle ring (menu, pause) is none.
+    if (take > 0 && take < frames) self->underrunCount.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < take; ++i, ++r) {
+        out[i * 2]     = self->ring[(r & RING_MASK) * 2];
+        out[i * 2 + 1] = self->ring[(r & RING_MASK) * 2 + 1];
+    }
+    for (int i = take; i < frames; ++i) {
+        out[i * 2]     = 0;
+        out[i * 2 + 1] = 0;
+    }
+    self->readIdx.store(r, std::memory_order_release);
+}
+
+void AudioOutput::push(const int16_t* samples, int frames) {
+    if (!device) return;
+    uint32_t w = writeIdx.load(std::memory_order_relaxed);
+    uint32_t r = readIdx.load(std::memory_order_acquire);
+
+    // Dynamic rate control: run slightly fast when the ring is below target
+    // and slightly slow above it. The callback drains in DEVICE_FRAMES
+    // bursts, so steer on a smoothed fill level rather than the raw one.
+    avgFill += (static_cast<double>(w - r) - avgFill) * 0.1;
+    double error = std::clamp((avgFill - targetFill) / targetFill, -1.0, 1.0);
+    double step = static_cast<double>(inputRate) / outputRate * rateScale *
+                  (1.0 + error * MAX_RATE_DELTA);
+
+    for (int i = 0; i < frames; ++i) {
+        int16_t l = samples[i * 2];
+        int16_t rr = samples[i * 2 + 1];
+        if (speed > 1) {
+            // Box-filter decimation for fast-forward.
+            decimL += l;
+            decimR += rr;
+            if (++decimCount < speed) continue;
+            l  = static_cast<int16_t>(decimL / speed);
+            rr = static_cast<int16_t>(decimR / speed);
+            decimCount = 0;
+            decimL = decimR = 0;
+        }
+        // Linear interpolation between the previous and current input.
+        while (phase < 1.0) {
+            if (w - r >= static_cast<uint32_t>(RING_FRAMES)) {
+                // Only reachable after a long consumer stall; rate control
+                // keeps the ring near target otherwise.
+                r = readIdx.load(std::memory_order_acquire);
+                if (w - r >= static_cast<uint32_t>(RING_FRAMES)) break;
+            }
+            uint32_t slot = (w & RING_MASK) * 2;
+            ring[slot]     = static_cast<int16_t>(prevL + (l  - prevL) * phase);
+            ring[slot + 1] = static_cast<int16_t>(prevR + (rr - prevR) * phase);
+            ++w;
+            phase += step;
+        }
+        phase = std::max(phase - 1.0, 0.0);
+        prevL = l;
+        prevR = rr;
+    }
+    writeIdx.store(w, std::memory_order_release);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <SDL.h>
+
+// SDL audio device fed from the samples the core produces each frame.
+//
+// The emulation thread is the only producer and the SDL callback the only
+// consumer, so the ring needs no lock. Instead of dropping samples when the
+// ring fills, push() resamples to the device rate and nudges the ratio by up
+// to MAX_RATE_DELTA to hold the fill level near TARGET_LATENCY_MS.
+class AudioOutput {
+public:
+    AudioOutput() = default;
+    ~AudioOutput();
+
+    bool init(int sampleRate);
+    void push(const int16_t* samples, int frames);
+    void clear();
+
+    // While fast-forwarding `factor` frames per host frame, average every
+    // `factor` input samples into one so the ring sees real-time input.
+    void setSpeed(int factor);
+
+    // Emulation running `scale` times faster than real hardware (vsync
+    // pacing on a 60 Hz display); scales the resampling ratio to match.
+    void setRateScale(double scale) { rateScale = scale; }
+
+    bool isOpen() const { return device != 0; }
+    // Frames queued for the device, as seen by the producer.
+    int bufferedFrames() const;
+    int targetFrames() const { return static_cast<int>(targetFill); }
+    int deviceRate() const { return outputRate; }
+    // Times the device has run dry mid-stream.
+    uint32_t underruns() const { return underrunCount.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int      RING_FRAMES = 4096; // must be a power of two
+    static constexpr uint32_t RING_MASK   = RING_FRAMES - 1;
+    static constexpr int      DEVICE_FRAMES = 512;
+    static constexpr double   TARGET_LATENCY_MS = 20.0;
+    static constexpr double   MAX_RATE_DELTA = 0.005;
+    static_assert((RING_FRAMES & RING_MASK) == 0, "ring size must be a power of two");
+
+    SDL_AudioDeviceID device = 0;
+    int    inputRate  = 0;
+    int    outputRate = 0;
+    double targetFill = 0.0;
+    double rateScale  = 1.0;
+
+    int16_t ring[RING_FRAMES * 2]{};
+    // Free-running indices; each on its own cache line so the producer and
+    // the callback do not false-share.
+    alignas(64) std::atomic<uint32_t> writeIdx{0};
+    alignas(64) std::atomic<uint32_t> readIdx{0};
+    std::atomic<uint32_t> underrunCount{0};
+
+    // Producer-only resampler state.
+    alignas(64) double phase = 0.0;
+    double  avgFill = 0.0;
+    int16_t prevL = 0, prevR = 0;
+    int     speed = 1;
+    int     decimCount = 0;
+    int32_t decimL = 0, decimR = 0;
+
+    void resetResampler();
+    static void audioCallback(void* userdata, Uint8* stream, int len);
+};
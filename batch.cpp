@@ -0,0 +1,442 @@
+#include "core.h"
+#include "hash.h"
+#include "image.h"
+#include "movie.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Runs many independent emulator instances in parallel. Each worker thread
+// owns one Core that it reuses for every job it runs; jobs start out split
+// evenly across workers, and idle workers steal from the back of the
+// busiest queues.
+//
+// Manifest: one JSON object per line, e.g.
+//   {"id": "boot-7", "rom": "roms/test.gb", "frames": 3600, "seed": 7}
+// Optional keys: "movie" (replay its inputs and check its hashes) and
+// "snapshot" (write the final frame as PPM). Results are JSONL in manifest
+// order.
+
+namespace {
+void printUsage(const char* argv0) {
+    std::cerr <<
+        "Usage: " << argv0 << " <manifest.jsonl> <results.jsonl> [options]\n"
+        "  --jobs N           Worker threads (default: hardware threads)\n"
+        "  --frames N         Frames per job when the manifest omits it (default 600)\n"
+        "  --snapshot-dir DIR Write every job's final frame to DIR/<id>.ppm\n"
+        "  --pin              Pin worker N to CPU N (Linux)\n"
+        "  --frameskip N      Draw one frame in N (and always the last)\n"
+        "  --render-thread    Give each worker a second thread for drawing\n";
+}
+
+struct Job {
+    std::string id;
+    std::string rom;
+    std::string movie;
+    std::string snapshot;
+    long     frames = -1;
+    uint64_t seed   = 0;   // 0 = no input
+};
+
+// Just enough JSON for flat objects of strings, numbers and booleans.
+class ManifestLine {
+public:
+    explicit ManifestLine(const std::string& s) : text(s) {}
+
+    bool parse(std::vector<std::pair<std::string, std::string>>& out) {
+        skipSpace();
+        if (!consume('{')) return false;
+        skipSpace();
+        if (consume('}')) return true;
+        for (;;) {
+            std::string key, value;
+            skipSpace();
+            if (!parseString(key)) return false;
+            skipSpace();
+            if (!consume(':')) return false;
+            skipSpace();
+            if (pos < text.size() && text[pos] == '"') {
+                if (!parseString(value)) return false;
+            } else {
+                while (pos < text.size() && text[pos] != ',' && text[pos] != '}' &&
+                       text[pos] != ' ' && text[pos] != '\t') {
+                    value += text[pos++];
+                }
+                if (value.empty()) return false;
+            }
+            out.emplace_back(std::move(key), std::move(value));
+            skipSpace();
+            if (consume('}')) return true;
+            if (!consume(',')) return false;
+        }
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                     text[pos] == '\r' || text[pos] == '\n')) ++pos;
+    }
+    bool consume(char c) {
+        if (pos < text.size() && text[pos] == c) { ++pos; return true; }
+        return false;
+    }
+    bool parseString(std::string& out) {
+        if (!consume('"')) return false;
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') return true;
+            if (c != '\\') { out += c; continue; }
+            if (pos >= text.size()) return false;
+            char e = text[pos++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'u':
+                    // Only needed for control characters in practice.
+                    if (pos + 4 > text.size()) return false;
+                    out += static_cast<char>(std::strtol(text.substr(pos, 4).c_str(), nullptr, 16));
+                    pos += 4;
+                    break;
+                default:  out += e; break;
+            }
+        }
+        return false;
+    }
+};
+
+std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20 || c >= 0x7F) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out;
+}
+
+std::string hex64(uint64_t v) {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(v));
+    return buf;
+}
+
+bool loadManifest(const std::string& path, long defaultFrames, std::vector<Job>& jobs) {
+    std::ifstream f(path);
+    if (!f) {
+        std::cerr << "Cannot open manifest: " << path << '\n';
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(f, line)) {
+        ++lineNo;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::vector<std::pair<std::string, std::string>> fields;
+        if (!ManifestLine(line).parse(fields)) {
+            std::cerr << path << ':' << lineNo << ": malformed JSON\n";
+            return false;
+        }
+        Job job;
+        job.frames = defaultFrames;
+        for (const auto& kv : fields) {
+            if      (kv.first == "id")       job.id = kv.second;
+            else if (kv.first == "rom")      job.rom = kv.second;
+            else if (kv.first == "movie")    job.movie = kv.second;
+            else if (kv.first == "snapshot") job.snapshot = kv.second;
+            else if (kv.first == "frames")   job.frames = std::strtol(kv.second.c_str(), nullptr, 10);
+            else if (kv.first == "seed")     job.seed = std::strtoull(kv.second.c_str(), nullptr, 10);
+        }
+        if (job.rom.empty()) {
+            std::cerr << path << ':' << lineNo << ": missing \"rom\"\n";
+            return false;
+        }
+        if (job.id.empty()) job.id = std::to_string(jobs.size());
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// splitmix64: a cheap, well-mixed stream from a single seed.
+uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Seeded jobs press a fresh random button set every 8 frames.
+constexpr int SEED_INPUT_PERIOD = 8;
+
+struct Worker {
+    std::mutex       lock;
+    std::deque<int>  queue;
+    Core             core;
+    std::vector<uint8_t> stateBuf;
+    std::vector<uint32_t> argb = std::vector<uint32_t>(SCREEN_WIDTH * SCREEN_HEIGHT);
+};
+
+class Batch {
+public:
+    Batch(std::vector<Job> jobsIn, int workerCount, std::string snapshotDirIn, long frameskipIn,
+          bool renderThread, std::ostream& outIn)
+        : jobs(std::move(jobsIn)), snapshotDir(std::move(snapshotDirIn)), frameskip(frameskipIn),
+          out(outIn),
+          results(jobs.size()), done(jobs.size(), false) {
+        for (int i = 0; i < workerCount; ++i) {
+            workers.emplace_back(new Worker());
+            workers.back()->core.getMemory().setSavePersistence(false);
+            workers.back()->core.getPPU().setThreadedRendering(renderThread);
+        }
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            workers[j % workers.size()]->queue.push_back(static_cast<int>(j));
+        }
+    }
+    ~Batch() {
+        for (Worker* w : workers) delete w;
+    }
+
+    void run(bool pin) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            threads.emplace_back([this, i] { workerLoop(i); });
+#ifdef __linux__
+            if (pin) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(static_cast<int>(i % std::thread::hardware_concurrency()), &set);
+                pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set);
+            }
+#else
+            (void)pin;
+#endif
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    long framesRun() const { return totalFrames.load(); }
+    int  failures() const  { return failed.load(); }
+
+private:
+    std::vector<Job>     jobs;
+    std::string          snapshotDir;
+    long                 frameskip;
+    std::ostream&        out;
+    std::vector<Worker*> workers;
+
+    std::mutex               outLock;
+    std::vector<std::string> results;
+    std::vector<bool>        done;
+    size_t                   nextToWrite = 0;
+
+    std::atomic<long> totalFrames{0};
+    std::atomic<int>  failed{0};
+
+    bool takeJob(size_t self, int& job) {
+        {
+            Worker& w = *workers[self];
+            std::lock_guard<std::mutex> g(w.lock);
+            if (!w.queue.empty()) {
+                job = w.queue.front();
+                w.queue.pop_front();
+                return true;
+            }
+        }
+        // Steal from the back of another worker's queue.
+        for (size_t k = 1; k < workers.size(); ++k) {
+            Worker& v = *workers[(self + k) % workers.size()];
+            std::lock_guard<std::mutex> g(v.lock);
+            if (!v.queue.empty()) {
+                job = v.queue.back();
+                v.queue.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        int job = 0;
+        while (takeJob(self, job)) {
+            std::string line = runJob(*workers[self], jobs[job]);
+            publish(static_cast<size_t>(job), std::move(line));
+        }
+    }
+
+    // Results are buffered until every earlier job has finished, so the
+    // output file is in manifest order regardless of scheduling.
+    void publish(size_t index, std::string line) {
+        std::lock_guard<std::mutex> g(outLock);
+        results[index] = std::move(line);
+        done[index] = true;
+        while (nextToWrite < done.size() && done[nextToWrite]) {
+            out << results[nextToWrite] << '\n';
+            results[nextToWrite].clear();
+            ++nextToWrite;
+        }
+        out.flush();
+    }
+
+    std::string failure(const Job& job, const std::string& error) {
+        ++failed;
+        return "{\"id\":\"" + jsonEscape(job.id) + "\",\"rom\":\"" + jsonEscape(job.rom) +
+               "\",\"ok\":false,\"error\":\"" + jsonEscape(error) + "\"}";
+    }
+
+    std::string runJob(Worker& w, const Job& job) {
+        Core& core = w.core;
+        // Start every job from power-on state, whatever ran before it.
+        core.unloadROM();
+        if (!core.loadROM(job.rom)) return failure(job, "cannot load ROM");
+
+        Movie movie;
+        long frames = job.frames;
+        if (!job.movie.empty()) {
+            if (!movie.load(job.movie)) return failure(job, "cannot load movie");
+            if (!movie.restoreStart(core)) return failure(job, "movie start state does not fit ROM");
+            long length = static_cast<long>(movie.frameCount());
+            if (frames < 0 || frames > length) frames = length;
+        }
+        if (frames < 0) frames = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t rng = job.seed;
+        uint8_t buttons = 0x0F, dpad = 0x0F;
+        long desync = -1;
+        long ran = 0;
+        // Movie hashes cover the framebuffer, so checking them needs every frame drawn.
+        bool drawAll = frameskip == 1 || movie.hasHashes();
+        for (; ran < frames; ++ran) {
+            if (!job.movie.empty()) {
+                buttons = movie.buttons(ran);
+                dpad = movie.dpad(ran);
+            } else if (job.seed != 0 && ran % SEED_INPUT_PERIOD == 0) {
+                uint64_t r = nextRandom(rng);
+                buttons = uint8_t(r & 0x0F);
+                dpad = uint8_t((r >> 4) & 0x0F);
+            }
+            core.setJoypadState(buttons, dpad);
+            core.runFrame(drawAll || (ran + 1) % frameskip == 0 || ran + 1 == frames);
+            if (!job.movie.empty() && movie.hasHashes() &&
+                Movie::frameHash(core) != movie.expectedHash(ran)) {
+                desync = ran;
+                ++ran;
+                break;
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        totalFrames += ran;
+
+        size_t stateSize = core.serialize(w.stateBuf, false);
+        core.getPPU().colorizeFramebuffer(w.argb.data());
+        uint64_t fbHash = fnv1a(w.argb.data(), w.argb.size() * sizeof(uint32_t));
+
+        std::string snapshot = job.snapshot;
+        if (snapshot.empty() && !snapshotDir.empty()) snapshot = snapshotDir + "/" + job.id + ".ppm";
+        if (!snapshot.empty() && !writePPM(snapshot, w.argb.data())) {
+            return failure(job, "cannot write snapshot " + snapshot);
+        }
+
+        char timing[64];
+        std::snprintf(timing, sizeof(timing), "%.3f", secs);
+        std::string line = "{\"id\":\"" + jsonEscape(job.id) + "\",\"rom\":\"" + jsonEscape(job.rom) + "\"";
+        line += ",\"ok\":" + std::string(desync < 0 ? "true" : "false");
+        line += ",\"frames\":" + std::to_string(ran);
+        line += ",\"seconds\":" + std::string(timing);
+        line += ",\"state_hash\":\"" + hex64(fnv1a(w.stateBuf.data(), stateSize)) + "\"";
+        line += ",\"framebuffer_hash\":\"" + hex64(fbHash) + "\"";
+        if (!snapshot.empty()) line += ",\"snapshot\":\"" + jsonEscape(snapshot) + "\"";
+        line += ",\"serial\":\"" + jsonEscape(core.getMemory().getSerialOutput()) + "\"";
+        if (desync >= 0) {
+            ++failed;
+            line += ",\"desync_frame\":" + std::to_string(desync);
+        }
+        line += "}";
+        return line;
+    }
+};
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    int workerCount = static_cast<int>(std::thread::hardware_concurrency());
+    long frames = 600;
+    std::string snapshotDir;
+    long frameskip = 1;
+    bool renderThread = false;
+    bool pin = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            workerCount = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--snapshot-dir") == 0 && i + 1 < argc) {
+            snapshotDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            pin = true;
+        } else if (std::strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+            frameskip = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--render-thread") == 0) {
+            renderThread = true;
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    if (positional.size() != 2 || frames < 0 || frameskip < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (workerCount < 1) workerCount = 1;
+
+    std::vector<Job> jobs;
+    if (!loadManifest(positional[0], frames, jobs)) return 1;
+    std::ofstream out(positional[1], std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write results: " << positional[1] << '\n';
+        return 1;
+    }
+    if (workerCount > static_cast<int>(jobs.size()) && !jobs.empty()) {
+        workerCount = static_cast<int>(jobs.size());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Batch batch(std::move(jobs), workerCount, snapshotDir, frameskip, renderThread, out);
+    batch.run(pin);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::fprintf(stderr, "workers=%d frames=%ld seconds=%.3f fps=%.1f failed=%d\n",
+                 workerCount, batch.framesRun(), secs,
+                 secs > 0 ? batch.framesRun() / secs : 0.0, batch.failures());
+    return batch.failures() == 0 ? 0 : 2;
+}
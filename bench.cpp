@@ -0,0 +1,560 @@
+#include "core.h"
+#include "hash.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Micro- and macro-benchmarks for the core (`make bench`).
+//
+// Every benchmark does a fixed amount of work with fixed seeds, once to warm
+// up and then --reps times, and reports the median, min and max. Results are
+// JSONL, one object per benchmark:
+//   {"bench":"cpu.alu","kind":"micro","unit":"ns/instr","median":1.9,...}
+// Macro results also carry the final framebuffer hash, so a faster build
+// that renders something different shows up too.
+
+namespace fs = std::filesystem;
+
+namespace {
+void printUsage(const char* argv0) {
+    std::cerr <<
+        "Usage: " << argv0 << " [options] [rom.gb ...]\n"
+        "  --out FILE     Write results as JSONL (default bench.jsonl)\n"
+        "  --reps N       Timed repetitions per benchmark (default 5)\n"
+        "  --frames N     Frames per ROM benchmark (default 1200)\n"
+        "  --filter NAME  Only run benchmarks whose name starts with NAME\n"
+        "  --idle-skip    Fast-forward LY/STAT polling loops in ROM benchmarks\n"
+        "  --no-block-cache  Fetch and decode every instruction (A/B runs)\n"
+        "  --render-thread   Draw scanlines on a worker thread in ROM benchmarks\n"
+        "ROMs given on the command line are run headless after the built-in\n"
+        "synthetic ROM.\n";
+}
+
+using clock = std::chrono::steady_clock;
+
+struct Stats {
+    double median = 0.0;
+    double min    = 0.0;
+    double max    = 0.0;
+};
+
+Stats summarize(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    Stats s;
+    s.min = v.front();
+    s.max = v.back();
+    size_t n = v.size();
+    s.median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+    return s;
+}
+
+// Runs `body` once untimed, then `reps` times; returns ns per op.
+template <typename F>
+Stats measure(int reps, double ops, F&& body) {
+    body();
+    std::vector<double> ns;
+    for (int r = 0; r < reps; ++r) {
+        auto start = clock::now();
+        body();
+        double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        ns.push_back(elapsed / ops);
+    }
+    return summarize(ns);
+}
+
+// Keeps results observable so the compiler cannot drop the work.
+volatile uint64_t sink;
+
+uint64_t nextRandom(uint64_t& state) {
+    // xorshift64*: fixed seeds give the same inputs on every run.
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+}
+
+// 32 KiB ROM-only cartridge assembled by hand. The cartridge entry point
+// jumps to 0x150, where the program goes.
+class RomImage {
+public:
+    RomImage() : bytes(0x8000, 0) {
+        at(0x100).emit({0x00, 0xC3, 0x50, 0x01}); // NOP; JP 0x0150
+        std::memcpy(&bytes[0x134], "BENCH", 5);
+        at(0x150);
+    }
+    RomImage& at(uint16_t addr) { pc = addr; return *this; }
+    RomImage& emit(std::initializer_list<uint8_t> bs) {
+        for (uint8_t b : bs) bytes[pc++] = b;
+        return *this;
+    }
+    RomImage& repeat(int n, std::initializer_list<uint8_t> bs) {
+        for (int i = 0; i < n; ++i) emit(bs);
+        return *this;
+    }
+    uint16_t here() const { return pc; }
+    RomImage& jp(uint16_t target) { return emit({0xC3, uint8_t(target), uint8_t(target >> 8)}); }
+
+    bool save(const fs::path& path) const {
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+        return static_cast<bool>(f.write(reinterpret_cast<const char*>(bytes.data()),
+                                         static_cast<std::streamsize>(bytes.size())));
+    }
+
+    // Memory only loads from files, so go through a temporary one.
+    bool loadInto(Core& core, const std::string& name) const {
+        fs::path path = tempPath(name);
+        core.unloadROM();
+        bool ok = save(path) && core.loadROM(path.string());
+        std::error_code ec;
+        fs::remove(path, ec);
+        return ok;
+    }
+
+    static fs::path tempPath(const std::string& name) {
+        return fs::temp_directory_path() / ("gb-bench-" + name + ".gb");
+    }
+
+private:
+    std::vector<uint8_t> bytes;
+    uint16_t pc = 0;
+};
+
+class Bench {
+public:
+    Bench(std::ostream& out, int reps, const std::string& filter)
+        : out(out), reps(reps), filter(filter) {}
+
+    bool wants(const std::string& name) const {
+        return name.compare(0, filter.size(), filter) == 0;
+    }
+
+    void micro(const std::string& name, const char* unit, double ops, const Stats& s) {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf),
+                      "{\"bench\":\"%s\",\"kind\":\"micro\",\"unit\":\"%s\",\"median\":%.4f,"
+                      "\"min\":%.4f,\"max\":%.4f,\"ops\":%.0f,\"reps\":%d}",
+                      name.c_str(), unit, s.median, s.min, s.max, ops, reps);
+        line(buf);
+    }
+
+    void line(const std::string& s) {
+        out << s << '\n';
+        std::cout << s << '\n';
+    }
+
+    std::ostream& out;
+    const int reps;
+    const std::string filter;
+};
+
+// --- CPU: straight-line instruction streams, looped with a JP ------------
+
+void benchCPU(Bench& b, Core& core) {
+    constexpr double INSTRUCTIONS = 4e6;
+    struct Stream { const char* name; void (*build)(RomImage&); };
+    static const Stream streams[] = {
+        { "cpu.alu", [](RomImage& r) {
+            uint16_t loop = r.here();
+            r.repeat(16, {0x80, 0xA9, 0x14, 0x1D, 0xA4, 0xB5, 0x2F, 0xC6, 0x11}); // ADD B; XOR C; INC D; DEC E; AND H; OR L; CPL; ADD n
+            r.jp(loop);
+        }},
+        { "cpu.load", [](RomImage& r) {
+            r.emit({0x11, 0x00, 0xC1});                 // LD DE,0xC100
+            uint16_t loop = r.here();
+            r.emit({0x21, 0x00, 0xC0});                 // LD HL,0xC000
+            r.repeat(16, {0x2A, 0x12, 0x47, 0x70, 0x1C, 0x4E}); // LD A,(HL+); LD (DE),A; LD B,A; LD (HL),B; INC E; LD C,(HL)
+            r.jp(loop);
+        }},
+        { "cpu.branch", [](RomImage& r) {
+            // The subroutine sits in front of the loop it is called from.
+            r.emit({0x18, 0x03});                       // JR +3
+            uint16_t sub = r.here();
+            r.emit({0x3C, 0xC9, 0x00});                 // INC A; RET; (pad)
+            uint16_t loop = r.here();
+            for (int i = 0; i < 16; ++i) {
+                r.emit({0xCD, uint8_t(sub), uint8_t(sub >> 8)}); // CALL sub
+                r.emit({0xB7, 0x20, 0x00});             // OR A; JR NZ,+0
+                r.emit({0x28, 0x00});                   // JR Z,+0
+            }
+            r.jp(loop);
+        }},
+        { "cpu.cb", [](RomImage& r) {
+            r.emit({0x21, 0x00, 0xC0});                 // LD HL,0xC000
+            uint16_t loop = r.here();
+            r.repeat(16, {0xCB, 0x11, 0xCB, 0x7F, 0xCB, 0x37, 0xCB, 0xC6, 0xCB, 0x3A}); // RL C; BIT 7,A; SWAP A; SET 0,(HL); SRL D
+            r.jp(loop);
+        }},
+    };
+    for (const Stream& s : streams) {
+        if (!b.wants(s.name)) continue;
+        RomImage rom;
+        s.build(rom);
+        if (!rom.loadInto(core, s.name)) continue;
+        CPU& cpu = core.getCPU();
+        Stats st = measure(b.reps, INSTRUCTIONS, [&] {
+            uint64_t cycles = 0;
+            for (long i = 0; i < static_cast<long>(INSTRUCTIONS); ++i) cycles += cpu.step();
+            sink = cycles;
+        });
+        b.micro(s.name, "ns/instr", INSTRUCTIONS, st);
+    }
+}
+
+// --- PPU: whole frames of scanlines under different LCDC loads -----------
+
+void fillVideoMemory(Memory& mem, int spriteCount) {
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    mem.write(0xFF40, 0x00); // LCD off while we fill VRAM and OAM
+    for (uint16_t a = 0x8000; a < 0xA000; ++a) mem.write(a, uint8_t(nextRandom(rng)));
+    for (int i = 0; i < 40; ++i) {
+        uint16_t o = static_cast<uint16_t>(0xFE00 + i * 4);
+        // Park unused sprites off-screen; spread the rest over all lines.
+        uint8_t y = i < spriteCount ? uint8_t(16 + (i * 37) % 144) : 0;
+        mem.write(o,     y);
+        mem.write(o + 1, uint8_t(8 + (i * 53) % 160));
+        mem.write(o + 2, uint8_t(nextRandom(rng)));
+        mem.write(o + 3, uint8_t(nextRandom(rng) & 0xF0));
+    }
+    mem.write(0xFF47, 0xE4);
+    mem.write(0xFF48, 0xE4);
+    mem.write(0xFF49, 0x1B);
+    mem.write(0xFF42, 3);   // SCY
+    mem.write(0xFF43, 5);   // SCX
+    mem.write(0xFF4A, 40);  // WY
+    mem.write(0xFF4B, 47);  // WX
+}
+
+void benchPPU(Bench& b, Core& core) {
+    constexpr int FRAMES = 300;
+    struct Load { const char* name; uint8_t lcdc; int sprites; };
+    static const Load loads[] = {
+        { "ppu.bg",          0x91, 0  },
+        { "ppu.bg_window",   0xB1, 0  },
+        { "ppu.sprites8x8",  0x93, 40 },
+        { "ppu.sprites8x16", 0x97, 40 },
+        { "ppu.all",         0xF7, 40 },
+    };
+    RomImage rom;
+    rom.emit({0x18, 0xFE}); // JR -2
+    bool loaded = false;
+    for (const Load& l : loads) {
+        if (!b.wants(l.name)) continue;
+        if (!loaded && !(loaded = rom.loadInto(core, "ppu"))) return;
+        Memory& mem = core.getMemory();
+        PPU& ppu = core.getPPU();
+        fillVideoMemory(mem, l.sprites);
+        mem.write(0xFF40, l.lcdc);
+        Stats st = measure(b.reps, double(FRAMES) * SCREEN_HEIGHT, [&] {
+            for (int f = 0; f < FRAMES; ++f) ppu.step(Core::CYCLES_PER_FRAME);
+            sink = ppu.getFramebuffer()[SCREEN_WIDTH * SCREEN_HEIGHT / 2];
+        });
+        b.micro(l.name, "ns/scanline", double(FRAMES) * SCREEN_HEIGHT, st);
+    }
+}
+
+// --- APU: channel stepping plus band-limited synthesis -------------------
+
+void benchAPU(Bench& b, Core& core) {
+    constexpr int FRAMES = 600;
+    struct Setup { const char* name; std::vector<std::pair<uint16_t, uint8_t>> regs; };
+    const Setup setups[] = {
+        { "apu.idle", {{0xFF26, 0x80}} },
+        { "apu.tones", {
+            {0xFF26, 0x80}, {0xFF24, 0x77}, {0xFF25, 0xFF},
+            {0xFF11, 0x80}, {0xFF12, 0xF0}, {0xFF13, 0x00}, {0xFF14, 0x87}, // ch1 ~523 Hz
+            {0xFF16, 0x40}, {0xFF17, 0xF0}, {0xFF18, 0x8A}, {0xFF19, 0x86}, // ch2
+            {0xFF1A, 0x80}, {0xFF1C, 0x20}, {0xFF1D, 0x00}, {0xFF1E, 0x87}, // ch3
+        }},
+        { "apu.noise", {
+            {0xFF26, 0x80}, {0xFF24, 0x77}, {0xFF25, 0xFF},
+            {0xFF21, 0xF0}, {0xFF22, 0x10}, {0xFF23, 0x80},                 // ch4, fast LFSR
+        }},
+    };
+    RomImage rom;
+    rom.emit({0x18, 0xFE}); // JR -2
+    bool loaded = false;
+    for (const Setup& s : setups) {
+        if (!b.wants(s.name)) continue;
+        if (!loaded && !(loaded = rom.loadInto(core, "apu"))) return;
+        Memory& mem = core.getMemory();
+        APU& apu = core.getAPU();
+        mem.write(0xFF26, 0x00); // power-cycle to clear the previous setup
+        for (int i = 0; i < 16; ++i) mem.write(static_cast<uint16_t>(0xFF30 + i), uint8_t(i * 0x11));
+        for (const auto& r : s.regs) mem.write(r.first, r.second);
+        uint64_t samples = 0;
+        Stats st = measure(b.reps, FRAMES, [&] {
+            samples = 0;
+            for (int f = 0; f < FRAMES; ++f) {
+                apu.step(Core::CYCLES_PER_FRAME);
+                apu.endFrame();
+                samples += static_cast<uint64_t>(apu.sampleCount());
+                apu.clearSamples();
+            }
+            sink = samples;
+        });
+        b.micro(s.name, "ns/frame", FRAMES, st);
+        double perSample = samples ? double(samples) / FRAMES : 1.0;
+        Stats ps{st.median / perSample, st.min / perSample, st.max / perSample};
+        b.micro(std::string(s.name) + ".per_sample", "ns/sample", double(samples), ps);
+    }
+}
+
+// --- Memory::read dispatch per region ------------------------------------
+
+void benchMemory(Bench& b, Core& core) {
+    constexpr int ADDRS = 4096;
+    constexpr int PASSES = 512;
+    struct Region { const char* name; uint16_t lo, hi; };
+    static const Region regions[] = {
+        { "mem.read.rom0", 0x0000, 0x3FFF },
+        { "mem.read.romx", 0x4000, 0x7FFF },
+        { "mem.read.vram", 0x8000, 0x9FFF },
+        { "mem.read.wram", 0xC000, 0xDFFF },
+        { "mem.read.oam",  0xFE00, 0xFE9F },
+        { "mem.read.hram", 0xFF80, 0xFFFE },
+        { "mem.read.mixed", 0x0000, 0xFFFF },
+    };
+    RomImage rom;
+    rom.emit({0x18, 0xFE}); // JR -2
+    bool loaded = false;
+    std::vector<uint16_t> addrs(ADDRS);
+    for (const Region& r : regions) {
+        if (!b.wants(r.name)) continue;
+        if (!loaded && !(loaded = rom.loadInto(core, "mem"))) return;
+        Memory& mem = core.getMemory();
+        uint64_t rng = 0xD1B54A32D192ED03ull;
+        for (uint16_t& a : addrs) {
+            // The mixed stream skips I/O so reads have no side effects.
+            do a = static_cast<uint16_t>(r.lo + nextRandom(rng) % (uint32_t(r.hi) - r.lo + 1));
+            while (a >= 0xFF00 && a < 0xFF80);
+        }
+        Stats st = measure(b.reps, double(ADDRS) * PASSES, [&] {
+            uint64_t sum = 0;
+            for (int p = 0; p < PASSES; ++p) {
+                for (uint16_t a : addrs) sum += mem.read(a);
+            }
+            sink = sum;
+        });
+        b.micro(r.name, "ns/read", double(ADDRS) * PASSES, st);
+    }
+}
+
+// --- Whole ROMs, headless ------------------------------------------------
+
+// A small "game": LCD on with background, window and sprites, one VBlank
+// interrupt per frame that wakes the CPU from HALT to scroll and churn WRAM.
+RomImage syntheticGame() {
+    RomImage r;
+    r.at(0x40).emit({0xD9});                         // VBlank: RETI
+    r.at(0x150);
+    r.emit({0xF3, 0x31, 0xFE, 0xFF});                // DI; LD SP,0xFFFE
+    r.emit({0xAF, 0xE0, 0x40});                      // XOR A; LDH (LCDC),A
+    // Fill 0x8000-0x9FFF (tiles and maps) with L ^ H.
+    r.emit({0x21, 0x00, 0x80});                      // LD HL,0x8000
+    uint16_t fill = r.here();
+    r.emit({0x7D, 0xAC, 0x22, 0x7C, 0xFE, 0xA0});    // LD A,L; XOR H; LD (HL+),A; LD A,H; CP 0xA0
+    r.emit({0x20, uint8_t(fill - (r.here() + 2))});  // JR NZ,fill
+    // 40 sprites: Y = X = 2 * L + 16, tile L, attributes 0.
+    r.emit({0x21, 0x00, 0xFE});                      // LD HL,0xFE00
+    uint16_t oam = r.here();
+    r.emit({0x7D, 0x87, 0xC6, 0x10, 0x22, 0x22, 0x7D, 0x22, 0xAF, 0x22}); // LD A,L; ADD A,A; ADD 16; Y; X; LD A,L; tile; XOR A; attr
+    r.emit({0x7D, 0xFE, 0xA0});                      // LD A,L; CP 0xA0
+    r.emit({0x20, uint8_t(oam - (r.here() + 2))});   // JR NZ,oam
+    r.emit({0x3E, 0xE4, 0xE0, 0x47, 0xE0, 0x48});    // BGP = OBP0 = 0xE4
+    r.emit({0x3E, 0x50, 0xE0, 0x4A, 0xE0, 0x4B});    // WY = WX = 0x50
+    r.emit({0x3E, 0x01, 0xE0, 0xFF});                // IE = VBlank
+    r.emit({0x3E, 0xF3, 0xE0, 0x40});                // LCDC: on, window, 8x8 sprites
+    r.emit({0xFB});                                  // EI
+    uint16_t main = r.here();
+    r.emit({0x76, 0x00});                            // HALT; NOP
+    r.emit({0xF0, 0x43, 0x3C, 0xE0, 0x43});          // SCX++
+    r.emit({0x21, 0x00, 0xC0, 0x06, 0x00});          // LD HL,0xC000; LD B,0
+    uint16_t churn = r.here();
+    r.emit({0x7E, 0x80, 0x22, 0x05});                // LD A,(HL); ADD B; LD (HL+),A; DEC B
+    r.emit({0x20, uint8_t(churn - (r.here() + 2))}); // JR NZ,churn
+    r.jp(main);
+    return r;
+}
+
+void benchROM(Bench& b, Core& core, const std::string& name, const std::string& path, long frames) {
+    if (!b.wants(name)) return;
+    core.unloadROM();
+    if (!core.loadROM(path)) {
+        std::cerr << "Skipping " << path << ": cannot load\n";
+        return;
+    }
+    std::vector<uint8_t> start;
+    size_t startSize = core.serialize(start);
+
+    std::vector<double> ns, fps;
+    uint64_t instructions = 0;
+    uint64_t fbHash = 0;
+    for (int r = 0; r <= b.reps; ++r) {
+        // Every repetition replays the same frames from power-on.
+        core.deserialize(start.data(), startSize);
+        uint64_t before = core.getCPU().getInstructionCount();
+        auto t0 = clock::now();
+        for (long f = 0; f < frames; ++f) core.runFrame();
+        double secs = std::chrono::duration<double>(clock::now() - t0).count();
+        instructions = core.getCPU().getInstructionCount() - before;
+        fbHash = fnv1a(core.getPPU().getFramebuffer(), SCREEN_WIDTH * SCREEN_HEIGHT);
+        if (r == 0) continue; // warm-up
+        fps.push_back(frames / secs);
+        ns.push_back(instructions ? secs * 1e9 / double(instructions) : 0.0);
+    }
+    Stats f = summarize(fps), n = summarize(ns);
+    char buf[512];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"bench\":\"%s\",\"kind\":\"macro\",\"frames\":%ld,\"fps\":%.1f,"
+                  "\"fps_min\":%.1f,\"fps_max\":%.1f,\"ns_per_instr\":%.4f,"
+                  "\"instructions\":%llu,\"reps\":%d,\"framebuffer_hash\":\"%016llx\"}",
+                  name.c_str(), frames, f.median, f.min, f.max, n.median,
+                  static_cast<unsigned long long>(instructions), b.reps,
+                  static_cast<unsigned long long>(fbHash));
+    b.line(buf);
+}
+
+// --- Forking for search loops --------------------------------------------
+
+uint64_t stateHash(const Core& core) {
+    std::vector<uint8_t> state;
+    size_t n = core.serialize(state, false);
+    return fnv1a(state.data(), n);
+}
+
+// A reused child must end up where a fresh fork does, even if it last ran
+// another cartridge whose decoded blocks sit at the same addresses. False
+// on a mismatch, which fails the whole run.
+bool benchFork(Bench& b, bool blockCache) {
+    if (!b.wants("core.fork")) return true;
+    constexpr int FRAMES = 120;
+    RomImage other;
+    uint16_t loop = other.here();
+    other.repeat(16, {0x3C, 0x05, 0xA8}).jp(loop);  // INC A; DEC B; XOR B
+
+    Core parent, reused;
+    for (Core* c : { &parent, &reused }) {
+        c->getMemory().setSavePersistence(false);
+        c->getCPU().setBlockCache(blockCache);
+    }
+    if (!syntheticGame().loadInto(parent, "fork-parent") || !other.loadInto(reused, "fork-other")) {
+        return true;
+    }
+    for (int f = 0; f < 10; ++f) reused.runFrame();
+
+    // Fork at power-on: the child's next blocks start at 0x0100 and 0x0150,
+    // where the other cartridge's are cached.
+    parent.forkInto(reused);
+    std::unique_ptr<Core> fresh = parent.fork();
+    for (int f = 0; f < FRAMES; ++f) {
+        parent.runFrame();
+        reused.runFrame();
+        fresh->runFrame();
+    }
+    uint64_t expect = stateHash(parent);
+    if (stateHash(*fresh) != expect || stateHash(reused) != expect) {
+        std::cerr << "core.fork: a forked core diverged from its parent\n";
+        return false;
+    }
+
+    // Cost of one search-loop node: fork into a reused core, step a frame.
+    constexpr double FORKS = 200;
+    Core::StepSpec spec;
+    std::vector<uint8_t> obs(spec.outputSize());
+    Stats st = measure(b.reps, FORKS, [&] {
+        for (int i = 0; i < static_cast<int>(FORKS); ++i) {
+            parent.forkInto(reused);
+            reused.step(0xFF, 1, spec, obs.data());
+        }
+    });
+    b.micro("core.fork", "ns/step", FORKS, st);
+    return true;
+}
+}
+
+int main(int argc, char* argv[]) {
+    std::string outPath = "bench.jsonl";
+    std::string filter;
+    int  reps = 5;
+    long frames = 1200;
+    std::vector<std::string> roms;
+    bool idleSkip = false;
+    bool blockCache = true;
+    bool renderThread = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--idle-skip") == 0) {
+            idleSkip = true;
+        } else if (std::strcmp(argv[i], "--no-block-cache") == 0) {
+            blockCache = false;
+        } else if (std::strcmp(argv[i], "--render-thread") == 0) {
+            renderThread = true;
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            roms.push_back(argv[i]);
+        }
+    }
+    if (reps < 1 || frames < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::ofstream out(outPath, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write " << outPath << '\n';
+        return 1;
+    }
+
+    Bench b(out, reps, filter);
+    char meta[256];
+    std::snprintf(meta, sizeof(meta),
+                  "{\"bench\":\"meta\",\"decoder\":\"%s\",\"profile\":%s,\"idle_skip\":%s,"
+                  "\"block_cache\":%s,\"render_thread\":%s,\"compiler\":\"%s\"}",
+#ifdef GB_LEGACY_DECODER
+                  "legacy",
+#else
+                  "table",
+#endif
+                  prof::enabled ? "true" : "false", idleSkip ? "true" : "false",
+                  blockCache ? "true" : "false", renderThread ? "true" : "false", __VERSION__);
+    b.line(meta);
+
+    Core core;
+    core.getMemory().setSavePersistence(false);
+    core.getCPU().setBlockCache(blockCache);
+    benchCPU(b, core);
+    benchPPU(b, core);
+    benchAPU(b, core);
+    benchMemory(b, core);
+    core.setIdleLoopSkip(idleSkip);
+    core.getPPU().setThreadedRendering(renderThread);
+
+    if (b.wants("rom.synthetic")) {
+        fs::path path = RomImage::tempPath("synthetic");
+        if (syntheticGame().save(path)) benchROM(b, core, "rom.synthetic", path.string(), frames);
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    for (const std::string& rom : roms) {
+        benchROM(b, core, "rom." + fs::path(rom).stem().string(), rom, frames);
+    }
+    return benchFork(b, blockCache) ? 0 : 1;
+}
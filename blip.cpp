@@ -0,0 +1,107 @@
+#include "blip.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <istream>
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+
+// Blackman-windowed sinc impulses, one per sub-sample phase, each scaled to
+// sum to exactly `unity` so a step settles at its true amplitude.
+struct KernelTable {
+    static constexpr int W = BlipBuffer::KERNEL_WIDTH;
+    int32_t taps[32][W];
+
+    KernelTable(int phases, int unity) {
+        const double cutoff = 0.9; // fraction of Nyquist left unattenuated
+        for (int p = 0; p < phases; ++p) {
+            double frac = double(p) / phases;
+            double v[W];
+            double sum = 0.0;
+            for (int i = 0; i < W; ++i) {
+                double x = i - (W / 2 - 1) - frac;
+                double s = x == 0.0 ? 1.0 : std::sin(kPi * cutoff * x) / (kPi * cutoff * x);
+                double w = 0.42 + 0.5 * std::cos(2 * kPi * x / W) + 0.08 * std::cos(4 * kPi * x / W);
+                v[i] = s * w;
+                sum += v[i];
+            }
+            int total = 0, peak = 0;
+            for (int i = 0; i < W; ++i) {
+                taps[p][i] = static_cast<int32_t>(std::lround(v[i] / sum * unity));
+                total += taps[p][i];
+                if (taps[p][i] > taps[p][peak]) peak = i;
+            }
+            taps[p][peak] += unity - total;
+        }
+    }
+};
+}
+
+BlipBuffer::BlipBuffer(double clockRate, double sampleRate, int maxSamples)
+    : factor(static_cast<uint64_t>(sampleRate / clockRate * 4294967296.0 + 0.5)),
+      buf(static_cast<size_t>(maxSamples) + KERNEL_WIDTH + 1, 0) {
+    static_assert(PHASES <= 32, "kernel table holds at most 32 phases");
+    static const KernelTable table(PHASES, 1 << KERNEL_BITS);
+    kernel = table.taps;
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    integrator = 0;
+    std::fill(buf.begin(), buf.end(), 0);
+}
+
+void BlipBuffer::endFrame(uint32_t clocks) {
+    offset += uint64_t(clocks) * factor;
+}
+
+int BlipBuffer::readSamples(int16_t* out, int count, int stride) {
+    const int avail = samplesAvailable();
+    count = std::min(count, avail);
+    int32_t sum = integrator;
+    for (int i = 0; i < count; ++i) {
+        int32_t s = sum + buf[i];
+        sum = s - (s >> BASS_SHIFT);
+        s >>= KERNEL_BITS;
+        out[i * stride] = static_cast<int16_t>(std::clamp(s, -32768, 32767));
+    }
+    integrator = sum;
+
+    // Slide the unread samples and the kernel tails to the front.
+    const int keep = avail - count + KERNEL_WIDTH;
+    std::memmove(buf.data(), buf.data() + count, size_t(keep) * sizeof(int32_t));
+    std::fill(buf.begin() + keep, buf.begin() + keep + count, 0);
+    offset -= uint64_t(count) << FRAC_BITS;
+    return count;
+}
+
+void BlipBuffer::saveState(std::ostream& out) const {
+    auto W = [&](const auto& x) {
+        out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+    };
+    W(offset);
+    W(integrator);
+    uint32_t pending = static_cast<uint32_t>(samplesAvailable() + KERNEL_WIDTH);
+    W(pending);
+    out.write(reinterpret_cast<const char*>(buf.data()), pending * sizeof(int32_t));
+}
+
+bool BlipBuffer::loadState(std::istream& in) {
+    auto R = [&](auto& x) {
+        return static_cast<bool>(
+            in.read(reinterpret_cast<char*>(&x), sizeof(x)));
+    };
+    uint64_t off = 0;
+    int32_t integ = 0;
+    uint32_t pending = 0;
+    if (!R(off) || !R(integ) || !R(pending)) return false;
+    if (pending != (off >> FRAC_BITS) + KERNEL_WIDTH || pending > buf.size()) return false;
+    std::fill(buf.begin(), buf.end(), 0);
+    if (!in.read(reinterpret_cast<char*>(buf.data()), pending * sizeof(int32_t))) return false;
+    offset = off;
+    integrator = integ;
+    return true;
+}
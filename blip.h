@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Band-limited synthesis buffer. Callers record amplitude changes at their
+// exact clock time with addDelta(); endFrame() then turns everything up to
+// that time into output samples with one integration pass. Each delta is
+// spread over KERNEL_WIDTH samples by a windowed-sinc step, so edges between
+// sample points do not alias the way point-sampling a square wave does.
+class BlipBuffer {
+public:
+    static constexpr int KERNEL_WIDTH = 16;
+
+    BlipBuffer(double clockRate, double sampleRate, int maxSamples);
+
+    void clear();
+
+    // `time` is in clocks since the last endFrame(); at most one frame of
+    // clocks (maxSamples worth) may be pending.
+    void addDelta(uint32_t time, int delta) {
+        uint64_t fixed = offset + uint64_t(time) * factor;
+        const int32_t* k = kernel[(fixed >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+        int32_t* out = &buf[fixed >> FRAC_BITS];
+        for (int i = 0; i < KERNEL_WIDTH; ++i) out[i] += delta * k[i];
+    }
+
+    // Makes the samples up to `clocks` readable and starts a new frame.
+    void endFrame(uint32_t clocks);
+    int  samplesAvailable() const { return static_cast<int>(offset >> FRAC_BITS); }
+
+    // Writes up to `count` samples to `out[i * stride]`; returns how many.
+    int readSamples(int16_t* out, int count, int stride);
+
+    void saveState(std::ostream& out) const;
+    bool loadState(std::istream& in);
+
+private:
+    static constexpr int FRAC_BITS   = 32;
+    static constexpr int PHASE_BITS  = 5;
+    static constexpr int PHASES      = 1 << PHASE_BITS;
+    static constexpr int KERNEL_BITS = 15; // each phase sums to 1 << KERNEL_BITS
+    static constexpr int BASS_SHIFT  = 9;  // DC-blocking high-pass, ~14 Hz at 44.1 kHz
+
+    uint64_t factor = 0; // output samples per clock, FRAC_BITS fixed point
+    uint64_t offset = 0; // fixed-point sample position of the frame start
+    int32_t  integrator = 0;
+    std::vector<int32_t> buf;
+    const int32_t (*kernel)[KERNEL_WIDTH]; // shared table, one row per phase
+};
@@ -0,0 +1,253 @@
+#include "capture.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+// 16-bit stereo PCM. The header's sizes are filled in by close().
+class WavWriter {
+public:
+    ~WavWriter() { close(); }
+
+    bool open(const std::string& p, int rate) {
+        close();
+        file = std::fopen(p.c_str(), "wb");
+        if (!file) return false;
+        sampleRate = rate;
+        dataBytes = 0;
+        failed = false;
+        writeHeader();
+        return !failed;
+    }
+
+    bool write(const int16_t* samples, int frames) {
+        if (!file) return false;
+        buffer.resize(size_t(frames) * 4);
+        for (int i = 0; i < frames * 2; ++i) {
+            uint16_t s = uint16_t(samples ? samples[i] : 0);
+            buffer[size_t(i) * 2]     = uint8_t(s);
+            buffer[size_t(i) * 2 + 1] = uint8_t(s >> 8);
+        }
+        if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true;
+        dataBytes += uint32_t(buffer.size());
+        return !failed;
+    }
+
+    bool close() {
+        if (!file) return true;
+        if (std::fseek(file, 0, SEEK_SET) != 0) failed = true;
+        else writeHeader();
+        if (std::fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+
+private:
+    std::FILE* file = nullptr;
+    int      sampleRate = 0;
+    uint32_t dataBytes = 0;
+    bool     failed = false;
+    std::vector<uint8_t> buffer;
+
+    void writeHeader() {
+        uint8_t h[44];
+        auto put = [&](int at, uint32_t v, int bytes) {
+            for (int i = 0; i < bytes; ++i) h[at + i] = uint8_t(v >> (8 * i));
+        };
+        std::memcpy(h, "RIFF", 4);
+        put(4, 36 + dataBytes, 4);
+        std::memcpy(h + 8, "WAVEfmt ", 8);
+        put(16, 16, 4);
+        put(20, 1, 2);                        // PCM
+        put(22, 2, 2);                        // channels
+        put(24, uint32_t(sampleRate), 4);
+        put(28, uint32_t(sampleRate) * 4, 4); // bytes per second
+        put(32, 4, 2);                        // bytes per frame
+        put(34, 16, 2);                       // bits per sample
+        std::memcpy(h + 36, "data", 4);
+        put(40, dataBytes, 4);
+        if (std::fwrite(h, 1, sizeof(h), file) != sizeof(h)) failed = true;
+    }
+};
+}
+
+Capture::Capture() : pool(POOL_SIZE), queue(POOL_SIZE, 0) {
+    freeSlots.reserve(POOL_SIZE);
+    for (int i = POOL_SIZE - 1; i >= 0; --i) {
+        pool[size_t(i)].path.reserve(256);
+        freeSlots.push_back(i);
+    }
+}
+
+Capture::~Capture() {
+    stopRecording();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+int Capture::acquire(int reserve) {
+    if (int(freeSlots.size()) <= reserve) return -1;
+    int index = freeSlots.back();
+    freeSlots.pop_back();
+    return index;
+}
+
+void Capture::enqueue(int index) {
+    queue[size_t((queueHead + queueCount) % POOL_SIZE)] = index;
+    ++queueCount;
+    if (!worker.joinable()) worker = std::thread(&Capture::run, this);
+    wake.notify_one();
+}
+
+bool Capture::screenshot(const std::string& path, const uint8_t* shades, const uint32_t palette[4]) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int index = acquire(SCREENSHOT_RESERVE);
+    if (index < 0) return false;
+    Slot& s = pool[size_t(index)];
+    s.kind = Kind::Screenshot;
+    s.path = path;
+    std::memcpy(s.shades, shades, sizeof(s.shades));
+    std::memcpy(s.palette, palette, sizeof(s.palette));
+    enqueue(index);
+    return true;
+}
+
+bool Capture::startRecording(const std::string& base, const uint32_t palette[4]) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (recording) return false;
+    int index = acquire(START_RESERVE);
+    if (index < 0) return false;
+    Slot& s = pool[size_t(index)];
+    s.kind = Kind::Start;
+    s.path = base;
+    std::memcpy(s.palette, palette, sizeof(s.palette));
+    stats = Stats();
+    pendingDrops = 0;
+    recording = true;
+    enqueue(index);
+    return true;
+}
+
+void Capture::stopRecording() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording) return;
+    recording = false;
+    // Start left this slot free, and frames and screenshots never take it.
+    int index = acquire(0);
+    Slot& s = pool[size_t(index)];
+    s.kind = Kind::Stop;
+    s.dropsBefore = pendingDrops;
+    enqueue(index);
+}
+
+void Capture::submitFrame(const uint8_t* shades, const int16_t* audio, int audioFrames) {
+    if (!isRecording()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording) return;
+    int index = acquire(FRAME_RESERVE);
+    if (index < 0) {
+        ++pendingDrops;
+        ++stats.framesDropped;
+        return;
+    }
+    Slot& s = pool[size_t(index)];
+    s.kind = Kind::Frame;
+    std::memcpy(s.shades, shades, sizeof(s.shades));
+    s.audioFrames = std::min(std::max(audioFrames, 0), int(APU::BUFFER_FRAMES));
+    if (audio) std::memcpy(s.audio, audio, size_t(s.audioFrames) * 2 * sizeof(int16_t));
+    else       std::memset(s.audio, 0, size_t(s.audioFrames) * 2 * sizeof(int16_t));
+    s.dropsBefore = pendingDrops;
+    pendingDrops = 0;
+    ++stats.framesRecorded;
+    enqueue(index);
+}
+
+Capture::Stats Capture::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void Capture::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return queueCount == 0 && busy == 0; });
+}
+
+void Capture::run() {
+    ApngWriter video;
+    WavWriter  sound;
+    std::string base;
+    bool failed = false;
+    int lastAudioFrames = 0;
+
+    // Hold the last image and the length of its sound for each lost frame.
+    auto fillDrops = [&](uint32_t drops) {
+        for (uint32_t i = 0; i < drops; ++i) {
+            if (!video.repeatFrame() || !sound.write(nullptr, lastAudioFrames)) failed = true;
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (queueCount == 0) {
+            if (stopping) return;
+            wake.wait(lock);
+            continue;
+        }
+        int index = queue[size_t(queueHead)];
+        queueHead = (queueHead + 1) % POOL_SIZE;
+        --queueCount;
+        ++busy;
+        lock.unlock();
+
+        // One write per line so output from other threads can't split it.
+        Slot& s = pool[size_t(index)];
+        switch (s.kind) {
+            case Kind::Screenshot:
+                if (!writePNG(s.path, s.shades, s.palette)) {
+                    std::cerr << "Failed writing screenshot: " + s.path + '\n';
+                }
+                break;
+            case Kind::Start:
+                base = s.path;
+                failed = !video.open(base + ".apng", s.palette) ||
+                         !sound.open(base + ".wav", APU::SAMPLE_RATE);
+                lastAudioFrames = 0;
+                break;
+            case Kind::Frame:
+                if (!video.isOpen()) break;
+                fillDrops(s.dropsBefore);
+                if (!video.addFrame(s.shades) || !sound.write(s.audio, s.audioFrames)) failed = true;
+                lastAudioFrames = s.audioFrames;
+                break;
+            case Kind::Stop: {
+                if (!video.isOpen()) {
+                    std::cerr << "Failed writing capture: " + base + '\n';
+                    break;
+                }
+                fillDrops(s.dropsBefore);
+                uint32_t frames = video.frameCount();
+                if (!video.close()) failed = true;
+                if (!sound.close()) failed = true;
+                if (failed) {
+                    std::cerr << "Failed writing capture: " + base + '\n';
+                } else {
+                    std::cout << "Recorded: " + base + ".apng and .wav (" +
+                                 std::to_string(frames) + " frames)\n" << std::flush;
+                }
+                break;
+            }
+        }
+
+        lock.lock();
+        freeSlots.push_back(index);
+        --busy;
+        done.notify_all();
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "apu.h"
+#include "ppu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Screenshots and gameplay recording, encoded on a worker thread.
+//
+// Callers only copy a frame (and, when recording, its audio) into one of a
+// fixed pool of slots and queue it; the worker turns screenshots into PNGs
+// and recordings into an APNG of every frame plus a WAV of the sound. The
+// pool is allocated once, so queueing never allocates, and it never waits:
+// with the pool full a recorded frame is dropped and counted. For each one
+// the worker shows the previous image again and pads the WAV with as much
+// silence as that frame had sound, so the two files stay in step.
+class Capture {
+public:
+    struct Stats {
+        uint64_t framesRecorded = 0;
+        uint64_t framesDropped = 0;
+    };
+
+    Capture();
+    // Writes everything still queued, finishing any recording.
+    ~Capture();
+    Capture(const Capture&) = delete;
+    Capture& operator=(const Capture&) = delete;
+
+    // Queue a PNG of `shades` in `palette`; false if the queue is full.
+    bool screenshot(const std::string& path, const uint8_t* shades, const uint32_t palette[4]);
+
+    // Record every submitted frame to `<base>.apng`, in `palette`, and its
+    // audio to `<base>.wav`. False if a recording is already running.
+    bool startRecording(const std::string& base, const uint32_t palette[4]);
+    void stopRecording();
+    bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+    // One emulated frame for the recording; ignored when not recording.
+    void submitFrame(const uint8_t* shades, const int16_t* audio, int audioFrames);
+    // Counts for the current (or last) recording.
+    Stats getStats() const;
+
+    // Block until everything queued so far is on disk.
+    void flush();
+
+private:
+    // About a quarter second of recording.
+    static constexpr int POOL_SIZE = 16;
+    // Slots each kind leaves free: recorded frames can't crowd out a
+    // screenshot, and a started recording can always queue its end.
+    static constexpr int FRAME_RESERVE = 3;
+    static constexpr int SCREENSHOT_RESERVE = 1;
+    static constexpr int START_RESERVE = 1;
+
+    enum class Kind : uint8_t { Frame, Screenshot, Start, Stop };
+    struct Slot {
+        Kind     kind = Kind::Frame;
+        uint8_t  shades[SCREEN_WIDTH * SCREEN_HEIGHT];
+        uint32_t palette[4];
+        int16_t  audio[APU::BUFFER_FRAMES * 2];
+        int      audioFrames = 0;
+        uint32_t dropsBefore = 0;  // frames lost just before this one
+        std::string path;
+    };
+
+    std::vector<Slot> pool;
+    std::vector<int>  freeSlots;  // stack of unused slot indices
+    std::vector<int>  queue;      // ring of queued slot indices
+    int  queueHead = 0;
+    int  queueCount = 0;
+    int  busy = 0;                // slots taken off the queue, not yet written
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;  // work queued or shutdown
+    std::condition_variable done;  // a slot was written
+    std::atomic<bool> recording{false};
+    uint32_t pendingDrops = 0;
+    Stats    stats;
+    bool     stopping = false;
+    std::thread worker;
+
+    // Both need `mutex`. acquire() returns -1 unless more than `reserve`
+    // slots are free.
+    int   acquire(int reserve);
+    void  enqueue(int index);
+    void  run();
+};
@@ -0,0 +1,128 @@
+#include "colorize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GB_COLORIZE_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GB_COLORIZE_NEON 1
+#endif
+
+namespace {
+using Kernel = void (*)(const uint8_t*, uint32_t*, int, const uint32_t*);
+
+void colorizeScalar(const uint8_t* shades, uint32_t* out, int count, const uint32_t* palette) {
+    for (int i = 0; i < count; ++i) out[i] = palette[shades[i] & 3];
+}
+
+#if defined(GB_COLORIZE_X86) && defined(__SSE2__)
+// Selects palette entries with the two index bits as lane masks.
+inline __m128i select4(__m128i idx32, const __m128i pal[4]) {
+    __m128i m0 = _mm_srai_epi32(_mm_slli_epi32(idx32, 31), 31);
+    __m128i m1 = _mm_srai_epi32(_mm_slli_epi32(idx32, 30), 31);
+    __m128i a = _mm_or_si128(_mm_and_si128(m0, pal[1]), _mm_andnot_si128(m0, pal[0]));
+    __m128i b = _mm_or_si128(_mm_and_si128(m0, pal[3]), _mm_andnot_si128(m0, pal[2]));
+    return _mm_or_si128(_mm_and_si128(m1, b), _mm_andnot_si128(m1, a));
+}
+
+void colorizeSSE2(const uint8_t* shades, uint32_t* out, int count, const uint32_t* palette) {
+    const __m128i pal[4] = {
+        _mm_set1_epi32(static_cast<int>(palette[0])), _mm_set1_epi32(static_cast<int>(palette[1])),
+        _mm_set1_epi32(static_cast<int>(palette[2])), _mm_set1_epi32(static_cast<int>(palette[3])),
+    };
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i));
+        __m128i lo = _mm_unpacklo_epi8(idx, zero);
+        __m128i hi = _mm_unpackhi_epi8(idx, zero);
+        __m128i* dst = reinterpret_cast<__m128i*>(out + i);
+        _mm_storeu_si128(dst + 0, select4(_mm_unpacklo_epi16(lo, zero), pal));
+        _mm_storeu_si128(dst + 1, select4(_mm_unpackhi_epi16(lo, zero), pal));
+        _mm_storeu_si128(dst + 2, select4(_mm_unpacklo_epi16(hi, zero), pal));
+        _mm_storeu_si128(dst + 3, select4(_mm_unpackhi_epi16(hi, zero), pal));
+    }
+    colorizeScalar(shades + i, out + i, count - i, palette);
+}
+#endif
+
+#if defined(GB_COLORIZE_X86) && defined(__GNUC__)
+// Built for AVX2 regardless of the global -m flags; only called when the
+// CPU reports support. The palette is a single in-register permute.
+__attribute__((target("avx2")))
+void colorizeAVX2(const uint8_t* shades, uint32_t* out, int count, const uint32_t* palette) {
+    const __m256i pal = _mm256_setr_epi32(
+        static_cast<int>(palette[0]), static_cast<int>(palette[1]),
+        static_cast<int>(palette[2]), static_cast<int>(palette[3]),
+        static_cast<int>(palette[0]), static_cast<int>(palette[1]),
+        static_cast<int>(palette[2]), static_cast<int>(palette[3]));
+    const __m256i mask = _mm256_set1_epi32(3);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i));
+        __m256i a = _mm256_and_si256(_mm256_cvtepu8_epi32(idx), mask);
+        __m256i b = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)), mask);
+        __m256i* dst = reinterpret_cast<__m256i*>(out + i);
+        _mm256_storeu_si256(dst + 0, _mm256_permutevar8x32_epi32(pal, a));
+        _mm256_storeu_si256(dst + 1, _mm256_permutevar8x32_epi32(pal, b));
+    }
+    colorizeScalar(shades + i, out + i, count - i, palette);
+}
+#endif
+
+#if defined(GB_COLORIZE_NEON)
+// Looks up each byte plane of the palette with TBL and lets ST4 interleave
+// the planes back into 16 little-endian ARGB pixels.
+void colorizeNEON(const uint8_t* shades, uint32_t* out, int count, const uint32_t* palette) {
+    uint8_t planes[4][16] = {};
+    for (int b = 0; b < 4; ++b) {
+        for (int c = 0; c < 4; ++c) planes[b][c] = uint8_t(palette[c] >> (b * 8));
+    }
+    const uint8x16_t t0 = vld1q_u8(planes[0]), t1 = vld1q_u8(planes[1]);
+    const uint8x16_t t2 = vld1q_u8(planes[2]), t3 = vld1q_u8(planes[3]);
+    const uint8x16_t mask = vdupq_n_u8(3);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t idx = vandq_u8(vld1q_u8(shades + i), mask);
+        uint8x16x4_t px;
+        px.val[0] = vqtbl1q_u8(t0, idx);
+        px.val[1] = vqtbl1q_u8(t1, idx);
+        px.val[2] = vqtbl1q_u8(t2, idx);
+        px.val[3] = vqtbl1q_u8(t3, idx);
+        vst4q_u8(reinterpret_cast<uint8_t*>(out + i), px);
+    }
+    colorizeScalar(shades + i, out + i, count - i, palette);
+}
+#endif
+
+struct Selected {
+    Kernel fn;
+    const char* name;
+};
+
+Selected selectKernel() {
+#if defined(GB_COLORIZE_X86) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) return { colorizeAVX2, "avx2" };
+#endif
+#if defined(GB_COLORIZE_X86) && defined(__SSE2__)
+    return { colorizeSSE2, "sse2" };
+#elif defined(GB_COLORIZE_NEON)
+    return { colorizeNEON, "neon" };
+#else
+    return { colorizeScalar, "scalar" };
+#endif
+}
+
+const Selected& selected() {
+    static const Selected s = selectKernel();
+    return s;
+}
+}
+
+void colorize(const uint8_t* shades, uint32_t* out, int count, const uint32_t palette[4]) {
+    selected().fn(shades, out, count, palette);
+}
+
+const char* colorizeKernel() {
+    return selected().name;
+}
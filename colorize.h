@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// Expands 2-bit shade indices (0-3) into 32-bit ARGB pixels through a
+// 4-entry palette. The kernel (AVX2, SSE2, NEON or plain C++) is picked
+// once at startup from what the host CPU supports.
+void colorize(const uint8_t* shades, uint32_t* out, int count, const uint32_t palette[4]);
+
+// Name of the kernel colorize() dispatches to, e.g. "avx2".
+const char* colorizeKernel();
@@ -0,0 +1,123 @@
+#include "compress.h"
+
+#include <cstring>
+
+namespace {
+constexpr int    MIN_MATCH    = 4;
+constexpr size_t LAST_LITERALS = 5;  // the block must end in >= 5 literals
+constexpr size_t MF_LIMIT     = 12; // no match may start in the last 12 bytes
+constexpr size_t MAX_OFFSET   = 65535;
+constexpr int    HASH_BITS    = 12;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+uint8_t* writeLength(uint8_t* op, size_t len) {
+    while (len >= 255) { *op++ = 255; len -= 255; }
+    *op++ = uint8_t(len);
+    return op;
+}
+
+// Upper bound on the bytes one sequence can emit.
+size_t sequenceBound(size_t litLen, size_t matchLen) {
+    return 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1;
+}
+}
+
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + capacity;
+    size_t anchor = 0;
+
+    if (size > MF_LIMIT) {
+        uint32_t table[1 << HASH_BITS] = {}; // position + 1, 0 = empty
+        const size_t matchLimit = size - LAST_LITERALS;
+        const size_t limit = size - MF_LIMIT;
+        size_t ip = 0;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash4(seq);
+            size_t ref = table[h];
+            table[h] = uint32_t(ip + 1);
+            if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read32(src + ref - 1) != seq) {
+                // Step faster through data that keeps failing to match.
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            ref -= 1;
+
+            size_t len = MIN_MATCH;
+            while (ip + len < matchLimit && src[ref + len] == src[ip + len]) ++len;
+
+            size_t litLen = ip - anchor;
+            if (size_t(oend - op) < sequenceBound(litLen, len)) return 0;
+
+            size_t ml = len - MIN_MATCH;
+            uint8_t* token = op++;
+            *token = uint8_t(((litLen >= 15 ? 15 : litLen) << 4) | (ml >= 15 ? 15 : ml));
+            if (litLen >= 15) op = writeLength(op, litLen - 15);
+            if (litLen) std::memcpy(op, src + anchor, litLen);
+            op += litLen;
+            uint16_t offset = uint16_t(ip - ref);
+            *op++ = uint8_t(offset);
+            *op++ = uint8_t(offset >> 8);
+            if (ml >= 15) op = writeLength(op, ml - 15);
+
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    size_t litLen = size - anchor;
+    if (size_t(oend - op) < 1 + litLen / 255 + 1 + litLen) return 0;
+    *op++ = uint8_t((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15) op = writeLength(op, litLen - 15);
+    if (litLen) std::memcpy(op, src + anchor, litLen);
+    op += litLen;
+    return size_t(op - dst);
+}
+
+bool lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t outSize) {
+    size_t ip = 0, op = 0;
+    auto readLength = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= size) return false;
+            b = src[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < size) {
+        uint8_t token = src[ip++];
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !readLength(litLen)) return false;
+        if (litLen > size - ip || litLen > outSize - op) return false;
+        if (litLen) std::memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == size) break; // last sequence carries literals only
+
+        if (size - ip < 2) return false;
+        size_t offset = size_t(src[ip]) | (size_t(src[ip + 1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return false;
+        size_t len = token & 0x0F;
+        if (len == 15 && !readLength(len)) return false;
+        len += MIN_MATCH;
+        if (len > outSize - op) return false;
+        // Byte copy: source and destination may overlap for short offsets.
+        const uint8_t* m = dst + op - offset;
+        for (size_t i = 0; i < len; ++i) dst[op + i] = m[i];
+        op += len;
+    }
+    return op == outSize;
+}
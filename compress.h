@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Minimal LZ4 block-format codec (no frame header, no dictionary). Output
+// decodes with any standard LZ4_decompress_safe(); used for save states,
+// which are mostly zero-filled RAM and compress well.
+
+// Worst-case compressed size for `n` input bytes.
+constexpr size_t lz4Bound(size_t n) { return n + n / 255 + 16; }
+
+// Returns the compressed size, or 0 if it does not fit in `capacity`.
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+// Decodes exactly `outSize` bytes; false on malformed input.
+bool lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t outSize);
@@ -0,0 +1,485 @@
+#include "core.h"
+
+#include "compress.h"
+#include "profile.h"
+#include "state.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <ostream>
+#include <istream>
+
+namespace {
+constexpr uint32_t kStateMagic   = 0x53574247u; // 'GBWS' (Game Boy Write State)
+constexpr uint32_t kStateVersion = 3;           // container layout only
+
+constexpr uint32_t chunkTag(const char (&s)[5]) {
+    return uint32_t(uint8_t(s[0]))       | uint32_t(uint8_t(s[1])) << 8 |
+           uint32_t(uint8_t(s[2])) << 16 | uint32_t(uint8_t(s[3])) << 24;
+}
+
+struct StateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunkCount;
+};
+
+struct ChunkHeader {
+    uint32_t tag;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t rawSize;
+    uint32_t storedSize;
+};
+
+constexpr uint16_t kChunkCompressed = 0x0001;
+// Far above anything a component writes (the largest, Memory, is 128 KiB
+// of cartridge RAM plus about 17 KiB), so a corrupt size is refused before
+// it is allocated.
+constexpr uint32_t kMaxChunkSize = uint32_t(1) << 20;
+
+// One entry per component, in load order. Bump a version when that
+// component's saveState() layout changes.
+struct ChunkInfo {
+    uint32_t tag;
+    uint16_t version;
+};
+constexpr ChunkInfo kChunks[] = {
+    { chunkTag("CPU "), 1 },
+    { chunkTag("PPU "), 1 },
+    { chunkTag("APU "), 2 },
+    { chunkTag("MEM "), 2 },
+};
+constexpr int kChunkCount = sizeof(kChunks) / sizeof(kChunks[0]);
+// Forks share memory through Memory::forkInto() instead of copying it.
+constexpr int kMemoryChunk = 3;
+}
+
+Core::Core() {
+    memory.setCPU(&cpu);
+    memory.setPPU(&ppu);
+    memory.setAPU(&apu);
+    memory.setScheduler(&scheduler);
+    ppu.setScheduler(&scheduler);
+    resync();
+}
+
+void Core::resetComponents() {
+    cpu.reset();
+    ppu.reset();
+    apu.reset();
+    scheduler.reset();
+    resync();
+}
+
+void Core::resync() {
+    lastPollTime = Scheduler::NEVER;
+    cpu.syncBlockCache();
+    memory.resetSync(scheduler.now);
+    ppu.resetSync(scheduler.now);
+    apu.resetSync(scheduler.now);
+}
+
+void Core::runEvents() {
+    // Same order the subsystems used to be stepped in after each instruction.
+    memory.syncTimer(scheduler.now);
+    memory.syncDMA(scheduler.now);
+    ppu.sync(scheduler.now);
+    memory.syncSerial(scheduler.now);
+}
+
+void Core::skipHalt(uint64_t frameEnd) {
+    // Only an event can raise an interrupt, so nothing wakes the CPU before
+    // the next one. Jump there in whole 4-cycle HALT steps, landing on the
+    // same cycle stepping would have.
+    const uint64_t limit = std::min(scheduler.nextEvent(), frameEnd);
+    const uint64_t steps = limit > scheduler.now ? (limit - scheduler.now + 3) / 4 : 1;
+    scheduler.now += steps * 4;
+    scheduler.instrStart = scheduler.now - 4;
+    GB_PROF(prof::counters.haltCycles += steps * 4);
+    if (scheduler.now >= scheduler.nextEvent()) runEvents();
+}
+
+void Core::skipIdleLoop(uint64_t frameEnd) {
+    // The CPU has just read LY or STAT. Match the polling loop
+    //   head: LDH A,(44|41)  or  LD A,(FF44|FF41)
+    //         CP n           or  AND n
+    //         JR cc,head     or  JP cc,head
+    // The loop touches nothing but A and F, and LY/STAT only change at PPU
+    // events, so from its second pass on every pass repeats the last one
+    // until the next event. Skip the whole passes that fit before it.
+    const uint16_t pc = cpu.getPC();
+    auto peek = [&](uint16_t addr, uint8_t& v) {
+        // Code bytes only: never trigger an I/O read's side effects.
+        bool plain = addr < 0x8000 || (addr >= 0xC000 && addr < 0xE000) ||
+                     (addr >= 0xFF80 && addr < 0xFFFF);
+        if (plain) v = memory.read(addr);
+        return plain;
+    };
+    auto isStatus = [](uint8_t lo) { return lo == 0x44 || lo == 0x41; };
+
+    uint8_t b0, b1, b2;
+    uint16_t head;
+    int readCycles;
+    if (peek(uint16_t(pc - 2), b0) && b0 == 0xF0 && peek(uint16_t(pc - 1), b1) && isStatus(b1)) {
+        head = uint16_t(pc - 2);
+        readCycles = 12;
+    } else if (peek(uint16_t(pc - 3), b0) && b0 == 0xFA && peek(uint16_t(pc - 2), b1) &&
+               isStatus(b1) && peek(uint16_t(pc - 1), b2) && b2 == 0xFF) {
+        head = uint16_t(pc - 3);
+        readCycles = 16;
+    } else {
+        return;
+    }
+
+    uint8_t testOp, operand, branchOp, lo, hi = 0;
+    if (!peek(pc, testOp) || (testOp != 0xFE && testOp != 0xE6)) return;
+    if (!peek(uint16_t(pc + 1), operand) || !peek(uint16_t(pc + 2), branchOp)) return;
+    if (!peek(uint16_t(pc + 3), lo)) return;
+    uint16_t target;
+    int branchCycles;
+    if ((branchOp & 0xE7) == 0x20) {        // JR NZ/Z/NC/C
+        target = uint16_t(pc + 4 + int8_t(lo));
+        branchCycles = 12;
+    } else if ((branchOp & 0xE7) == 0xC2) { // JP NZ/Z/NC/C
+        if (!peek(uint16_t(pc + 4), hi)) return;
+        target = uint16_t(lo | hi << 8);
+        branchCycles = 16;
+    } else {
+        return;
+    }
+    if (target != head) return;
+    const uint64_t passCycles = uint64_t(readCycles + 8 + branchCycles);
+
+    // One full pass since the last poll here, reading the same value: the
+    // flags then already hold what the test leaves behind, so skipped
+    // passes change nothing but time.
+    const uint8_t a = cpu.getA();
+    bool secondPass = pc == lastPollPc && a == lastPollValue &&
+                      scheduler.now - lastPollTime == passCycles;
+    lastPollPc = pc;
+    lastPollValue = a;
+    lastPollTime = scheduler.now;
+    if (!secondPass) return;
+
+    bool z = testOp == 0xFE ? a == operand : (a & operand) == 0;
+    bool c = testOp == 0xFE && a < operand;
+    bool taken;
+    switch ((branchOp >> 3) & 0x03) {
+        case 0:  taken = !z; break;
+        case 1:  taken = z;  break;
+        case 2:  taken = !c; break;
+        default: taken = c;  break;
+    }
+    if (!taken) return;
+    // A pending interrupt would be taken before the next instruction.
+    if (cpu.getIME() && (memory.getIF() & memory.getIE() & 0x1F) != 0) return;
+
+    const uint64_t limit = std::min(scheduler.nextEvent(), frameEnd);
+    if (limit <= scheduler.now) return;
+    const uint64_t passes = (limit - scheduler.now) / passCycles;
+    if (passes == 0) return;
+    scheduler.now += passes * passCycles;
+    scheduler.instrStart = scheduler.now - uint64_t(readCycles);
+    lastPollTime = scheduler.now;
+}
+
+void Core::syncAll() {
+    runEvents();
+    apu.sync(scheduler.now);
+}
+
+bool Core::loadROM(const std::string& path) {
+    if (!memory.loadROM(path)) return false;
+    resetComponents();
+    GB_TRACE(traceRun = trace::newRun());
+    return true;
+}
+
+void Core::unloadROM() {
+    memory.unloadROM();
+    resetComponents();
+}
+
+void Core::reset() {
+    memory.reset();
+    resetComponents();
+}
+
+Core::Frame Core::runFrame(bool render) {
+    GB_PROF_SCOPE(Frame);
+    GB_PROF(prof::counters.cycles += CYCLES_PER_FRAME);
+    apu.clearSamples();
+    ppu.setRenderEnabled(render);
+    GB_TRACE(trace::attach(traceRun, memory.getRomSize()));
+    // Run the CPU until the next scheduled event; timer, DMA, PPU and APU
+    // otherwise only catch up when their registers are touched.
+    const uint64_t frameEnd = scheduler.now + CYCLES_PER_FRAME;
+    while (scheduler.now < frameEnd) {
+        if (cpu.isHalted() && (memory.getIF() & memory.getIE() & 0x1F) == 0) {
+            skipHalt(frameEnd);
+            continue;
+        }
+        if (!idleLoopSkip) {
+            cpu.runUntil(scheduler, frameEnd);
+            if (scheduler.now >= scheduler.nextEvent()) runEvents();
+            continue;
+        }
+        scheduler.instrStart = scheduler.now;
+        scheduler.now += static_cast<uint64_t>(cpu.step());
+        // Before running events: a value read ahead of an event that is now
+        // due says nothing about the next pass.
+        if (memory.takeStatusPoll()) skipIdleLoop(frameEnd);
+        if (scheduler.now >= scheduler.nextEvent()) runEvents();
+    }
+    // Leave every subsystem at the frame boundary so callers (and save
+    // states) see consistent state.
+    syncAll();
+    apu.endFrame();
+    ppu.clearFrameReady();
+
+    Frame f;
+    f.framebuffer = ppu.getFramebuffer();
+    f.palette     = ppu.getPalette();
+    f.audio       = apu.getSamples();
+    f.audioFrames = apu.sampleCount();
+    return f;
+}
+
+void Core::saveChunk(int index, std::ostream& out) const {
+    switch (index) {
+        case 0: cpu.saveState(out);    break;
+        case 1: ppu.saveState(out);    break;
+        case 2: apu.saveState(out);    break;
+        case 3: memory.saveState(out); break;
+    }
+}
+
+bool Core::loadChunk(int index, std::istream& in) {
+    switch (index) {
+        case 0: return cpu.loadState(in);
+        case 1: return ppu.loadState(in);
+        case 2: return apu.loadState(in);
+        case 3: return memory.loadState(in);
+    }
+    return false;
+}
+
+bool Core::saveChunks(std::vector<uint8_t>& out, size_t* sizes) const {
+    out.clear();
+    VectorWriteBuf buf(out);
+    std::ostream os(&buf);
+    for (int i = 0; i < kChunkCount; ++i) {
+        size_t before = out.size();
+        saveChunk(i, os);
+        sizes[i] = out.size() - before;
+    }
+    return static_cast<bool>(os);
+}
+
+bool Core::loadChunks(const uint8_t* const* payload, const size_t* sizes) {
+    for (int i = 0; i < kChunkCount; ++i) {
+        SpanReadBuf buf(payload[i], sizes[i]);
+        std::istream is(&buf);
+        if (!loadChunk(i, is)) return false;
+    }
+    return true;
+}
+
+size_t Core::maxStateSize() const {
+    size_t raw[kChunkCount];
+    saveChunks(stateScratch, raw);
+    size_t total = sizeof(StateHeader);
+    for (size_t n : raw) total += sizeof(ChunkHeader) + lz4Bound(n);
+    return total;
+}
+
+size_t Core::serialize(uint8_t* out, size_t capacity, bool compress) const {
+    size_t raw[kChunkCount];
+    if (!saveChunks(stateScratch, raw)) return 0;
+    return packChunks(raw, out, capacity, compress);
+}
+
+size_t Core::serialize(std::vector<uint8_t>& out, bool compress) const {
+    size_t raw[kChunkCount];
+    if (!saveChunks(stateScratch, raw)) return 0;
+    size_t bound = sizeof(StateHeader);
+    for (size_t n : raw) bound += sizeof(ChunkHeader) + (compress ? lz4Bound(n) : n);
+    if (out.size() < bound) out.resize(bound);
+    return packChunks(raw, out.data(), out.size(), compress);
+}
+
+size_t Core::packChunks(const size_t* raw, uint8_t* out, size_t capacity, bool compress) const {
+    StateHeader hdr{ kStateMagic, kStateVersion, uint32_t(kChunkCount) };
+    if (capacity < sizeof(hdr)) return 0;
+    std::memcpy(out, &hdr, sizeof(hdr));
+    size_t pos = sizeof(hdr);
+
+    const uint8_t* chunk = stateScratch.data();
+    for (int i = 0; i < kChunkCount; ++i) {
+        if (capacity - pos < sizeof(ChunkHeader)) return 0;
+        uint8_t* payload = out + pos + sizeof(ChunkHeader);
+        size_t room = capacity - pos - sizeof(ChunkHeader);
+        ChunkHeader ch{ kChunks[i].tag, kChunks[i].version, 0, uint32_t(raw[i]), 0 };
+
+        size_t stored = 0;
+        if (compress) {
+            stored = lz4Compress(chunk, raw[i], payload, room);
+            if (stored && stored < raw[i]) ch.flags = kChunkCompressed;
+            else stored = 0;
+        }
+        if (ch.flags == 0) {
+            // Stored raw: compression was off, failed or did not help.
+            if (raw[i] > room) return 0;
+            std::memcpy(payload, chunk, raw[i]);
+            stored = raw[i];
+        }
+        ch.storedSize = uint32_t(stored);
+        std::memcpy(out + pos, &ch, sizeof(ch));
+        pos += sizeof(ch) + stored;
+        chunk += raw[i];
+    }
+    return pos;
+}
+
+bool Core::deserialize(const uint8_t* data, size_t size) {
+    StateHeader hdr{};
+    if (size < sizeof(hdr)) return false;
+    std::memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != kStateMagic || hdr.version != kStateVersion) return false;
+
+    // Validate every chunk header before touching any component. Chunks
+    // with unknown tags are skipped so newer states can add optional ones.
+    ChunkHeader found[kChunkCount]{};
+    size_t offset[kChunkCount]{};
+    bool present[kChunkCount]{};
+    size_t pos = sizeof(hdr);
+    for (uint32_t n = 0; n < hdr.chunkCount; ++n) {
+        ChunkHeader ch{};
+        if (size - pos < sizeof(ch)) return false;
+        std::memcpy(&ch, data + pos, sizeof(ch));
+        pos += sizeof(ch);
+        if (ch.storedSize > size - pos) return false;
+        for (int i = 0; i < kChunkCount; ++i) {
+            if (ch.tag != kChunks[i].tag) continue;
+            if (ch.version != kChunks[i].version) return false;
+            if (ch.rawSize > kMaxChunkSize) return false;
+            if (ch.flags & kChunkCompressed) {
+                // LZ4 expands a block at most ~255x.
+                if (ch.rawSize > uint64_t(ch.storedSize) * 255 + 16) return false;
+            } else if (ch.storedSize != ch.rawSize) {
+                return false;
+            }
+            found[i] = ch;
+            offset[i] = pos;
+            present[i] = true;
+        }
+        pos += ch.storedSize;
+    }
+    for (bool p : present) {
+        if (!p) return false;
+    }
+
+    // Unpack every chunk before touching any component, so a corrupt one
+    // leaves the machine as it was.
+    const uint8_t* payload[kChunkCount];
+    size_t rawSize[kChunkCount];
+    size_t unpacked = 0;
+    for (int i = 0; i < kChunkCount; ++i) {
+        if (found[i].flags & kChunkCompressed) unpacked += found[i].rawSize;
+    }
+    loadScratch.resize(unpacked);
+    size_t at = 0;
+    for (int i = 0; i < kChunkCount; ++i) {
+        rawSize[i] = found[i].rawSize;
+        payload[i] = data + offset[i];
+        if (found[i].flags & kChunkCompressed) {
+            if (!lz4Decompress(payload[i], found[i].storedSize,
+                               loadScratch.data() + at, rawSize[i])) return false;
+            payload[i] = loadScratch.data() + at;
+            at += rawSize[i];
+        }
+    }
+
+    // A component can still reject its chunk halfway through; keep the
+    // current state to put back.
+    size_t backupSize[kChunkCount];
+    if (!saveChunks(rollbackState, backupSize)) return false;
+    if (!loadChunks(payload, rawSize)) {
+        const uint8_t* backup[kChunkCount];
+        size_t pos = 0;
+        for (int i = 0; i < kChunkCount; ++i) {
+            backup[i] = rollbackState.data() + pos;
+            pos += backupSize[i];
+        }
+        loadChunks(backup, backupSize);
+        resync();
+        return false;
+    }
+    resync();
+    return true;
+}
+
+bool Core::saveState(std::ostream& out, bool compress) const {
+    std::vector<uint8_t> data;
+    size_t n = serialize(data, compress);
+    if (n == 0) return false;
+    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(n));
+    return static_cast<bool>(out);
+}
+
+bool Core::loadState(std::istream& in) {
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    return deserialize(data.data(), data.size());
+}
+
+std::unique_ptr<Core> Core::fork() {
+    std::unique_ptr<Core> child(new Core());
+    forkInto(*child);
+    return child;
+}
+
+void Core::forkInto(Core& child) {
+    if (&child == this) return;
+    memory.forkInto(child.memory);
+    VectorWriteBuf out(stateScratch);
+    std::ostream os(&out);
+    for (int i = 0; i < kChunkCount; ++i) {
+        if (i == kMemoryChunk) continue;
+        stateScratch.clear();
+        saveChunk(i, os);
+        SpanReadBuf in(stateScratch.data(), stateScratch.size());
+        std::istream is(&in);
+        child.loadChunk(i, is);
+    }
+    child.idleLoopSkip = idleLoopSkip;
+    child.traceRun = traceRun;
+    child.resync();
+}
+
+bool Core::step(uint8_t input, int frames, const StepSpec& spec, uint8_t* out) {
+    if (!spec.valid()) return false;
+    setJoypadState(input & 0x0F, input >> 4);
+    for (int i = 0; i < frames; ++i) runFrame(i + 1 == frames);
+
+    const uint8_t* fb = ppu.getFramebuffer();
+    const int d = spec.downsample;
+    const int w = spec.width(), h = spec.height();
+    const int scale = 3 * d * d;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            int sum = 0;
+            for (int dy = 0; dy < d; ++dy) {
+                const uint8_t* row = fb + (y * d + dy) * SCREEN_WIDTH + x * d;
+                for (int dx = 0; dx < d; ++dx) sum += row[dx];
+            }
+            // Shade 0 is the lightest.
+            *out++ = uint8_t(255 - (sum * 255 + scale / 2) / scale);
+        }
+    }
+    for (uint16_t addr : spec.ramAddresses) *out++ = memory.peek(addr);
+    return true;
+}
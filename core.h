@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <memory>
+
+#include "memory.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "scheduler.h"
+
+// SDL-free emulator core: owns one Memory/CPU/PPU/APU set and advances it a
+// frame at a time. Frontends (SDL window, headless runner) sit on top.
+class Core {
+public:
+    static constexpr int CYCLES_PER_FRAME = 70224;
+
+    struct Frame {
+        const uint8_t*  framebuffer = nullptr; // SCREEN_WIDTH * SCREEN_HEIGHT shade indices
+        const uint32_t* palette     = nullptr; // ARGB for shade 0-3
+        const int16_t*  audio       = nullptr; // interleaved stereo
+        int             audioFrames = 0;
+    };
+
+    Core();
+    Core(const Core&) = delete;
+    Core& operator=(const Core&) = delete;
+
+    bool loadROM(const std::string& path);
+    void unloadROM();
+    // Power-cycle the loaded game without reopening the ROM file.
+    void reset();
+    bool hasROM() const { return memory.hasROM(); }
+
+    // With `render` false the frame runs with identical timing and state
+    // but draws nothing; the framebuffer still holds the last drawn lines.
+    // Rendering just the last of several frames still gives a whole image
+    // while the LCD is on.
+    Frame runFrame(bool render = true);
+
+    void setJoypadState(uint8_t buttons, uint8_t dpad) { memory.setJoypadState(buttons, dpad); }
+
+    // Fast-forward loops that poll LY or STAT (`LDH A,(44); CP n; JR NZ`
+    // and similar) up to the next event. Off by default. HALT is always
+    // skipped the same way. Both land exactly where stepping would, so
+    // results do not depend on the setting.
+    void setIdleLoopSkip(bool on) { idleLoopSkip = on; }
+
+    // A save state is a small header followed by one tagged chunk per
+    // component (CPU, PPU, APU, Memory), each with its own layout version
+    // and optionally LZ4-compressed.
+    bool saveState(std::ostream& out, bool compress = true) const;
+    bool loadState(std::istream& in);
+
+    // In-memory capture without going through a stream. serialize() returns
+    // the bytes written, or 0 if `capacity` is too small; maxStateSize() is
+    // always enough for the currently loaded cartridge, but costs a full
+    // serialization itself. The vector overload grows `out` as needed (it
+    // never shrinks it), so a reused buffer stops allocating. A state that
+    // fails to load leaves the machine as it was.
+    size_t serialize(uint8_t* out, size_t capacity, bool compress = false) const;
+    size_t serialize(std::vector<uint8_t>& out, bool compress = false) const;
+    bool   deserialize(const uint8_t* data, size_t size);
+    size_t maxStateSize() const;
+
+    // A copy of this machine that runs on independently, for search and
+    // training loops. Memory's state is one block copied whole; the ROM is
+    // shared and cartridge RAM shared copy-on-write. Having
+    // forkInto() overwrite an existing core reuses its allocations. Forks
+    // never write battery saves and start with render threading off.
+    std::unique_ptr<Core> fork();
+    void forkInto(Core& child);
+
+    // What step() writes: a grayscale image of the screen, shrunk by
+    // `downsample` (1, 2 or 4; nothing else divides both sides evenly)
+    // with each output pixel the mean of its block, row by row, then one
+    // byte per entry of `ramAddresses`, read as Memory::peek() does.
+    struct StepSpec {
+        int downsample = 2;
+        std::vector<uint16_t> ramAddresses;
+        bool   valid() const  { return downsample == 1 || downsample == 2 || downsample == 4; }
+        int    width() const  { return valid() ? SCREEN_WIDTH / downsample : 0; }
+        int    height() const { return valid() ? SCREEN_HEIGHT / downsample : 0; }
+        size_t outputSize() const { return valid() ? size_t(width()) * height() + ramAddresses.size() : 0; }
+    };
+    // Hold `input` (buttons | dpad << 4, active low as in movies) for
+    // `frames` frames, drawing only the last, and fill `out` with
+    // spec.outputSize() bytes. Allocates nothing. Returns false, without
+    // running anything, if the spec is not valid().
+    bool step(uint8_t input, int frames, const StepSpec& spec, uint8_t* out);
+
+    Memory& getMemory() { return memory; }
+    CPU&    getCPU()    { return cpu; }
+    PPU&    getPPU()    { return ppu; }
+    APU&    getAPU()    { return apu; }
+    const Memory& getMemory() const { return memory; }
+    const PPU&    getPPU()    const { return ppu; }
+
+private:
+    Scheduler scheduler;
+    Memory    memory;
+    CPU       cpu{memory};
+    PPU       ppu{memory};
+    APU       apu{memory};
+
+    bool     idleLoopSkip = false;
+    uint16_t lastPollPc   = 0;
+    uint8_t  lastPollValue = 0;
+    uint64_t lastPollTime = Scheduler::NEVER;
+    uint32_t traceRun = 0;  // coverage id of the loaded ROM (TRACE=1 builds)
+
+    // Reused between save-state calls to hold the uncompressed chunks.
+    mutable std::vector<uint8_t> stateScratch;
+    // deserialize(): decompressed chunks, and the state it replaces so a
+    // chunk that fails to load can be undone.
+    std::vector<uint8_t> loadScratch;
+    std::vector<uint8_t> rollbackState;
+
+    void resetComponents();
+    void resync();
+    void saveChunk(int index, std::ostream& out) const;
+    bool loadChunk(int index, std::istream& in);
+    // All chunks back to back, uncompressed, with each one's size in `sizes`.
+    bool saveChunks(std::vector<uint8_t>& out, size_t* sizes) const;
+    bool loadChunks(const uint8_t* const* payload, const size_t* sizes);
+    // The container for the chunks saveChunks() left in stateScratch.
+    size_t packChunks(const size_t* raw, uint8_t* out, size_t capacity, bool compress) const;
+    void runEvents();
+    void syncAll();
+    void skipHalt(uint64_t frameEnd);
+    void skipIdleLoop(uint64_t frameEnd);
+};
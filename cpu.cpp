@@ -1,7 +1,14 @@
 #include "cpu.h"
 #include "memory.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "trace.h"
 
+#include <array>
 #include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <ostream>
 #include <istream>
 
@@ -12,6 +19,34 @@ struct CpuStateBlob {
 };
 }
 
+#ifndef GB_LEGACY_DECODER
+struct CPU::Uop {
+    int (*fn)(CPU&, uint16_t);
+    uint16_t imm;
+    uint16_t pc;     // address of the opcode
+    uint8_t  op;
+    uint8_t  length; // opcode plus operand bytes
+};
+
+// Runs up to the first instruction that may jump (or the last one that
+// could be decoded). An empty block marks code that can't be cached.
+struct CPU::Block {
+    int bank; // ROM bank at 0x4000-0x7FFF; 0 for blocks below that
+    std::vector<Uop> uops;
+    uint16_t end = 0;           // address after the last uop
+    Block* exits[2]{};          // fall-through and jump target seen last, tried before the map
+};
+
+struct CPU::BlockCache {
+    const uint8_t* rom = nullptr; // the ROM the blocks were decoded from
+    std::unordered_map<uint32_t, std::unique_ptr<Block>> map; // (bank << 16) | pc
+};
+
+namespace {
+constexpr size_t MAX_BLOCK_UOPS = 64;
+}
+#endif
+
 void CPU::saveState(std::ostream& out) const {
     CpuStateBlob s{};
     s.af = af; s.bc = bc; s.de = de; s.hl = hl; s.sp = sp; s.pc = pc;
@@ -46,6 +81,13 @@ void CPU::reset() {
     imeScheduled = false;
     halted = false;
     stopped = false;
+    instructions = 0;
+#ifndef GB_LEGACY_DECODER
+    // Also called on ROM load, so cached code never outlives its cartridge.
+    blocks.reset();
+    curBlock = nullptr;
+    curIndex = 0;
+#endif
 }
 
 void CPU::requestInterrupt(uint8_t mask) {
@@ -200,6 +242,7 @@ int CPU::step() {
             halted = false;
         } else {
             int c = handleInterrupts();
+            GB_PROF(prof::counters.haltCycles += c > 0 ? 0 : 4);
             return c > 0 ? c : 4;
         }
     }
@@ -208,8 +251,14 @@ int CPU::step() {
     if (ic > 0) return ic;
 
     bool wasImeScheduled = imeScheduled;
-    uint8_t op = fetch8();
-    int cycles = execute(op);
+#ifdef GB_TRACING
+    uint16_t tracePc = pc;
+    int traceBank = pc >= 0x4000 && pc < 0x8000 ? memory.getRomBank() : 0;
+    uint8_t traceOp = memory.read(pc);
+#endif
+    int cycles = dispatch();
+    GB_TRACE(trace::record(tracePc, traceBank, traceOp, cycles));
+    ++instructions;
     if (wasImeScheduled && imeScheduled) {
         ime = true;
         imeScheduled = false;
@@ -217,6 +266,25 @@ int CPU::step() {
     return cycles;
 }
 
+void CPU::runUntil(Scheduler& s, uint64_t limit) {
+    do {
+        s.instrStart = s.now;
+        s.now += static_cast<uint64_t>(step());
+    } while (s.now < limit && s.now < s.nextEvent() && !halted);
+}
+
+#ifdef GB_LEGACY_DECODER
+void CPU::setBlockCache(bool) {}
+void CPU::syncBlockCache() {}
+
+int CPU::dispatch() {
+    uint8_t op = fetch8();
+    GB_PROF(prof::counters.opcodes[op]++);
+    return execute(op);
+}
+
+// Reference decoder, kept so table-dispatch results can be diffed against it
+// (build with `make LEGACY_DECODER=1`).
 int CPU::execute(uint8_t op) {
     // Lambdas to read/write the standard 8-bit operand index.
     auto rdR = [&](int i) -> uint8_t {
@@ -441,6 +509,7 @@ int CPU::execute(uint8_t op) {
 
 int CPU::executeCB() {
     uint8_t op = fetch8();
+    GB_PROF(prof::counters.cbOpcodes[op]++);
     int reg = op & 0x07;
     int bitIdx = (op >> 3) & 0x07;
 
@@ -492,3 +561,380 @@ int CPU::executeCB() {
     wrR(reg, rdR(reg) | (1u << bitIdx));
     return memCycles;
 }
+
+#else
+
+// Table-driven dispatch. Every opcode gets its own handler instantiated from
+// the templates below, so register operands are resolved at compile time
+// (LD B,C compiles to a plain byte move). Operands are fetched by execute()
+// before the handler runs and passed in as `imm`.
+struct CPU::Ops {
+    using Fn   = int (*)(CPU&, uint16_t);
+    using CBFn = int (*)(CPU&);
+
+    // r[i]: B C D E H L (HL) A
+    template <int R> static uint8_t get(CPU& c) {
+        if constexpr (R == 0) return c.b;
+        else if constexpr (R == 1) return c.c;
+        else if constexpr (R == 2) return c.d;
+        else if constexpr (R == 3) return c.e;
+        else if constexpr (R == 4) return c.h;
+        else if constexpr (R == 5) return c.l;
+        else if constexpr (R == 6) return c.read8(c.hl);
+        else return c.a;
+    }
+    template <int R> static void set(CPU& c, uint8_t v) {
+        if constexpr (R == 0) c.b = v;
+        else if constexpr (R == 1) c.c = v;
+        else if constexpr (R == 2) c.d = v;
+        else if constexpr (R == 3) c.e = v;
+        else if constexpr (R == 4) c.h = v;
+        else if constexpr (R == 5) c.l = v;
+        else if constexpr (R == 6) c.write8(c.hl, v);
+        else c.a = v;
+    }
+    // rp[p]: BC DE HL SP
+    template <int P> static uint16_t& rp(CPU& c) {
+        if constexpr (P == 0) return c.bc;
+        else if constexpr (P == 1) return c.de;
+        else if constexpr (P == 2) return c.hl;
+        else return c.sp;
+    }
+    // cc[y]: NZ Z NC C
+    template <int Y> static bool cond(const CPU& c) {
+        if constexpr (Y == 0) return !c.getZ();
+        else if constexpr (Y == 1) return c.getZ();
+        else if constexpr (Y == 2) return !c.getC();
+        else return c.getC();
+    }
+    template <int Y> static void alu(CPU& c, uint8_t v) {
+        if constexpr (Y == 0) c.add8(v);
+        else if constexpr (Y == 1) c.adc8(v);
+        else if constexpr (Y == 2) c.sub8(v);
+        else if constexpr (Y == 3) c.sbc8(v);
+        else if constexpr (Y == 4) c.and8(v);
+        else if constexpr (Y == 5) c.xor8(v);
+        else if constexpr (Y == 6) c.or8(v);
+        else c.cp8(v);
+    }
+
+    template <int OP> static int op(CPU& c, uint16_t imm) {
+        constexpr int x = OP >> 6;
+        constexpr int y = (OP >> 3) & 7;
+        constexpr int z = OP & 7;
+        constexpr int p = y >> 1;
+        constexpr int q = y & 1;
+        (void)imm;
+
+        if constexpr (OP == 0x76) {
+            c.halted = true; return 4;
+        } else if constexpr (x == 1) {
+            set<y>(c, get<z>(c));
+            return (y == 6 || z == 6) ? 8 : 4;
+        } else if constexpr (x == 2) {
+            alu<y>(c, get<z>(c));
+            return z == 6 ? 8 : 4;
+        } else if constexpr (x == 0) {
+            if constexpr (z == 0) {
+                if constexpr (y == 0) return 4;
+                else if constexpr (y == 1) { c.write16(imm, c.sp); return 20; }
+                else if constexpr (y == 2) { c.stopped = true; return 4; }
+                else if constexpr (y == 3) { c.pc += int8_t(imm); return 12; }
+                else {
+                    if (cond<y - 4>(c)) { c.pc += int8_t(imm); return 12; }
+                    return 8;
+                }
+            } else if constexpr (z == 1) {
+                if constexpr (q == 0) { rp<p>(c) = imm; return 12; }
+                else { c.add16hl(rp<p>(c)); return 8; }
+            } else if constexpr (z == 2) {
+                if constexpr (q == 0) {
+                    if constexpr (p == 0) c.write8(c.bc, c.a);
+                    else if constexpr (p == 1) c.write8(c.de, c.a);
+                    else if constexpr (p == 2) c.write8(c.hl++, c.a);
+                    else c.write8(c.hl--, c.a);
+                } else {
+                    if constexpr (p == 0) c.a = c.read8(c.bc);
+                    else if constexpr (p == 1) c.a = c.read8(c.de);
+                    else if constexpr (p == 2) c.a = c.read8(c.hl++);
+                    else c.a = c.read8(c.hl--);
+                }
+                return 8;
+            } else if constexpr (z == 3) {
+                if constexpr (q == 0) rp<p>(c)++;
+                else rp<p>(c)--;
+                return 8;
+            } else if constexpr (z == 4) {
+                set<y>(c, c.inc8(get<y>(c)));
+                return y == 6 ? 12 : 4;
+            } else if constexpr (z == 5) {
+                set<y>(c, c.dec8(get<y>(c)));
+                return y == 6 ? 12 : 4;
+            } else if constexpr (z == 6) {
+                set<y>(c, uint8_t(imm));
+                return y == 6 ? 12 : 8;
+            } else {
+                if constexpr (y == 0) { c.a = c.rlc(c.a); c.setZ(false); }
+                else if constexpr (y == 1) { c.a = c.rrc(c.a); c.setZ(false); }
+                else if constexpr (y == 2) { c.a = c.rl(c.a);  c.setZ(false); }
+                else if constexpr (y == 3) { c.a = c.rr(c.a);  c.setZ(false); }
+                else if constexpr (y == 4) c.daa();
+                else if constexpr (y == 5) { c.a = ~c.a; c.setN(true); c.setH(true); }
+                else if constexpr (y == 6) { c.setN(false); c.setH(false); c.setC(true); }
+                else { c.setN(false); c.setH(false); c.setC(!c.getC()); }
+                return 4;
+            }
+        } else {
+            if constexpr (z == 0) {
+                if constexpr (y < 4) {
+                    if (cond<y>(c)) { c.pc = c.pop16(); return 20; }
+                    return 8;
+                }
+                else if constexpr (y == 4) { c.write8(0xFF00 + imm, c.a); return 12; }
+                else if constexpr (y == 5) { c.sp = c.addSP(int8_t(imm)); return 16; }
+                else if constexpr (y == 6) { c.a = c.read8(0xFF00 + imm); return 12; }
+                else { c.hl = c.addSP(int8_t(imm)); return 12; }
+            } else if constexpr (z == 1) {
+                if constexpr (q == 0) {
+                    if constexpr (p == 0) c.bc = c.pop16();
+                    else if constexpr (p == 1) c.de = c.pop16();
+                    else if constexpr (p == 2) c.hl = c.pop16();
+                    else c.af = c.pop16() & 0xFFF0;
+                    return 12;
+                }
+                else if constexpr (p == 0) { c.pc = c.pop16(); return 16; }
+                else if constexpr (p == 1) { c.pc = c.pop16(); c.ime = true; return 16; }
+                else if constexpr (p == 2) { c.pc = c.hl; return 4; }
+                else { c.sp = c.hl; return 8; }
+            } else if constexpr (z == 2) {
+                if constexpr (y < 4) {
+                    if (cond<y>(c)) { c.pc = imm; return 16; }
+                    return 12;
+                }
+                else if constexpr (y == 4) { c.write8(0xFF00 + c.c, c.a); return 8; }
+                else if constexpr (y == 5) { c.write8(imm, c.a); return 16; }
+                else if constexpr (y == 6) { c.a = c.read8(0xFF00 + c.c); return 8; }
+                else { c.a = c.read8(imm); return 16; }
+            } else if constexpr (z == 3) {
+                if constexpr (y == 0) { c.pc = imm; return 16; }
+                else if constexpr (y == 1) {
+                    GB_PROF(prof::counters.cbOpcodes[imm & 0xFF]++);
+                    return cbTable[imm & 0xFF](c);
+                }
+                else if constexpr (y == 6) { c.ime = false; c.imeScheduled = false; return 4; }
+                else if constexpr (y == 7) { c.imeScheduled = true; return 4; }
+                else return 4; // illegal D3, DB, E3, EB
+            } else if constexpr (z == 4) {
+                if constexpr (y < 4) {
+                    if (cond<y>(c)) { c.push16(c.pc); c.pc = imm; return 24; }
+                    return 12;
+                }
+                else return 4; // illegal E4, EC, F4, FC
+            } else if constexpr (z == 5) {
+                if constexpr (q == 0) {
+                    if constexpr (p == 0) c.push16(c.bc);
+                    else if constexpr (p == 1) c.push16(c.de);
+                    else if constexpr (p == 2) c.push16(c.hl);
+                    else c.push16(c.af & 0xFFF0);
+                    return 16;
+                }
+                else if constexpr (p == 0) { c.push16(c.pc); c.pc = imm; return 24; }
+                else return 4; // illegal DD, ED, FD
+            } else if constexpr (z == 6) {
+                alu<y>(c, uint8_t(imm));
+                return 8;
+            } else {
+                c.push16(c.pc); c.pc = uint16_t(y * 8);
+                return 16;
+            }
+        }
+    }
+
+    template <int OP> static int cb(CPU& c) {
+        constexpr int y = (OP >> 3) & 7;
+        constexpr int z = OP & 7;
+        constexpr int memCycles = (z == 6) ? 16 : 8;
+        if constexpr (OP < 0x40) {
+            uint8_t v = get<z>(c);
+            uint8_t r;
+            if constexpr (y == 0) r = c.rlc(v);
+            else if constexpr (y == 1) r = c.rrc(v);
+            else if constexpr (y == 2) r = c.rl(v);
+            else if constexpr (y == 3) r = c.rr(v);
+            else if constexpr (y == 4) r = c.sla(v);
+            else if constexpr (y == 5) r = c.sra(v);
+            else if constexpr (y == 6) r = c.swap(v);
+            else r = c.srl(v);
+            set<z>(c, r);
+            return memCycles;
+        } else if constexpr (OP < 0x80) {
+            c.bit(y, get<z>(c));
+            return (z == 6) ? 12 : 8;
+        } else if constexpr (OP < 0xC0) {
+            set<z>(c, get<z>(c) & ~(1u << y));
+            return memCycles;
+        } else {
+            set<z>(c, get<z>(c) | (1u << y));
+            return memCycles;
+        }
+    }
+
+    // Operand bytes following each opcode (STOP's padding byte included).
+    static constexpr uint8_t length(int op) {
+        switch (op) {
+            case 0x06: case 0x0E: case 0x16: case 0x1E:
+            case 0x26: case 0x2E: case 0x36: case 0x3E:
+            case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+            case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            case 0xCB: case 0xE0: case 0xF0: case 0xE8: case 0xF8:
+                return 1;
+            case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+            case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+            case 0xEA: case 0xFA:
+                return 2;
+            default:
+                return 0;
+        }
+    }
+
+    // Instructions after which pc may not simply fall through.
+    static constexpr bool endsBlock(int op) {
+        switch (op) {
+            case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: case 0x76:
+            case 0xC0: case 0xC2: case 0xC3: case 0xC4: case 0xC8: case 0xC9:
+            case 0xCA: case 0xCC: case 0xCD: case 0xD0: case 0xD2: case 0xD4:
+            case 0xD8: case 0xD9: case 0xDA: case 0xDC: case 0xE9:
+                return true;
+            default:
+                return (op & 0xC7) == 0xC7; // RST
+        }
+    }
+
+    template <size_t... I>
+    static constexpr std::array<Fn, 256> makeTable(std::index_sequence<I...>) {
+        return {{ &op<int(I)>... }};
+    }
+    template <size_t... I>
+    static constexpr std::array<CBFn, 256> makeCBTable(std::index_sequence<I...>) {
+        return {{ &cb<int(I)>... }};
+    }
+    template <size_t... I>
+    static constexpr std::array<uint8_t, 256> makeLengths(std::index_sequence<I...>) {
+        return {{ length(int(I))... }};
+    }
+
+    static const std::array<Fn, 256>      table;
+    static const std::array<CBFn, 256>    cbTable;
+    static const std::array<uint8_t, 256> lengths;
+};
+
+const std::array<CPU::Ops::Fn, 256> CPU::Ops::table =
+    CPU::Ops::makeTable(std::make_index_sequence<256>{});
+const std::array<CPU::Ops::CBFn, 256> CPU::Ops::cbTable =
+    CPU::Ops::makeCBTable(std::make_index_sequence<256>{});
+const std::array<uint8_t, 256> CPU::Ops::lengths =
+    CPU::Ops::makeLengths(std::make_index_sequence<256>{});
+
+int CPU::execute(uint8_t op) {
+    uint16_t imm = 0;
+    switch (Ops::lengths[op]) {
+        case 1: imm = fetch8();  break;
+        case 2: imm = fetch16(); break;
+    }
+    return Ops::table[op](*this, imm);
+}
+
+void CPU::setBlockCache(bool on) {
+    blockCacheOn = on;
+    curBlock = nullptr;
+}
+
+void CPU::syncBlockCache() {
+    if (blocks && blocks->rom != memory.getRomData()) blocks.reset();
+    curBlock = nullptr;
+    curIndex = 0;
+}
+
+int CPU::dispatch() {
+    if (const Uop* u = nextUop()) {
+        GB_PROF(prof::counters.opcodes[u->op]++);
+        GB_PROF(prof::counters.reads[prof::regionOf(u->pc)] += u->length);
+        pc += u->length;
+        return u->fn(*this, u->imm);
+    }
+    uint8_t op = fetch8();
+    GB_PROF(prof::counters.opcodes[op]++);
+    return execute(op);
+}
+
+// ROM can't change under a loaded cartridge, so a block stays valid for as
+// long as its bank is mapped; pc and bank are checked on every instruction.
+// Code in RAM always goes through fetch and decode.
+const CPU::Uop* CPU::nextUop() {
+    if (pc >= 0x8000 || !blockCacheOn) return nullptr;
+    int bank = pc < 0x4000 ? 0 : memory.getRomBank();
+    Block* b = curBlock;
+    if (b && curIndex < b->uops.size()) {
+        const Uop& u = b->uops[curIndex];
+        if (u.pc == pc && b->bank == bank) {
+            ++curIndex;
+            return &u;
+        }
+    }
+    Block* next = nullptr;
+    Block** exit = nullptr;
+    if (b) {
+        exit = &b->exits[pc == b->end ? 0 : 1];
+        next = *exit;
+    }
+    if (!next || next->bank != bank || next->uops.empty() || next->uops[0].pc != pc) {
+        next = findBlock(bank, pc);
+        if (exit) *exit = next;
+    }
+    curBlock = next;
+    curIndex = 0;
+    if (next->uops.empty()) return nullptr;
+    curIndex = 1;
+    return &next->uops[0];
+}
+
+CPU::Block* CPU::findBlock(int bank, uint16_t addr) {
+    if (!blocks) {
+        blocks.reset(new BlockCache());
+        blocks->rom = memory.getRomData();
+    }
+    std::unique_ptr<Block>& block = blocks->map[uint32_t(bank) << 16 | addr];
+    if (block) return block.get();
+
+    block.reset(new Block());
+    block->bank = bank;
+    const uint8_t* rom = memory.getRomData();
+    size_t size = memory.getRomSize();
+    // Instructions never straddle 0x4000 or 0x8000: the bytes on the far
+    // side belong to a different mapping.
+    uint32_t end = addr < 0x4000 ? 0x4000 : 0x8000;
+    for (uint32_t a = addr; rom && block->uops.size() < MAX_BLOCK_UOPS;) {
+        size_t off = a < 0x4000 ? a : size_t(bank) * 0x4000 + (a - 0x4000);
+        if (off >= size) break;
+        uint8_t op = rom[off];
+        uint8_t len = uint8_t(1 + Ops::lengths[op]);
+        if (a + len > end || off + len > size) break;
+        uint16_t imm = 0;
+        if (len == 2) imm = rom[off + 1];
+        if (len == 3) imm = uint16_t(rom[off + 1] | (rom[off + 2] << 8));
+        block->uops.push_back(Uop{Ops::table[op], imm, uint16_t(a), op, len});
+        a += len;
+        if (Ops::endsBlock(op)) break;
+    }
+    if (!block->uops.empty()) {
+        const Uop& last = block->uops.back();
+        block->end = uint16_t(last.pc + last.length);
+    }
+    return block.get();
+}
+
+#endif
+
+CPU::~CPU() = default;
@@ -2,8 +2,10 @@
 
 #include <cstdint>
 #include <iosfwd>
+#include <memory>
 
 class Memory;
+class Scheduler;
 
 constexpr uint8_t INT_VBLANK = 0x01;
 constexpr uint8_t INT_STAT   = 0x02;
@@ -14,11 +16,29 @@ constexpr uint8_t INT_JOYPAD = 0x10;
 class CPU {
 public:
     explicit CPU(Memory& mem);
+    ~CPU();
 
     void reset();
     int  step();
+    // Step instructions back to back, keeping the scheduler's clock, until
+    // an event is due, `limit` is reached or the CPU halts. Same result as
+    // stepping one at a time from Core::runFrame, minus the call overhead.
+    void runUntil(Scheduler& s, uint64_t limit);
     void requestInterrupt(uint8_t mask);
     bool isHalted() const { return halted; }
+    uint16_t getPC() const { return pc; }
+    uint8_t  getA() const { return a; }
+    bool     getIME() const { return ime; }
+    // Instructions executed since reset() (HALT idling and interrupt
+    // dispatch excluded). Not part of the save state.
+    uint64_t getInstructionCount() const { return instructions; }
+    // Run ROM code from pre-decoded blocks (default on). Results are
+    // identical either way; the switch exists for benchmarking. The legacy
+    // decoder ignores it.
+    void setBlockCache(bool on);
+    // Drop cached blocks decoded from a ROM that memory no longer maps: a
+    // fork can move a reused core onto another cartridge.
+    void syncBlockCache();
 
     void saveState(std::ostream& out) const;
     bool loadState(std::istream& in);
@@ -37,6 +57,7 @@ private:
     bool imeScheduled = false;
     bool halted = false;
     bool stopped = false;
+    uint64_t instructions = 0;
 
     bool getZ() const { return (f & 0x80) != 0; }
     bool getN() const { return (f & 0x40) != 0; }
@@ -60,8 +81,26 @@ private:
     uint16_t pop16();
 
     int  handleInterrupts();
+    int  dispatch(); // fetch, decode and run one instruction
     int  execute(uint8_t op);
+#ifdef GB_LEGACY_DECODER
     int  executeCB();
+#else
+    // Compile-time generated opcode handlers (cpu.cpp).
+    struct Ops;
+    // Straight-line runs of ROM instructions decoded once and replayed
+    // from then on, keyed by (bank, pc) (cpu.cpp).
+    struct Uop;
+    struct Block;
+    struct BlockCache;
+    const Uop* nextUop();
+    Block* findBlock(int bank, uint16_t addr);
+
+    std::unique_ptr<BlockCache> blocks;
+    Block*   curBlock = nullptr;
+    uint16_t curIndex = 0;   // next uop in curBlock
+    bool     blockCacheOn = true;
+#endif
 
     void add8(uint8_t v);
     void adc8(uint8_t v);
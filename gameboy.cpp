@@ -1,9 +1,11 @@
 #include "gameboy.h"
-#include "memory.h"
-#include "cpu.h"
-#include "ppu.h"
-#include "apu.h"
+#include "core.h"
+#include "audio.h"
 #include "ui.h"
+#include "rewind.h"
+#include "movie.h"
+#include "capture.h"
+#include "colorize.h"
 
 #include <iostream>
 #include <fstream>
@@ -14,9 +16,6 @@
 #include <cstring>
 
 namespace {
-constexpr uint32_t kStateMagic   = 0x53574247u; // 'GBWS' (Game Boy Write State)
-constexpr uint32_t kStateVersion = 1;
-
 constexpr uint32_t PALETTES[][4] = {
     // 0: GREEN (DMG classic)
     { 0xFF9BBC0Fu, 0xFF8BAC0Fu, 0xFF306230u, 0xFF0F380Fu },
@@ -29,16 +28,28 @@ constexpr uint32_t PALETTES[][4] = {
 };
 constexpr int PALETTE_COUNT = sizeof(PALETTES) / sizeof(PALETTES[0]);
 constexpr const char* PALETTE_NAMES[] = { "GREEN", "GRAY", "POCKET", "BGB" };
+
+// e.g. screenshot_20240131_235959, in the working directory.
+std::string timestampedName(const char* prefix) {
+    std::time_t t = std::time(nullptr);
+    std::tm* lt = std::localtime(&t);
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s_%04d%02d%02d_%02d%02d%02d", prefix,
+                  lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday,
+                  lt->tm_hour, lt->tm_min, lt->tm_sec);
+    return name;
+}
 }
 
 GameBoy::GameBoy() = default;
 
 GameBoy::~GameBoy() {
+    delete capture;  // finishes writing anything still queued
+    delete movie;
+    delete rewind;
     delete ui;
-    delete cpu;
-    delete ppu;
-    delete apu;
-    delete memory;
+    delete audio;
+    delete core;
     if (texture)  SDL_DestroyTexture(texture);
     if (renderer) SDL_DestroyRenderer(renderer);
     if (window)   SDL_DestroyWindow(window);
@@ -55,7 +66,11 @@ bool GameBoy::init() {
                               SCREEN_WIDTH * windowScale, SCREEN_HEIGHT * windowScale,
                               SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
     if (!window) { std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << '\n'; return false; }
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    // Only vsync pacing may block in SDL_RenderPresent; the other modes
+    // would otherwise have two clocks fighting over the frame rate.
+    Uint32 renderFlags = SDL_RENDERER_ACCELERATED;
+    if (paceMode == PaceMode::Vsync) renderFlags |= SDL_RENDERER_PRESENTVSYNC;
+    renderer = SDL_CreateRenderer(window, -1, renderFlags);
     if (!renderer) { std::cerr << "SDL_CreateRenderer failed: " << SDL_GetError() << '\n'; return false; }
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
@@ -63,15 +78,31 @@ bool GameBoy::init() {
                                 SCREEN_WIDTH, SCREEN_HEIGHT);
     if (!texture) { std::cerr << "SDL_CreateTexture failed: " << SDL_GetError() << '\n'; return false; }
 
-    memory = new Memory();
-    cpu    = new CPU(*memory);
-    ppu    = new PPU(*memory);
-    apu    = new APU(*memory);
-    memory->setCPU(cpu);
-    memory->setPPU(ppu);
-    memory->setAPU(apu);
-    if (!apu->init()) {
-        std::cerr << "APU init failed, continuing without sound\n";
+    core  = new Core();
+    core->setIdleLoopSkip(idleLoopSkip);
+    audio = new AudioOutput();
+    rewind = new Rewind(REWIND_SECONDS);
+    movie  = new Movie();
+    capture = new Capture();
+    if (!audio->init(APU::SAMPLE_RATE)) {
+        std::cerr << "Audio init failed, continuing without sound\n";
+        if (paceMode == PaceMode::Audio) paceMode = PaceMode::Spin;
+    }
+    if (paceMode == PaceMode::Vsync) {
+        SDL_RendererInfo info{};
+        SDL_DisplayMode mode{};
+        if (SDL_GetRendererInfo(renderer, &info) != 0 || !(info.flags & SDL_RENDERER_PRESENTVSYNC)) {
+            std::cerr << "Vsync unavailable, pacing with the spin timer\n";
+            paceMode = PaceMode::Spin;
+        } else {
+            double refresh = 60.0;
+            if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+                refresh = mode.refresh_rate;
+            }
+            cadence.setRates(refresh, 1000.0 / FRAME_TIME);
+            audio->setRateScale(cadence.speedRatio());
+            frameStats = FrameStats(1000.0 / refresh);
+        }
     }
     setPaletteByIndex(paletteIdx);
 
@@ -82,10 +113,14 @@ bool GameBoy::init() {
 }
 
 bool GameBoy::loadROM(const std::string& path) {
-    if (!memory->loadROM(path)) return false;
-    cpu->reset();
-    ppu->reset();
-    apu->reset();
+    stopRecording();
+    if (!core->loadROM(path)) return false;
+    rewind->reset(*core);
+    if (trace::enabled) {
+        symbols = trace::SymbolTable();
+        symbols.load(romSiblingPath(".sym"));
+        trace::dumpOnCrash(romSiblingPath(".crash.txt"), &symbols);
+    }
     setPaletteByIndex(paletteIdx);
     if (ui) {
         ui->setRomLoaded(true);
@@ -96,24 +131,21 @@ bool GameBoy::loadROM(const std::string& path) {
 }
 
 bool GameBoy::unloadCurrentROM() {
-    if (!memory->hasROM()) return false;
-    memory->unloadROM();
-    cpu->reset();
-    ppu->reset();
-    apu->reset();
+    if (!core->hasROM()) return false;
+    stopRecording();
+    core->unloadROM();
+    rewind->clear();
     if (ui) ui->setRomLoaded(false);
     return true;
 }
 
 void GameBoy::resetGame() {
-    if (!memory->hasROM()) return;
-    std::string path = memory->romPath();
-    memory->unloadROM();
-    memory->loadROM(path);
-    cpu->reset();
-    ppu->reset();
-    apu->reset();
+    if (!core->hasROM()) return;
+    stopRecording();
+    core->reset();
+    rewind->reset(*core);
     setPaletteByIndex(paletteIdx);
+    republish = true;
     if (ui) ui->toast("RESET");
 }
 
@@ -121,7 +153,7 @@ void GameBoy::setPaletteByIndex(int idx) {
     if (idx < 0) idx = PALETTE_COUNT - 1;
     if (idx >= PALETTE_COUNT) idx = 0;
     paletteIdx = idx;
-    if (ppu) ppu->setPalette(PALETTES[paletteIdx]);
+    if (core) core->getPPU().setPalette(PALETTES[paletteIdx]);
     if (ui)  ui->setPaletteName(paletteName(paletteIdx));
 }
 
@@ -140,7 +172,7 @@ void GameBoy::toggleFullscreen() {
 }
 
 std::string GameBoy::statePathForSlot(int slot) const {
-    std::string base = memory->romPath();
+    std::string base = core->getMemory().romPath();
     if (base.empty()) return {};
     auto dot = base.find_last_of('.');
     std::string stem = (dot == std::string::npos) ? base : base.substr(0, dot);
@@ -150,31 +182,21 @@ std::string GameBoy::statePathForSlot(int slot) const {
 bool GameBoy::saveStateToFile(const std::string& path) {
     std::ofstream f(path, std::ios::binary | std::ios::trunc);
     if (!f) return false;
-    f.write(reinterpret_cast<const char*>(&kStateMagic), sizeof(kStateMagic));
-    f.write(reinterpret_cast<const char*>(&kStateVersion), sizeof(kStateVersion));
-    cpu->saveState(f);
-    ppu->saveState(f);
-    apu->saveState(f);
-    memory->saveState(f);
-    return static_cast<bool>(f);
+    return core->saveState(f);
 }
 
 bool GameBoy::loadStateFromFile(const std::string& path) {
     std::ifstream f(path, std::ios::binary);
     if (!f) return false;
-    uint32_t magic = 0, version = 0;
-    f.read(reinterpret_cast<char*>(&magic), sizeof(magic));
-    f.read(reinterpret_cast<char*>(&version), sizeof(version));
-    if (magic != kStateMagic || version != kStateVersion) return false;
-    if (!cpu->loadState(f)) return false;
-    if (!ppu->loadState(f)) return false;
-    if (!apu->loadState(f)) return false;
-    if (!memory->loadState(f)) return false;
+    stopRecording();
+    if (!core->loadState(f)) return false;
+    audio->clear();
+    republish = true;
     return true;
 }
 
 void GameBoy::saveStateSlot(int slot) {
-    if (!memory->hasROM()) {
+    if (!core->hasROM()) {
         if (ui) ui->toast("NO ROM LOADED");
         return;
     }
@@ -189,7 +211,7 @@ void GameBoy::saveStateSlot(int slot) {
 }
 
 void GameBoy::loadStateSlot(int slot) {
-    if (!memory->hasROM()) {
+    if (!core->hasROM()) {
         if (ui) ui->toast("NO ROM LOADED");
         return;
     }
@@ -203,30 +225,103 @@ void GameBoy::loadStateSlot(int slot) {
     }
 }
 
+// The PNG is written on the capture thread; this only copies the frame.
 void GameBoy::takeScreenshot() {
-    if (!memory->hasROM()) {
+    if (!core->hasROM()) {
         if (ui) ui->toast("NO ROM LOADED");
         return;
     }
-    std::time_t t = std::time(nullptr);
-    std::tm* lt = std::localtime(&t);
-    char fname[128];
-    std::snprintf(fname, sizeof(fname), "screenshot_%04d%02d%02d_%02d%02d%02d.bmp",
-                  lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday,
-                  lt->tm_hour, lt->tm_min, lt->tm_sec);
-    SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormat(
-        0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
-    if (!surf) {
-        if (ui) ui->toast("SCREENSHOT FAILED");
+    // The frame on screen, or the core's if none was presented yet.
+    const uint8_t* shades = haveFrame ? frames.readSlot().shades : core->getPPU().getFramebuffer();
+    std::string name = timestampedName("screenshot") + ".png";
+    bool ok = capture->screenshot(name, shades, PALETTES[paletteIdx]);
+    if (ui) ui->toast(ok ? "SAVED " + name : "SCREENSHOT FAILED");
+}
+
+void GameBoy::toggleCapture() {
+    if (capture->isRecording()) {
+        stopCapture();
+        return;
+    }
+    if (!core->hasROM()) {
+        if (ui) ui->toast("NO ROM LOADED");
+        return;
+    }
+    std::string base = timestampedName("capture");
+    if (!capture->startRecording(base, PALETTES[paletteIdx])) {
+        if (ui) ui->toast("CAPTURE FAILED");
+        return;
+    }
+    if (ui) ui->toast("CAPTURING " + base);
+}
+
+void GameBoy::stopCapture() {
+    if (!capture->isRecording()) return;
+    capture->stopRecording();
+    Capture::Stats st = capture->getStats();
+    if (ui) {
+        ui->toast("CAPTURE SAVED, " + std::to_string(st.framesDropped) + " FRAMES DROPPED");
+    }
+}
+
+std::string GameBoy::moviePath() const {
+    std::string base = core->getMemory().romPath();
+    if (base.empty()) return {};
+    auto dot = base.find_last_of('.');
+    std::string stem = (dot == std::string::npos) ? base : base.substr(0, dot);
+    return stem + ".gbm";
+}
+
+std::string GameBoy::romSiblingPath(const char* ext) const {
+    std::string base = core->getMemory().romPath();
+    if (base.empty()) return {};
+    auto dot = base.find_last_of('.');
+    return ((dot == std::string::npos) ? base : base.substr(0, dot)) + ext;
+}
+
+void GameBoy::requestTraceDump() {
+    if (!trace::enabled) {
+        ui->toast("TRACING NEEDS TRACE=1");
+    } else if (!core->hasROM()) {
+        ui->toast("NO ROM LOADED");
+    } else {
+        traceRequested = true;
+    }
+}
+
+// Runs on the emulation thread, whose ring and coverage these are.
+void GameBoy::writeTraceDump() {
+    std::lock_guard<std::mutex> lock(coreMutex);
+    const trace::SymbolTable* syms = symbols.empty() ? nullptr : &symbols;
+    bool ok = trace::writeRing(romSiblingPath(".trace.txt"), syms) &&
+              trace::writeCoverage(romSiblingPath(".cov")) &&
+              (!syms || trace::writeCoverageSummary(romSiblingPath(".cov.txt"), symbols));
+    traceResult = ok ? 1 : 2;
+}
+
+void GameBoy::toggleRecording() {
+    if (recording) {
+        stopRecording();
         return;
     }
-    SDL_LockSurface(surf);
-    std::memcpy(surf->pixels, ppu->getFramebuffer(),
-                SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
-    SDL_UnlockSurface(surf);
-    int ok = SDL_SaveBMP(surf, fname);
-    SDL_FreeSurface(surf);
-    if (ui) ui->toast(ok == 0 ? std::string("SAVED ") + fname : "SCREENSHOT FAILED");
+    if (!core->hasROM()) {
+        if (ui) ui->toast("NO ROM LOADED");
+        return;
+    }
+    if (!movie->start(*core)) {
+        if (ui) ui->toast("RECORD FAILED");
+        return;
+    }
+    recording = true;
+    if (ui) ui->toast("RECORDING");
+}
+
+// Ends the current recording, if any, and writes it next to the ROM.
+void GameBoy::stopRecording() {
+    if (!recording) return;
+    recording = false;
+    bool ok = movie->save(moviePath());
+    if (ui) ui->toast(ok ? "MOVIE SAVED " + moviePath() : "MOVIE SAVE FAILED");
 }
 
 void GameBoy::pollInput() {
@@ -245,13 +340,15 @@ void GameBoy::pollInput() {
                     if (ui->isMenuOpen()) {
                         // Only close if we have a ROM to fall back to; otherwise
                         // keep the title menu visible.
-                        if (memory->hasROM()) ui->closeMenu();
+                        if (core->hasROM()) ui->closeMenu();
                     } else {
                         ui->openInGameMenu();
                     }
                     continue;
                 case SDLK_F2: saveStateSlot(saveSlot); continue;
+                case SDLK_F3: ui->toggleProfiler(); continue;
                 case SDLK_F4: loadStateSlot(saveSlot); continue;
+                case SDLK_F5: toggleRecording(); continue;
                 case SDLK_F6:
                     saveSlot = (saveSlot + 9) % 10;
                     ui->setSlot(saveSlot);
@@ -264,17 +361,19 @@ void GameBoy::pollInput() {
                     continue;
                 case SDLK_F8: takeScreenshot(); continue;
                 case SDLK_F9: resetGame(); continue;
+                case SDLK_F10: requestTraceDump(); continue;
                 case SDLK_F11: toggleFullscreen(); continue;
+                case SDLK_F12: toggleCapture(); continue;
                 case SDLK_m:
                     if (ui->isMenuOpen()) break;
                     muted = !muted;
-                    apu->setMuted(muted);
+                    core->getAPU().setMuted(muted);
                     ui->setMutedView(muted);
                     ui->toast(muted ? "MUTED" : "UNMUTED");
                     continue;
                 case SDLK_p:
                     if (ui->isMenuOpen()) break;
-                    if (memory->hasROM()) {
+                    if (core->hasROM()) {
                         paused = !paused;
                         ui->setPaused(paused);
                         ui->toast(paused ? "PAUSED" : "RESUMED");
@@ -290,7 +389,7 @@ void GameBoy::pollInput() {
             }
 
             if (k == SDLK_ESCAPE) {
-                if (memory->hasROM()) ui->openInGameMenu();
+                if (core->hasROM()) ui->openInGameMenu();
                 else                  ui->openTitleMenu();
                 continue;
             }
@@ -298,7 +397,7 @@ void GameBoy::pollInput() {
     }
 
     // Apply joypad input only when game is running and no menu is up.
-    if (!ui->isMenuOpen() && !paused && memory->hasROM()) {
+    if (!ui->isMenuOpen() && !paused && core->hasROM()) {
         const Uint8* ks = SDL_GetKeyboardState(nullptr);
         uint8_t btn = 0x0F;
         uint8_t dp  = 0x0F;
@@ -311,15 +410,17 @@ void GameBoy::pollInput() {
         if (ks[SDL_SCANCODE_UP])        dp  &= ~0x04;
         if (ks[SDL_SCANCODE_DOWN])      dp  &= ~0x08;
         fastForward = ks[SDL_SCANCODE_SPACE] != 0;
-        buttons = btn;
-        dpad    = dp;
-        memory->setJoypadState(buttons, dpad);
+        // Rewinding would break the recorded input timeline.
+        rewinding   = !recording && ks[SDL_SCANCODE_R] != 0;
+        inputMailbox.store(static_cast<uint8_t>(btn << 4 | dp), std::memory_order_release);
     } else {
         // Release joypad when menu is open.
-        memory->setJoypadState(0x0F, 0x0F);
+        inputMailbox.store(0xFF, std::memory_order_release);
         fastForward = false;
+        rewinding = false;
     }
     ui->setFastForwardView(fastForward);
+    ui->setRewindView(rewinding);
 }
 
 void GameBoy::applyUIAction() {
@@ -327,12 +428,12 @@ void GameBoy::applyUIAction() {
     if (a.quit) running = false;
     if (a.resetRequested) resetGame();
     if (a.quitToMenuRequested) {
-        memory->saveSRAM();
+        core->getMemory().saveSRAM();
         unloadCurrentROM();
         ui->openTitleMenu();
     }
     if (!a.loadRomPath.empty()) {
-        memory->saveSRAM();
+        core->getMemory().saveSRAM();
         unloadCurrentROM();
         if (!loadROM(a.loadRomPath)) {
             ui->toast("LOAD FAILED");
@@ -347,7 +448,7 @@ void GameBoy::applyUIAction() {
     }
     if (a.toggleMute) {
         muted = !muted;
-        apu->setMuted(muted);
+        core->getAPU().setMuted(muted);
         ui->setMutedView(muted);
     }
     if (a.toggleFullscreen) toggleFullscreen();
@@ -358,25 +459,44 @@ void GameBoy::applyUIAction() {
     }
 }
 
-void GameBoy::runOneFrame() {
-    int frameCycles = 0;
-    while (frameCycles < CYCLES_PER_FRAME && running) {
-        int c = cpu->step();
-        memory->updateTimer(c);
-        memory->updateDMA(c);
-        ppu->step(c);
-        apu->step(c);
-        frameCycles += c;
-        if (ppu->isFrameReady()) {
-            ppu->clearFrameReady();
-        }
-    }
+void GameBoy::runOneFrame(bool render, bool audible) {
+    // Movies hash the framebuffer each frame, so recording draws them all;
+    // so does capturing video.
+    bool capturing = capture->isRecording();
+    Core::Frame f = core->runFrame(render || recording || capturing);
+    if (audible) audio->push(f.audio, f.audioFrames);
+    if (capturing) capture->submitFrame(f.framebuffer, f.audio, f.audioFrames);
+    rewind->capture(*core);
+    if (recording) movie->record(buttons, dpad, *core);
+}
+
+void GameBoy::rewindOneFrame() {
+    // Hold on the oldest snapshot once history runs out.
+    if (rewind->stepBack(*core)) audio->clear();
+}
+
+void GameBoy::publishFrame() {
+    std::memcpy(frames.writeSlot().shades, core->getPPU().getFramebuffer(),
+                sizeof(VideoFrame::shades));
+    frames.publish();
+    if (prof::enabled) profSnapshot = prof::counters;
 }
 
 void GameBoy::presentFrame() {
-    if (memory->hasROM()) {
-        SDL_UpdateTexture(texture, nullptr, ppu->getFramebuffer(),
-                          SCREEN_WIDTH * sizeof(uint32_t));
+    // Colorize on this thread so palette changes show even while paused.
+    if (frames.update()) haveFrame = true;
+    if (haveFrame) {
+        void* pixels = nullptr;
+        int pitch = 0;
+        if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0) {
+            const uint8_t* shades = frames.readSlot().shades;
+            for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+                colorize(shades + y * SCREEN_WIDTH,
+                         reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + y * pitch),
+                         SCREEN_WIDTH, PALETTES[paletteIdx]);
+            }
+            SDL_UnlockTexture(texture);
+        }
     }
     int outW = 0, outH = 0;
     SDL_GetRendererOutputSize(renderer, &outW, &outH);
@@ -385,38 +505,148 @@ void GameBoy::presentFrame() {
 
 void GameBoy::run() {
     running = true;
-    if (!memory->hasROM()) {
+    if (!core->hasROM()) {
         ui->openTitleMenu();
     }
 
-    using clock = std::chrono::high_resolution_clock;
-    auto last = clock::now();
-
+    std::thread emuThread(&GameBoy::emulationLoop, this);
     while (running) {
-        pollInput();
-        applyUIAction();
-
-        if (memory->hasROM() && !paused && !ui->isMenuOpen()) {
-            int frames = fastForward ? FAST_FORWARD_FRAMES : 1;
-            for (int i = 0; i < frames && running; ++i) {
-                runOneFrame();
+        {
+            std::lock_guard<std::mutex> lock(coreMutex);
+            pollInput();
+            applyUIAction();
+            if (int r = traceResult.exchange(0)) {
+                ui->toast(r == 1 ? "TRACE SAVED " + romSiblingPath(".trace.txt") : "TRACE FAILED");
             }
+            emulating = core->hasROM() && !paused && !ui->isMenuOpen();
+            if (ui->screen() == UI::Screen::Profiler) ui->setProfile(profSnapshot);
         }
 
         presentFrame();
+        bool newFrame = true;
+        if (paceMode == PaceMode::Vsync) {
+            refreshTicks.fetch_add(1, std::memory_order_release);
+        } else {
+            newFrame = waitForFrame();
+        }
+        // A timed-out wait is not a frame; the stall shows up as one long
+        // interval once the frame does arrive.
+        if (newFrame || !emulating) frameStats.mark(emulating);
+    }
+    emuThread.join();
+
+    stopRecording();
+    stopCapture();
+    core->getMemory().flushSRAM();
+    reportFrameStats();
+    reportProfile();
+}
 
-        // Pace to 59.7275 Hz unless fast-forwarding.
-        auto now = clock::now();
-        double elapsed = std::chrono::duration<double, std::milli>(now - last).count();
-        double target = (memory->hasROM() && !paused && !ui->isMenuOpen() && !fastForward)
-                            ? FRAME_TIME
-                            : (1000.0 / 60.0);
-        if (elapsed < target) {
-            std::this_thread::sleep_for(
-                std::chrono::duration<double, std::milli>(target - elapsed));
+void GameBoy::emulationLoop() {
+    uint32_t seenRefresh = refreshTicks.load(std::memory_order_acquire);
+    while (running) {
+        const bool turbo = turboFrames > 0 && fastForward;
+        if (paceMode == PaceMode::Vsync && !turbo) waitForRefresh(seenRefresh);
+        if (traceRequested.exchange(false)) writeTraceDump();
+        if (!emulating) {
+            if (republish.exchange(false)) {
+                std::lock_guard<std::mutex> lock(coreMutex);
+                if (core->hasROM()) publishFrame();
+            }
+            if (paceMode != PaceMode::Vsync) spinTimer.wait(IDLE_FRAME_TIME);
+            continue;
         }
-        last = clock::now();
+        {
+            std::lock_guard<std::mutex> lock(coreMutex);
+            if (!core->hasROM()) continue;
+            uint8_t in = inputMailbox.load(std::memory_order_acquire);
+            buttons = in >> 4;
+            dpad    = in & 0x0F;
+            core->setJoypadState(buttons, dpad);
+            if (rewinding) {
+                rewindOneFrame();
+            } else if (turbo) {
+                for (int i = 0; i < turboFrames; ++i) runOneFrame(i == turboFrames - 1, false);
+            } else {
+                int n = fastForward ? FAST_FORWARD_FRAMES : 1;
+                audio->setSpeed(n);
+                if (paceMode == PaceMode::Vsync && !fastForward) n = cadence.framesThisRefresh();
+                // Only the last frame of a batch is shown.
+                for (int i = 0; i < n; ++i) runOneFrame(i == n - 1);
+            }
+            publishFrame();
+        }
+        if (turbo) {
+            // Let the UI thread at the core between bursts.
+            std::this_thread::yield();
+        } else if (paceMode != PaceMode::Vsync) {
+            paceEmulation();
+        }
+    }
+}
+
+void GameBoy::paceEmulation() {
+    // Rewind pushes no audio, so there is nothing to block on.
+    if (paceMode == PaceMode::Audio && !rewinding) {
+        waitForAudio();
+        return;
+    }
+    spinTimer.wait(fastForward ? IDLE_FRAME_TIME : FRAME_TIME);
+}
+
+void GameBoy::waitForRefresh(uint32_t& seen) {
+    using clock = std::chrono::steady_clock;
+    const auto giveUp = clock::now() + std::chrono::milliseconds(100);
+    uint32_t now = refreshTicks.load(std::memory_order_acquire);
+    while (now == seen && running && clock::now() < giveUp) {
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
+        now = refreshTicks.load(std::memory_order_acquire);
+    }
+    // Handle one refresh at a time, but drop a backlog rather than racing
+    // through it if emulation fell behind.
+    if (now - seen > 2) seen = now;
+    else if (now != seen) seen++;
+}
+
+bool GameBoy::waitForFrame() {
+    // Present as soon as the emulation thread has something new. Menus and
+    // toasts keep animating at the idle rate when nothing is running.
+    using clock = std::chrono::steady_clock;
+    const double timeoutMs = emulating ? 100.0 : IDLE_FRAME_TIME;
+    const auto giveUp = clock::now() + std::chrono::duration_cast<clock::duration>(
+                            std::chrono::duration<double, std::milli>(timeoutMs));
+    while (!frames.hasUpdate() && running && clock::now() < giveUp) {
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
+    }
+    return frames.hasUpdate();
+}
+
+void GameBoy::waitForAudio() {
+    // Block until the device has drained the ring back to its target fill,
+    // so the sound card's clock sets the frame rate. Give up after a few
+    // frames in case the device has stopped pulling.
+    using clock = std::chrono::steady_clock;
+    const auto giveUp = clock::now() + std::chrono::milliseconds(100);
+    while (audio->bufferedFrames() > audio->targetFrames() && clock::now() < giveUp) {
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
     }
+    spinTimer.reset();
+}
 
-    memory->saveSRAM();
+void GameBoy::reportFrameStats() {
+    if (frameStats.frames() == 0) return;
+    frameStats.print(std::cout, paceModeName(paceMode));
+    std::cout << "audio underruns=" << audio->underruns() << '\n';
+    if (!frameStatsPath.empty() && !frameStats.writeCSV(frameStatsPath)) {
+        std::cerr << "Failed to write " << frameStatsPath << '\n';
+    }
+}
+
+void GameBoy::reportProfile() {
+    if (!prof::enabled) return;
+    if (prof::writeCSV(profSnapshot, profilePath)) {
+        std::cout << "profile written to " << profilePath << '\n';
+    } else {
+        std::cerr << "Failed to write " << profilePath << '\n';
+    }
 }
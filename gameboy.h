@@ -1,53 +1,127 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <SDL.h>
 
-class CPU;
-class Memory;
-class PPU;
-class APU;
+#include "pacer.h"
+#include "ppu.h"
+#include "profile.h"
+#include "trace.h"
+#include "triplebuffer.h"
+
+class Core;
+class AudioOutput;
 class UI;
+class Rewind;
+class Movie;
+class Capture;
 
 class GameBoy {
 public:
     GameBoy();
     ~GameBoy();
 
+    // These must be set before init().
+    void setPaceMode(PaceMode mode) { paceMode = mode; }
+    void setFrameStatsPath(const std::string& path) { frameStatsPath = path; }
+    void setIdleLoopSkip(bool on) { idleLoopSkip = on; }
+    // Non-zero makes fast-forward uncapped and silent, drawing one frame
+    // in `frames`.
+    void setTurbo(int frames) { turboFrames = frames; }
+    // Where a PROFILE=1 build writes its counters on exit.
+    void setProfilePath(const std::string& path) { profilePath = path; }
+
     bool init();
     bool loadROM(const std::string& path);
     void run();
 
 private:
-    Memory* memory = nullptr;
-    CPU*    cpu    = nullptr;
-    PPU*    ppu    = nullptr;
-    APU*    apu    = nullptr;
-    UI*     ui     = nullptr;
+    Core*        core  = nullptr;
+    AudioOutput* audio = nullptr;
+    UI*          ui    = nullptr;
+    Rewind*      rewind = nullptr;
+    Movie*       movie  = nullptr;
+    Capture*     capture = nullptr;
 
     SDL_Window*   window   = nullptr;
     SDL_Renderer* renderer = nullptr;
     SDL_Texture*  texture  = nullptr;
 
-    bool running = false;
+    // The core runs on its own thread (emulationLoop). Everything that
+    // touches the core, rewind, movie or audio producer from the UI thread
+    // holds coreMutex; the emulation thread holds it only while stepping.
+    std::mutex coreMutex;
+
+    // Finished frames (shade indices), emulation thread -> UI thread.
+    struct VideoFrame {
+        uint8_t shades[SCREEN_WIDTH * SCREEN_HEIGHT];
+    };
+    TripleBuffer<VideoFrame> frames;
+    bool haveFrame = false;
+    // Asks a paused emulation thread to publish the core's current frame
+    // (after a state load or reset).
+    std::atomic<bool> republish{false};
+
+    // Joypad mailbox, sampled once per emulated frame: buttons << 4 | dpad.
+    std::atomic<uint8_t> inputMailbox{0xFF};
+    // Set by the UI thread: ROM loaded, not paused, no menu up.
+    std::atomic<bool> emulating{false};
+    // Bumped after every present in vsync mode to release the next frames.
+    std::atomic<uint32_t> refreshTicks{0};
+
+    std::atomic<bool> running{false};
     bool paused = false;
-    bool fastForward = false;
+    std::atomic<bool> fastForward{false};
+    std::atomic<bool> rewinding{false};
+    bool recording = false;
+    bool idleLoopSkip = false;
+    int  turboFrames = 0;
     bool fullscreen = false;
     bool muted = false;
     int  windowScale = 4;
     int  saveSlot = 0;
     int  paletteIdx = 1;
 
-    uint8_t buttons = 0x0F;
+    uint8_t buttons = 0x0F; // last input the emulation thread applied
     uint8_t dpad    = 0x0F;
 
-    static constexpr int    CYCLES_PER_FRAME = 70224;
     static constexpr double FRAME_TIME = 1000.0 / 59.7275;
+    static constexpr double IDLE_FRAME_TIME = 1000.0 / 60.0;
+
+    PaceMode       paceMode = PaceMode::Audio;
+    SpinTimer      spinTimer;
+    RefreshCadence cadence;
+    FrameStats     frameStats{FRAME_TIME};
+    std::string    frameStatsPath;
+
+    // The emulation thread's counters as of its last published frame.
+    prof::Counters profSnapshot{};
+    std::string    profilePath = "profile.csv";
+
+    // F10 in TRACE=1 builds. The ring and coverage belong to the emulation
+    // thread, so it writes them and reports back: 1 saved, 2 failed.
+    std::atomic<bool> traceRequested{false};
+    std::atomic<int>  traceResult{0};
+    trace::SymbolTable symbols; // the ROM's .sym, if any
+
     static constexpr int    FAST_FORWARD_FRAMES = 4;
+    static constexpr int    REWIND_SECONDS = 60;
 
+    void emulationLoop();
+    void publishFrame();
     void pollInput();
     void presentFrame();
-    void runOneFrame();
+    void paceEmulation();
+    void waitForAudio();
+    void waitForRefresh(uint32_t& seen);
+    bool waitForFrame();
+    void reportFrameStats();
+    void reportProfile();
+    void runOneFrame(bool render, bool audible = true);
+    void rewindOneFrame();
     void applyUIAction();
 
     void resetGame();
@@ -59,6 +133,16 @@ private:
     void loadStateSlot(int slot);
     std::string statePathForSlot(int slot) const;
     void takeScreenshot();
+    void toggleCapture();
+    void stopCapture();
+
+    void toggleRecording();
+    void stopRecording();
+    std::string moviePath() const;
+
+    void requestTraceDump();
+    void writeTraceDump();
+    std::string romSiblingPath(const char* ext) const;
 
     void setPaletteByIndex(int idx);
     const char* paletteName(int idx) const;
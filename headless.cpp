@@ -0,0 +1,260 @@
+#include "core.h"
+#include "hash.h"
+#include "image.h"
+#include "linksession.h"
+#include "movie.h"
+#include "profile.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+void printUsage(const char* argv0) {
+    std::cerr <<
+        "Usage: " << argv0 << " <rom.gb> [options]\n"
+        "  --frames N        Frames to emulate (default 600, or the whole movie)\n"
+        "  --play FILE       Replay an input movie, checking its frame hashes\n"
+        "  --dump-frame FILE Write the final frame as a binary PPM\n"
+        "  --profile FILE    Write performance counters as CSV (PROFILE=1 builds)\n"
+        "  --trace FILE      Write the last executed instructions, also on a crash (TRACE=1 builds)\n"
+        "  --coverage FILE   Write code coverage, plus FILE.txt per label with symbols (TRACE=1 builds)\n"
+        "  --sym FILE        Symbol file for the trace (default: the ROM's .sym, if any)\n"
+        "  --idle-skip       Fast-forward LY/STAT polling loops\n"
+        "  --frameskip N     Draw one frame in N (and always the last)\n"
+        "  --render-thread   Draw scanlines on a worker thread\n"
+        "  --link-peer H:P   Connect the link port to another instance over UDP\n"
+        "  --link-port N     Local UDP port for --link-peer (default 5620)\n"
+        "  --link-delay N    Extra frames of link latency (default 2)\n";
+}
+
+// How long a peer may go silent before the run is abandoned.
+constexpr int LINK_TIMEOUT_MS = 10000;
+
+bool advanceLinked(LinkSession& session, bool render) {
+    for (int waited = 0; !session.advance(render); waited += 10) {
+        if (waited >= LINK_TIMEOUT_MS) {
+            std::cerr << "Link: peer not responding at frame " << session.frame() << '\n';
+            return false;
+        }
+        session.waitForPeer(10);
+    }
+    return true;
+}
+
+// Wait until no frame rests on a guess, then stay around briefly so the
+// peer gets what it needs to do the same.
+bool settleLinked(LinkSession& session) {
+    for (int waited = 0; !session.settle(); waited += 10) {
+        if (waited >= LINK_TIMEOUT_MS) {
+            std::cerr << "Link: peer left before the last frames were confirmed\n";
+            return false;
+        }
+        session.waitForPeer(10);
+    }
+    for (int i = 0; i < 25; ++i) {
+        session.waitForPeer(10);
+        session.settle();
+    }
+    return true;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string romPath;
+    std::string dumpPath;
+    std::string moviePath;
+    std::string profilePath;
+    std::string tracePath;
+    std::string coveragePath;
+    std::string symPath;
+    long frames = -1;
+    long frameskip = 1;
+    bool idleSkip = false;
+    bool renderThread = false;
+    LinkSession::Options link;
+    link.localPort = 5620;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            moviePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--dump-frame") == 0 && i + 1 < argc) {
+            dumpPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--idle-skip") == 0) {
+            idleSkip = true;
+        } else if (std::strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+            frameskip = std::strtol(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--render-thread") == 0) {
+            renderThread = true;
+        } else if (std::strcmp(argv[i], "--link-peer") == 0 && i + 1 < argc) {
+            std::string peer = argv[++i];
+            size_t colon = peer.rfind(':');
+            if (colon == std::string::npos) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            link.peerHost = peer.substr(0, colon);
+            link.peerPort = static_cast<uint16_t>(std::strtol(peer.c_str() + colon + 1, nullptr, 10));
+        } else if (std::strcmp(argv[i], "--link-port") == 0 && i + 1 < argc) {
+            link.localPort = static_cast<uint16_t>(std::strtol(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--link-delay") == 0 && i + 1 < argc) {
+            link.delay = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+            coveragePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--sym") == 0 && i + 1 < argc) {
+            symPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            romPath = argv[i];
+        }
+    }
+    if (romPath.empty() || frames < -1 || frameskip < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!profilePath.empty() && !prof::enabled) {
+        std::cerr << "--profile needs a build with PROFILE=1\n";
+        return 1;
+    }
+    if ((!tracePath.empty() || !coveragePath.empty()) && !trace::enabled) {
+        std::cerr << (tracePath.empty() ? "--coverage" : "--trace")
+                  << " needs a build with TRACE=1\n";
+        return 1;
+    }
+
+    trace::SymbolTable symbols;
+    if (!symPath.empty()) {
+        if (!symbols.load(symPath)) {
+            std::cerr << "Failed to load symbols: " << symPath << '\n';
+            return 1;
+        }
+    } else if (trace::enabled) {
+        size_t dot = romPath.find_last_of('.');
+        symbols.load((dot == std::string::npos ? romPath : romPath.substr(0, dot)) + ".sym");
+    }
+    const trace::SymbolTable* traceSymbols = symbols.empty() ? nullptr : &symbols;
+    if (!tracePath.empty()) trace::dumpOnCrash(tracePath, traceSymbols);
+
+    Core core;
+    core.setIdleLoopSkip(idleSkip);
+    core.getPPU().setThreadedRendering(renderThread);
+    if (!core.loadROM(romPath)) {
+        std::cerr << "Failed to load ROM: " << romPath << '\n';
+        return 1;
+    }
+
+    Movie movie;
+    if (!moviePath.empty()) {
+        if (!movie.load(moviePath)) {
+            std::cerr << "Failed to load movie: " << moviePath << '\n';
+            return 1;
+        }
+        if (movie.title() != core.getMemory().romTitle()) {
+            std::cerr << "Warning: movie was recorded with \"" << movie.title() << "\"\n";
+        }
+        if (!movie.restoreStart(core)) {
+            std::cerr << "Movie start state does not fit this ROM\n";
+            return 1;
+        }
+        long length = static_cast<long>(movie.frameCount());
+        if (frames < 0 || frames > length) frames = length;
+    } else if (frames < 0) {
+        frames = 600;
+    }
+
+    // Opened last, so both ends start from the state they loaded.
+    LinkSession session(core);
+    if (!link.peerHost.empty()) {
+        std::string error;
+        if (!session.open(link, error)) {
+            std::cerr << "Link: " << error << '\n';
+            return 1;
+        }
+    }
+
+    prof::reset(); // count only the timed run
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    long desyncFrame = -1;
+    // Movie hashes cover the framebuffer, so checking them needs every frame drawn.
+    bool drawAll = frameskip == 1 || movie.hasHashes();
+    for (long i = 0; i < frames; ++i) {
+        if (!moviePath.empty()) core.setJoypadState(movie.buttons(i), movie.dpad(i));
+        bool render = drawAll || (i + 1) % frameskip == 0 || i + 1 == frames;
+        if (!session.isOpen()) {
+            core.runFrame(render);
+        } else if (!advanceLinked(session, render)) {
+            return 1;
+        }
+        if (!moviePath.empty() && movie.hasHashes() &&
+            Movie::frameHash(core) != movie.expectedHash(i)) {
+            desyncFrame = i;
+            frames = i + 1;
+            break;
+        }
+    }
+    if (session.isOpen() && !settleLinked(session)) return 1;
+    double secs = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<uint32_t> fb(SCREEN_WIDTH * SCREEN_HEIGHT);
+    core.getPPU().colorizeFramebuffer(fb.data());
+    uint64_t hash = fnv1a(fb.data(), SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    std::printf("frames=%ld seconds=%.3f fps=%.1f framebuffer_hash=%016llx\n",
+                frames, secs, secs > 0 ? frames / secs : 0.0,
+                static_cast<unsigned long long>(hash));
+
+    if (!profilePath.empty() && !prof::writeCSV(prof::counters, profilePath)) {
+        std::cerr << "Failed to write " << profilePath << '\n';
+        return 1;
+    }
+    if (!tracePath.empty() && !trace::writeRing(tracePath, traceSymbols)) {
+        std::cerr << "Failed to write " << tracePath << '\n';
+        return 1;
+    }
+    if (!coveragePath.empty() &&
+        (!trace::writeCoverage(coveragePath) ||
+         (traceSymbols && !trace::writeCoverageSummary(coveragePath + ".txt", symbols)))) {
+        std::cerr << "Failed to write " << coveragePath << '\n';
+        return 1;
+    }
+    if (!dumpPath.empty() && !writePPM(dumpPath, fb.data())) {
+        std::cerr << "Failed to write " << dumpPath << '\n';
+        return 1;
+    }
+    if (session.isOpen()) {
+        const LinkSession::Stats& st = session.getStats();
+        const std::string& serial = core.getMemory().getSerialOutput();
+        std::printf("link rollbacks=%llu resimulated=%llu max_rollback=%d stalls=%llu "
+                    "serial_bytes=%zu serial_hash=%016llx\n",
+                    static_cast<unsigned long long>(st.rollbacks),
+                    static_cast<unsigned long long>(st.resimulatedFrames), st.maxRollback,
+                    static_cast<unsigned long long>(st.stalls), serial.size(),
+                    static_cast<unsigned long long>(fnv1a(serial.data(), serial.size())));
+        if (session.isDesynced()) {
+            std::printf("link desync\n");
+            return 2;
+        }
+    }
+    if (desyncFrame >= 0) {
+        std::printf("desync at frame %ld\n", desyncFrame);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include "image.h"
+#include "ppu.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+constexpr uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+constexpr int ROW_BYTES = 1 + SCREEN_WIDTH / 4;  // filter byte, 4 pixels a byte
+constexpr int RAW_SIZE  = ROW_BYTES * SCREEN_HEIGHT;
+static_assert(RAW_SIZE <= 0xFFFF, "frame must fit one stored deflate block");
+
+// APNG frame delay: 70224 / 4194304 s in 16-bit terms (to within 1e-8).
+constexpr uint16_t DELAY_NUM = 400;
+constexpr uint16_t DELAY_DEN = 23891;
+
+uint32_t crc32(const uint8_t* p, size_t n, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void put16(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v >> 8);
+    p[1] = uint8_t(v);
+}
+
+void put32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+// Appends a zlib stream holding the packed rows in one stored block to
+// `out`, after `offset` bytes left for the caller.
+void packImage(const uint8_t* shades, std::vector<uint8_t>& out, size_t offset) {
+    out.resize(offset + 2 + 5 + RAW_SIZE + 4);
+    uint8_t* p = out.data() + offset;
+    *p++ = 0x78;  // deflate, 32K window
+    *p++ = 0x01;  // no preset dictionary, fastest
+    *p++ = 0x01;  // final block, stored
+    *p++ = uint8_t(RAW_SIZE);
+    *p++ = uint8_t(RAW_SIZE >> 8);
+    *p++ = uint8_t(~RAW_SIZE);
+    *p++ = uint8_t(~RAW_SIZE >> 8);
+    uint8_t* raw = p;
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        const uint8_t* row = shades + y * SCREEN_WIDTH;
+        *p++ = 0;  // filter: none
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            *p++ = uint8_t((row[x] & 3) << 6 | (row[x + 1] & 3) << 4 |
+                           (row[x + 2] & 3) << 2 | (row[x + 3] & 3));
+        }
+    }
+    uint32_t a = 1, b = 0;
+    for (int i = 0; i < RAW_SIZE; ++i) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(p, b << 16 | a);
+}
+
+void appendChunk(std::vector<uint8_t>& out, const char type[4], const uint8_t* data, size_t size) {
+    size_t at = out.size();
+    out.resize(at + 12 + size);
+    uint8_t* p = out.data() + at;
+    put32(p, uint32_t(size));
+    std::copy(type, type + 4, p + 4);
+    std::copy(data, data + size, p + 8);
+    put32(p + 8 + size, crc32(p + 4, size + 4));
+}
+
+// Signature, IHDR and, for an APNG, an acTL for `frames` frames.
+void appendHeader(std::vector<uint8_t>& out, bool animated, uint32_t frames) {
+    out.insert(out.end(), PNG_SIGNATURE, PNG_SIGNATURE + 8);
+    uint8_t ihdr[13] = {};
+    put32(ihdr, SCREEN_WIDTH);
+    put32(ihdr + 4, SCREEN_HEIGHT);
+    ihdr[8] = 2;  // bits per pixel
+    ihdr[9] = 3;  // indexed colour
+    appendChunk(out, "IHDR", ihdr, sizeof(ihdr));
+    if (animated) {
+        uint8_t actl[8] = {};
+        put32(actl, frames);  // plays: 0, loop forever
+        appendChunk(out, "acTL", actl, sizeof(actl));
+    }
+}
+constexpr long ACTL_OFFSET = 8 + 12 + 13;
+
+void appendPalette(std::vector<uint8_t>& out, const uint32_t palette[4]) {
+    uint8_t plte[12];
+    for (int i = 0; i < 4; ++i) {
+        plte[i * 3]     = uint8_t(palette[i] >> 16);
+        plte[i * 3 + 1] = uint8_t(palette[i] >> 8);
+        plte[i * 3 + 2] = uint8_t(palette[i]);
+    }
+    appendChunk(out, "PLTE", plte, sizeof(plte));
+}
+}
+
+bool writePPM(const std::string& path, const uint32_t* argb) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    f << "P6\n" << SCREEN_WIDTH << ' ' << SCREEN_HEIGHT << "\n255\n";
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i) {
+        char rgb[3] = {
+            static_cast<char>((argb[i] >> 16) & 0xFF),
+            static_cast<char>((argb[i] >>  8) & 0xFF),
+            static_cast<char>( argb[i]        & 0xFF),
+        };
+        f.write(rgb, 3);
+    }
+    return static_cast<bool>(f);
+}
+
+bool writePNG(const std::string& path, const uint8_t* shades, const uint32_t palette[4]) {
+    std::vector<uint8_t> out, image;
+    appendHeader(out, false, 0);
+    appendPalette(out, palette);
+    packImage(shades, image, 0);
+    appendChunk(out, "IDAT", image.data(), image.size());
+    appendChunk(out, "IEND", nullptr, 0);
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    f.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(f);
+}
+
+ApngWriter::~ApngWriter() {
+    close();
+}
+
+bool ApngWriter::open(const std::string& p, const uint32_t palette[4]) {
+    close();
+    file = std::fopen(p.c_str(), "wb");
+    if (!file) return false;
+    path = p;
+    frames = 0;
+    sequence = 0;
+    failed = false;
+    chunk.clear();
+    appendHeader(chunk, true, 0);
+    appendPalette(chunk, palette);
+    if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) failed = true;
+    return !failed;
+}
+
+bool ApngWriter::addFrame(const uint8_t* shades) {
+    if (!file) return false;
+    // The first four bytes hold the fdAT sequence number.
+    packImage(shades, image, 4);
+    return writeFrame();
+}
+
+bool ApngWriter::repeatFrame() {
+    if (!file) return false;
+    // Nothing shown yet, so nothing to hold.
+    return frames == 0 || writeFrame();
+}
+
+bool ApngWriter::writeFrame() {
+    uint8_t fctl[26] = {};
+    put32(fctl, sequence++);
+    put32(fctl + 4, SCREEN_WIDTH);
+    put32(fctl + 8, SCREEN_HEIGHT);
+    put16(fctl + 20, DELAY_NUM);
+    put16(fctl + 22, DELAY_DEN);
+    chunk.clear();
+    appendChunk(chunk, "fcTL", fctl, sizeof(fctl));
+    if (frames == 0) {
+        appendChunk(chunk, "IDAT", image.data() + 4, image.size() - 4);
+    } else {
+        put32(image.data(), sequence++);
+        appendChunk(chunk, "fdAT", image.data(), image.size());
+    }
+    if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) failed = true;
+    ++frames;
+    return !failed;
+}
+
+bool ApngWriter::close() {
+    if (!file) return true;
+    if (frames == 0) {
+        std::fclose(file);
+        file = nullptr;
+        std::remove(path.c_str());
+        return !failed;
+    }
+    chunk.clear();
+    appendChunk(chunk, "IEND", nullptr, 0);
+    if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) failed = true;
+
+    // Rewrite acTL now that the frame count is known.
+    chunk.clear();
+    appendHeader(chunk, true, frames);
+    if (std::fseek(file, ACTL_OFFSET, SEEK_SET) != 0 ||
+        std::fwrite(chunk.data() + ACTL_OFFSET, 1, chunk.size() - ACTL_OFFSET, file) !=
+            chunk.size() - ACTL_OFFSET) {
+        failed = true;
+    }
+    if (std::fclose(file) != 0) failed = true;
+    file = nullptr;
+    return !failed;
+}
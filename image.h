@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes a SCREEN_WIDTH x SCREEN_HEIGHT ARGB frame as a binary PPM.
+bool writePPM(const std::string& path, const uint32_t* argb);
+
+// Writes SCREEN_WIDTH x SCREEN_HEIGHT shade indices (0-3) as a 2-bit
+// indexed PNG, with `palette` (ARGB per shade) as its colour table.
+bool writePNG(const std::string& path, const uint8_t* shades, const uint32_t palette[4]);
+
+// Animated PNG of shade-index frames at the Game Boy's frame rate, in one
+// palette for the whole file. Pixel data is stored rather than deflated:
+// about 6 KB a frame, and adding one costs little more than the copy.
+class ApngWriter {
+public:
+    ApngWriter() = default;
+    ~ApngWriter();
+    ApngWriter(const ApngWriter&) = delete;
+    ApngWriter& operator=(const ApngWriter&) = delete;
+
+    bool open(const std::string& path, const uint32_t palette[4]);
+    bool addFrame(const uint8_t* shades);
+    // Shows the last frame for one more frame time, standing in for a frame
+    // that never arrived.
+    bool repeatFrame();
+    // Fills in the frame count and ends the file. A file without frames is
+    // not a valid APNG, so it is removed instead.
+    bool close();
+
+    bool isOpen() const { return file != nullptr; }
+    uint32_t frameCount() const { return frames; }
+
+private:
+    std::FILE* file = nullptr;
+    std::string path;
+    uint32_t frames = 0;
+    uint32_t sequence = 0;       // fcTL/fdAT sequence number
+    bool     failed = false;
+    std::vector<uint8_t> image;  // zlib stream of the last frame
+    std::vector<uint8_t> chunk;  // reused chunk buffer
+
+    bool writeFrame();
+    bool writeChunk(const char type[4], const uint8_t* data, size_t size);
+};
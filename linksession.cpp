@@ -0,0 +1,281 @@
+#include "linksession.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// "GBLK", version, count, first frame (LE), then count (data, flags) pairs.
+constexpr uint8_t PACKET_MAGIC[4] = { 'G', 'B', 'L', 'K' };
+constexpr uint8_t PACKET_VERSION = 1;
+constexpr size_t  PACKET_HEADER = 10;
+constexpr uint8_t FLAG_STARTED = 0x01;
+
+#ifdef _WIN32
+using NativeSocket = SOCKET;
+#else
+using NativeSocket = int;
+#endif
+
+NativeSocket native(intptr_t s) { return static_cast<NativeSocket>(s); }
+
+void closeSocket(intptr_t s) {
+#ifdef _WIN32
+    closesocket(native(s));
+#else
+    ::close(native(s));
+#endif
+}
+}
+
+LinkSession::LinkSession(Core& c) : core(c), slots(HISTORY) {}
+
+LinkSession::~LinkSession() {
+    close();
+}
+
+bool LinkSession::open(const Options& options, std::string& error) {
+    close();
+    // A rollback must never reach past the history, and a peer waiting on
+    // frames we have not confirmed must still find them in the packet.
+    if (options.delay < 0 || options.maxPrediction < 1 ||
+        options.maxPrediction + 2 * options.delay + 2 > int(SEND_WINDOW)) {
+        error = "link delay plus prediction window too large";
+        return false;
+    }
+    opts = options;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        error = "WSAStartup failed";
+        return false;
+    }
+#endif
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* peer = nullptr;
+    std::string port = std::to_string(opts.peerPort);
+    if (getaddrinfo(opts.peerHost.c_str(), port.c_str(), &hints, &peer) != 0 || !peer) {
+        error = "cannot resolve " + opts.peerHost;
+        return false;
+    }
+    peerAddr.assign(reinterpret_cast<const uint8_t*>(peer->ai_addr),
+                    reinterpret_cast<const uint8_t*>(peer->ai_addr) + peer->ai_addrlen);
+    freeaddrinfo(peer);
+
+#ifdef _WIN32
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        error = "cannot create socket";
+        return false;
+    }
+    u_long nonBlocking = 1;
+    ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+        error = "cannot create socket";
+        return false;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(opts.localPort);
+    if (bind(s, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+        closeSocket(static_cast<intptr_t>(s));
+        error = "cannot bind UDP port " + std::to_string(opts.localPort);
+        return false;
+    }
+    sock = static_cast<intptr_t>(s);
+
+    size_t capacity = core.maxStateSize();
+    for (Slot& sl : slots) {
+        sl = Slot();
+        sl.state.resize(capacity);
+    }
+    current = 0;
+    remoteCount = 0;
+    rollbackFrom = NONE;
+    desynced = false;
+    stats = Stats();
+    core.getMemory().setLinkCable(true);
+    return true;
+}
+
+void LinkSession::close() {
+    if (sock < 0) return;
+    closeSocket(sock);
+    sock = -1;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    core.getMemory().setLinkCable(false);
+}
+
+LinkSession::LinkFrame LinkSession::predict(uint32_t) {
+    // Games tend to send the same byte until something happens; a
+    // transfer out of nowhere is the rare case.
+    LinkFrame f;
+    if (remoteCount > 0) f.data = slot(remoteCount - 1).remote.data;
+    return f;
+}
+
+void LinkSession::runFrame(uint32_t f, bool render, Core::Frame* out) {
+    Slot& s = slot(f);
+    s.stateSize = core.serialize(s.state, false);
+    s.serialLength = core.getMemory().getSerialOutput().size();
+
+    uint32_t lag = uint32_t(opts.delay) + 1;
+    if (f >= lag) {
+        Slot& k = slot(f - lag);
+        LinkFrame peer = remoteKnown(f - lag) ? k.remote : predict(f - lag);
+        k.used = peer;
+        if (k.local.started || peer.started) core.getMemory().linkExchange(peer.data);
+    }
+
+    Core::Frame frame = core.runFrame(render);
+    if (out) *out = frame;
+    Memory& mem = core.getMemory();
+    s.local.started = mem.takeLinkStart();
+    s.local.data = mem.linkData();
+}
+
+void LinkSession::catchUp(bool renderLast) {
+    receive();
+    if (rollbackFrom == NONE) return;
+    uint32_t from = rollbackFrom;
+    rollbackFrom = NONE;
+    Slot& s = slot(from);
+    if (!s.stateSize || !core.deserialize(s.state.data(), s.stateSize)) {
+        desynced = true;
+        return;
+    }
+    core.getMemory().truncateSerialOutput(s.serialLength);
+    int depth = int(current - from);
+    ++stats.rollbacks;
+    stats.resimulatedFrames += uint64_t(depth);
+    stats.maxRollback = std::max(stats.maxRollback, depth);
+    for (uint32_t f = from; f < current; ++f) runFrame(f, renderLast && f + 1 == current, nullptr);
+}
+
+bool LinkSession::advance(bool render, Core::Frame* out) {
+    if (sock < 0) return false;
+    catchUp(false);
+
+    // Frame `current` exchanges with peer frame current - delay - 1.
+    uint32_t lag = uint32_t(opts.delay) + 1;
+    if (current >= lag && current - lag >= remoteCount + uint32_t(opts.maxPrediction)) {
+        ++stats.stalls;
+        send();  // ours may be what the peer is missing
+        return false;
+    }
+
+    runFrame(current, render, out);
+    ++current;
+    send();
+    return true;
+}
+
+bool LinkSession::settle() {
+    if (sock < 0) return false;
+    catchUp(true);
+    send();
+    uint32_t lag = uint32_t(opts.delay) + 1;
+    return current <= remoteCount + lag;
+}
+
+void LinkSession::waitForPeer(int ms) {
+    if (sock < 0) return;
+#ifdef _WIN32
+    WSAPOLLFD p{};
+    p.fd = native(sock);
+    p.events = POLLRDNORM;
+    WSAPoll(&p, 1, ms);
+#else
+    pollfd p{};
+    p.fd = native(sock);
+    p.events = POLLIN;
+    poll(&p, 1, ms);
+#endif
+}
+
+void LinkSession::send() {
+    // Frame f is confirmed once every exchange up to it used real peer data,
+    // i.e. f - delay - 1 < remoteCount.
+    uint32_t confirmed = std::min(current, remoteCount + uint32_t(opts.delay) + 1);
+    uint32_t first = confirmed > SEND_WINDOW ? confirmed - SEND_WINDOW : 0;
+    if (confirmed == first) return;
+
+    uint8_t packet[PACKET_HEADER + 2 * SEND_WINDOW];
+    std::memcpy(packet, PACKET_MAGIC, 4);
+    packet[4] = PACKET_VERSION;
+    packet[5] = uint8_t(confirmed - first);
+    for (int i = 0; i < 4; ++i) packet[6 + i] = uint8_t(first >> (8 * i));
+    size_t n = PACKET_HEADER;
+    for (uint32_t f = first; f < confirmed; ++f) {
+        const LinkFrame& l = slot(f).local;
+        packet[n++] = l.data;
+        packet[n++] = l.started ? FLAG_STARTED : 0;
+    }
+    auto sent = sendto(native(sock),
+                       reinterpret_cast<const char*>(packet), static_cast<int>(n), 0,
+                       reinterpret_cast<const sockaddr*>(peerAddr.data()),
+                       static_cast<socklen_t>(peerAddr.size()));
+    if (sent == static_cast<decltype(sent)>(n)) ++stats.packetsSent;
+}
+
+void LinkSession::receive() {
+    uint8_t packet[512];
+    uint32_t lag = uint32_t(opts.delay) + 1;
+    for (;;) {
+        auto got = recvfrom(native(sock),
+                            reinterpret_cast<char*>(packet), sizeof(packet), 0, nullptr, nullptr);
+        if (got < 0) return;
+        size_t n = static_cast<size_t>(got);
+        if (n < PACKET_HEADER || std::memcmp(packet, PACKET_MAGIC, 4) != 0 ||
+            packet[4] != PACKET_VERSION || n != PACKET_HEADER + 2 * size_t(packet[5])) {
+            continue;
+        }
+        ++stats.packetsReceived;
+
+        uint32_t first = 0;
+        for (int i = 0; i < 4; ++i) first |= uint32_t(packet[6 + i]) << (8 * i);
+        for (uint32_t i = 0; i < packet[5]; ++i) {
+            uint32_t f = first + i;
+            // Sent frames are confirmed, so a frame already known never changes.
+            if (f < remoteCount || f >= remoteCount + HISTORY || remoteKnown(f)) continue;
+            Slot& s = slot(f);
+            s.remoteFrame = f;
+            s.remote.data = packet[PACKET_HEADER + 2 * i];
+            s.remote.started = (packet[PACKET_HEADER + 2 * i + 1] & FLAG_STARTED) != 0;
+
+            // Was this frame's exchange already run on a guess?
+            uint32_t exchangedAt = f + lag;
+            if (exchangedAt >= current) continue;
+            bool guessed  = s.local.started || s.used.started;
+            bool actual   = s.local.started || s.remote.started;
+            if (guessed != actual || (actual && s.used.data != s.remote.data)) {
+                if (current - exchangedAt > HISTORY) desynced = true;
+                else rollbackFrom = std::min(rollbackFrom, exchangedAt);
+            }
+        }
+        while (remoteKnown(remoteCount)) ++remoteCount;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A link cable between two instances over UDP, with rollback.
+//
+// Each instance only emulates its own Game Boy; all it needs from the other
+// is the cable. Once per frame each side publishes a LinkFrame: its SB and
+// whether it started a transfer. An exchange `delay` + 1 frames later uses
+// both sides' LinkFrame for frame k: if either side started a transfer,
+// each SB receives the other's, so both instances compute the same result.
+// That caps the cable at one byte per frame each way, with delay + 1
+// frames of latency.
+//
+// The peer's LinkFrames arrive over the network. Until one does, the
+// session predicts it (the previous SB, no transfer) and runs on. When a
+// frame arrives that would have exchanged differently, the session
+// restores the in-memory state from before that exchange and re-runs the
+// frames since without drawing. A LinkFrame depends on the emulated state,
+// so only frames computed without any prediction are sent; what the peer
+// receives is final. The session stalls rather than predict more than
+// `maxPrediction` exchanges ahead of the peer.
+class LinkSession {
+public:
+    struct Options {
+        uint16_t    localPort = 0;
+        std::string peerHost;
+        uint16_t    peerPort = 0;
+        int delay = 2;
+        int maxPrediction = 8;
+    };
+
+    struct Stats {
+        uint64_t rollbacks = 0;
+        uint64_t resimulatedFrames = 0;
+        uint64_t stalls = 0;
+        int      maxRollback = 0;     // deepest rollback, in frames
+        uint64_t packetsSent = 0;
+        uint64_t packetsReceived = 0;
+    };
+
+    // The peer's half of the cable for one frame.
+    struct LinkFrame {
+        uint8_t data = 0xFF;
+        bool    started = false;
+    };
+
+    explicit LinkSession(Core& core);
+    ~LinkSession();
+    LinkSession(const LinkSession&) = delete;
+    LinkSession& operator=(const LinkSession&) = delete;
+
+    // Bind the local port, resolve the peer and attach the cable; false
+    // with `error` set if the options are out of range. Both
+    // sides must start from the same frame: call right after loading the
+    // ROM (or restoring the same state on both ends).
+    bool open(const Options& options, std::string& error);
+    void close();
+    bool isOpen() const { return sock >= 0; }
+
+    // Run the next frame, first re-running any frames a late peer update
+    // invalidated. Returns false without running anything if the session is
+    // too far ahead of the peer; call again (after waitForPeer) later.
+    bool advance(bool render, Core::Frame* out = nullptr);
+    // Take in peer updates and redo mispredicted frames without running a
+    // new one; true once every frame so far used the peer's real data. Keep
+    // calling it for a while after the last advance() so the peer can
+    // settle too.
+    bool settle();
+    // Block for up to `ms` until something arrives from the peer.
+    void waitForPeer(int ms);
+
+    uint32_t frame() const { return current; }
+    // A correction arrived for a frame older than the rollback history; the
+    // two instances no longer agree.
+    bool isDesynced() const { return desynced; }
+    const Stats& getStats() const { return stats; }
+
+private:
+    // Frames of state and link history kept; rollbacks reach this far.
+    static constexpr uint32_t HISTORY = 64;
+    // Each packet repeats this many of our latest final LinkFrames, so lost
+    // or reordered packets need no acknowledgements.
+    static constexpr uint32_t SEND_WINDOW = 32;
+    static constexpr uint32_t NONE = ~uint32_t(0);
+
+    struct Slot {
+        std::vector<uint8_t> state;  // core state at the start of the frame
+        size_t    stateSize = 0;
+        size_t    serialLength = 0;  // Memory's serial log length at that point
+        LinkFrame local;             // our LinkFrame for the frame
+        LinkFrame remote;            // the peer's, once known
+        uint32_t  remoteFrame = NONE;
+        LinkFrame used;              // what the exchange using this frame assumed
+    };
+
+    Core& core;
+    Options opts;
+    intptr_t sock = -1;          // a SOCKET on Windows
+    std::vector<uint8_t> peerAddr; // sockaddr storage
+    std::vector<Slot> slots;
+
+    uint32_t current = 0;        // next frame to run
+    uint32_t remoteCount = 0;    // peer frames 0..remoteCount-1 all received
+    uint32_t rollbackFrom = NONE;
+    bool     desynced = false;
+    Stats    stats;
+
+    Slot& slot(uint32_t frame) { return slots[frame % HISTORY]; }
+    bool  remoteKnown(uint32_t frame) { return slot(frame).remoteFrame == frame; }
+    LinkFrame predict(uint32_t frame);
+    void runFrame(uint32_t frame, bool render, Core::Frame* out);
+    void catchUp(bool renderLast);
+    void receive();
+    void send();
+};
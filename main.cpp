@@ -1,16 +1,46 @@
 #include "gameboy.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 int main(int argc, char* argv[]) {
     GameBoy gb;
+    const char* romPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--pace") == 0 && i + 1 < argc) {
+            PaceMode mode;
+            if (!parsePaceMode(argv[++i], mode)) {
+                std::cerr << "Unknown pacing mode: " << argv[i]
+                          << " (expected audio, vsync or spin)\n";
+                return 1;
+            }
+            gb.setPaceMode(mode);
+        } else if (std::strcmp(argv[i], "--frame-stats") == 0 && i + 1 < argc) {
+            gb.setFrameStatsPath(argv[++i]);
+        } else if (std::strcmp(argv[i], "--idle-skip") == 0) {
+            gb.setIdleLoopSkip(true);
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            gb.setProfilePath(argv[++i]);
+        } else if (std::strcmp(argv[i], "--turbo") == 0 && i + 1 < argc) {
+            int frames = std::atoi(argv[++i]);
+            if (frames < 1) {
+                std::cerr << "--turbo needs a frame count of at least 1\n";
+                return 1;
+            }
+            gb.setTurbo(frames);
+        } else {
+            romPath = argv[i];
+        }
+    }
+
     if (!gb.init()) {
         std::cerr << "Failed to initialize emulator\n";
         return 1;
     }
 
-    if (argc >= 2) {
-        if (!gb.loadROM(argv[1])) {
-            std::cerr << "Failed to load ROM: " << argv[1]
+    if (romPath) {
+        if (!gb.loadROM(romPath)) {
+            std::cerr << "Failed to load ROM: " << romPath
                       << " — opening menu.\n";
         }
     }
@@ -24,13 +54,18 @@ int main(int argc, char* argv[]) {
         "Hotkeys (RetroArch style):\n"
         "  F1          Menu / Pause overlay\n"
         "  F2          Save state (current slot)\n"
+        "  F3          Profiler overlay\n"
         "  F4          Load state (current slot)\n"
+        "  F5          Start / stop input movie recording\n"
         "  F6 / F7     Slot -1 / +1\n"
-        "  F8          Screenshot\n"
+        "  F8          Screenshot (PNG)\n"
         "  F9          Reset\n"
+        "  F10         Dump trace and coverage (TRACE=1 builds)\n"
         "  F11         Fullscreen toggle\n"
+        "  F12         Start / stop video capture (APNG + WAV)\n"
         "  P           Pause toggle\n"
         "  Space       Fast-forward (hold)\n"
+        "  R           Rewind (hold)\n"
         "  M           Mute toggle\n"
         "  Esc         Open menu\n";
 
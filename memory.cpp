@@ -2,42 +2,44 @@
 #include "cpu.h"
 #include "ppu.h"
 #include "apu.h"
+#include "scheduler.h"
+#include "romcache.h"
+#include "savewriter.h"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <utility>
 #include <ostream>
 #include <istream>
 
 Memory::Memory()
-    : vram(0x2000, 0),
-      wram(0x2000, 0),
-      oam(0xA0, 0),
-      io(0x80, 0),
-      hram(0x7F, 0) {
-    io[0x00] = 0xCF;
-    io[0x05] = 0x00;
-    io[0x06] = 0x00;
-    io[0x07] = 0x00;
-    io[0x0F] = 0xE1;
-    io[0x40] = 0x91;
-    io[0x41] = 0x85;
-    io[0x42] = 0x00;
-    io[0x43] = 0x00;
-    io[0x44] = 0x00;
-    io[0x45] = 0x00;
-    io[0x47] = 0xFC;
-    io[0x48] = 0xFF;
-    io[0x49] = 0xFF;
-    io[0x4A] = 0x00;
-    io[0x4B] = 0x00;
+    : extRam(std::make_shared<std::vector<uint8_t>>()) {
+    st.io[0x00] = 0xCF;
+    st.io[0x05] = 0x00;
+    st.io[0x06] = 0x00;
+    st.io[0x07] = 0x00;
+    st.io[0x0F] = 0xE1;
+    st.io[0x40] = 0x91;
+    st.io[0x41] = 0x85;
+    st.io[0x42] = 0x00;
+    st.io[0x43] = 0x00;
+    st.io[0x44] = 0x00;
+    st.io[0x45] = 0x00;
+    st.io[0x47] = 0xFC;
+    st.io[0x48] = 0xFF;
+    st.io[0x49] = 0xFF;
+    st.io[0x4A] = 0x00;
+    st.io[0x4B] = 0x00;
+    markAllVramDirty();
+    rebuildPageTables();
 }
 
 Memory::~Memory() {
-    saveSRAM();
+    flushSRAM();
 }
 
-static bool mbcTypeHasBattery(uint8_t t) {
+bool Memory::mbcHasBattery(uint8_t t) {
     switch (t) {
         case 0x03: case 0x06: case 0x09: case 0x0D:
         case 0x0F: case 0x10: case 0x13:
@@ -49,22 +51,19 @@ static bool mbcTypeHasBattery(uint8_t t) {
 }
 
 bool Memory::loadROM(const std::string& path) {
-    std::ifstream f(path, std::ios::binary | std::ios::ate);
-    if (!f) {
-        std::cerr << "Cannot open ROM: " << path << '\n';
+    std::string error;
+    std::shared_ptr<const RomFile> file = RomCache::open(path, error);
+    if (!file) {
+        std::cerr << error << '\n';
         return false;
     }
-    auto size = static_cast<size_t>(f.tellg());
-    f.seekg(0, std::ios::beg);
-    rom.assign(size, 0);
-    if (!f.read(reinterpret_cast<char*>(rom.data()), size)) {
-        std::cerr << "Failed to read ROM\n";
-        return false;
-    }
-    if (rom.size() < 0x150) {
+    if (file->size() < 0x150) {
         std::cerr << "ROM too small\n";
         return false;
     }
+    romFile = std::move(file);
+    rom = romFile->data();
+    romSize = romFile->size();
 
     mbcType = rom[0x0147];
     uint8_t ramCode = rom[0x0149];
@@ -77,62 +76,72 @@ bool Memory::loadROM(const std::string& path) {
         case 0x05: ramSize = 0x10000; break;
         default:   ramSize = 0x2000;  break;
     }
-    extRam.assign(ramSize, 0);
+    extRam = std::make_shared<std::vector<uint8_t>>(ramSize, 0);
 
     loadedPath = path;
-    hasBattery = mbcTypeHasBattery(mbcType);
-    if (hasBattery) {
+    hasBattery = mbcHasBattery(mbcType);
+    if (hasBattery && savePersistence) {
         size_t dot = path.find_last_of('.');
         savePath = (dot == std::string::npos) ? path + ".sav"
                                               : path.substr(0, dot) + ".sav";
+        SaveWriter::instance().flush(savePath); // another instance may still be writing it
         std::ifstream sf(savePath, std::ios::binary | std::ios::ate);
         if (sf) {
             auto sSize = static_cast<size_t>(sf.tellg());
             sf.seekg(0, std::ios::beg);
-            size_t toRead = std::min(sSize, extRam.size());
-            if (sf.read(reinterpret_cast<char*>(extRam.data()), toRead)) {
+            size_t toRead = std::min(sSize, extRam->size());
+            if (sf.read(reinterpret_cast<char*>(extRam->data()), toRead)) {
                 std::cout << "Loaded save: " << savePath << " (" << toRead << " bytes)\n";
             }
         }
     }
 
-    std::cout << "Loaded ROM: " << path << " (" << rom.size()
+    rebuildPageTables();
+    std::cout << "Loaded ROM: " << path << " (" << romSize
               << " bytes, MBC type " << static_cast<int>(mbcType) << ")\n";
     return true;
 }
 
 void Memory::unloadROM() {
-    saveSRAM();
-    rom.clear();
-    extRam.clear();
-    std::fill(vram.begin(), vram.end(), 0);
-    std::fill(wram.begin(), wram.end(), 0);
-    std::fill(oam.begin(), oam.end(), 0);
-    std::fill(hram.begin(), hram.end(), 0);
-    // io & ie are reset to power-on defaults by reinitializing the relevant ones
-    for (auto& b : io) b = 0;
-    io[0x00] = 0xCF;
-    io[0x0F] = 0xE1;
-    io[0x40] = 0x91;
-    io[0x41] = 0x85;
-    io[0x47] = 0xFC;
-    io[0x48] = 0xFF;
-    io[0x49] = 0xFF;
-    ie = 0;
-    mbcType = 0; romBank = 1; ramBank = 0;
-    ramEnabled = false; mbc1RamMode = false; rtcRegister = 0;
+    flushSRAM();
+    romFile.reset();
+    rom = nullptr;
+    romSize = 0;
+    extRam = std::make_shared<std::vector<uint8_t>>();
+    mbcType = 0;
     hasBattery = false; sramDirty = false;
     savePath.clear(); loadedPath.clear();
-    divCounter = 0; timerCounter = 0;
-    dmaActive = false; dmaCycles = 0; dmaSource = 0;
-    joypadButtons = 0x0F; joypadDpad = 0x0F;
+    reset();
+}
+
+void Memory::reset() {
+    // Cartridge RAM only survives a power cycle when it has a battery.
+    if (!hasBattery) std::fill_n(own(extRam), extRam->size(), 0);
+    // Everything else starts from zero apart from a few power-on values.
+    st = State();
+    oamDirty = true;
+    st.io[0x00] = 0xCF;
+    st.io[0x0F] = 0xE1;
+    st.io[0x40] = 0x91;
+    st.io[0x41] = 0x85;
+    st.io[0x47] = 0xFC;
+    st.io[0x48] = 0xFF;
+    st.io[0x49] = 0xFF;
+    serialOutput.clear();
+    linkStarted = false;
+    markAllVramDirty();
+    rebuildPageTables();
 }
 
 std::string Memory::romTitle() const {
-    if (rom.size() < 0x144) return "";
+    return headerTitle(rom, romSize);
+}
+
+std::string Memory::headerTitle(const uint8_t* data, size_t size) {
+    if (size < 0x144) return "";
     std::string t;
     for (int i = 0x134; i < 0x144; ++i) {
-        char c = static_cast<char>(rom[i]);
+        char c = static_cast<char>(data[i]);
         if (c == 0) break;
         if (c >= 32 && c < 127) t += c;
     }
@@ -143,29 +152,31 @@ void Memory::saveState(std::ostream& out) const {
     auto W = [&](const auto& x) {
         out.write(reinterpret_cast<const char*>(&x), sizeof(x));
     };
-    out.write(reinterpret_cast<const char*>(vram.data()),
-              static_cast<std::streamsize>(vram.size()));
-    out.write(reinterpret_cast<const char*>(wram.data()),
-              static_cast<std::streamsize>(wram.size()));
-    out.write(reinterpret_cast<const char*>(oam.data()),
-              static_cast<std::streamsize>(oam.size()));
-    out.write(reinterpret_cast<const char*>(io.data()),
-              static_cast<std::streamsize>(io.size()));
-    out.write(reinterpret_cast<const char*>(hram.data()),
-              static_cast<std::streamsize>(hram.size()));
-    W(ie);
-    W(mbcType); W(romBank); W(ramBank);
-    uint8_t flags = (ramEnabled ? 1 : 0) | (mbc1RamMode ? 2 : 0);
+    out.write(reinterpret_cast<const char*>(st.vram),
+              static_cast<std::streamsize>(sizeof(st.vram)));
+    out.write(reinterpret_cast<const char*>(st.wram),
+              static_cast<std::streamsize>(sizeof(st.wram)));
+    out.write(reinterpret_cast<const char*>(st.oam),
+              static_cast<std::streamsize>(sizeof(st.oam)));
+    out.write(reinterpret_cast<const char*>(st.io),
+              static_cast<std::streamsize>(sizeof(st.io)));
+    out.write(reinterpret_cast<const char*>(st.hram),
+              static_cast<std::streamsize>(sizeof(st.hram)));
+    W(st.ie);
+    W(mbcType); W(st.romBank); W(st.ramBank);
+    uint8_t flags = (st.ramEnabled ? 1 : 0) | (st.mbc1RamMode ? 2 : 0);
     W(flags);
-    W(rtcRegister);
-    W(divCounter); W(timerCounter);
-    uint8_t dma = dmaActive ? 1 : 0;
-    W(dma); W(dmaCycles); W(dmaSource);
-    W(joypadButtons); W(joypadDpad);
-    uint64_t sz = extRam.size();
+    W(st.rtcRegister);
+    W(st.divCounter); W(st.timerCounter);
+    uint8_t dma = st.dmaActive ? 1 : 0;
+    W(dma); W(st.dmaCycles); W(st.dmaSource);
+    W(st.joypadButtons); W(st.joypadDpad);
+    uint8_t serial = st.serialActive ? 1 : 0;
+    W(serial); W(st.serialCycles);
+    uint64_t sz = extRam->size();
     W(sz);
     if (sz) {
-        out.write(reinterpret_cast<const char*>(extRam.data()),
+        out.write(reinterpret_cast<const char*>(extRam->data()),
                   static_cast<std::streamsize>(sz));
     }
 }
@@ -175,63 +186,118 @@ bool Memory::loadState(std::istream& in) {
         return static_cast<bool>(
             in.read(reinterpret_cast<char*>(&x), sizeof(x)));
     };
-    if (!in.read(reinterpret_cast<char*>(vram.data()),
-                 static_cast<std::streamsize>(vram.size()))) return false;
-    if (!in.read(reinterpret_cast<char*>(wram.data()),
-                 static_cast<std::streamsize>(wram.size()))) return false;
-    if (!in.read(reinterpret_cast<char*>(oam.data()),
-                 static_cast<std::streamsize>(oam.size()))) return false;
-    if (!in.read(reinterpret_cast<char*>(io.data()),
-                 static_cast<std::streamsize>(io.size()))) return false;
-    if (!in.read(reinterpret_cast<char*>(hram.data()),
-                 static_cast<std::streamsize>(hram.size()))) return false;
-    if (!R(ie)) return false;
-    if (!R(mbcType) || !R(romBank) || !R(ramBank)) return false;
+    if (!in.read(reinterpret_cast<char*>(st.vram),
+                 static_cast<std::streamsize>(sizeof(st.vram)))) return false;
+    if (!in.read(reinterpret_cast<char*>(st.wram),
+                 static_cast<std::streamsize>(sizeof(st.wram)))) return false;
+    if (!in.read(reinterpret_cast<char*>(st.oam),
+                 static_cast<std::streamsize>(sizeof(st.oam)))) return false;
+    oamDirty = true;
+    if (!in.read(reinterpret_cast<char*>(st.io),
+                 static_cast<std::streamsize>(sizeof(st.io)))) return false;
+    if (!in.read(reinterpret_cast<char*>(st.hram),
+                 static_cast<std::streamsize>(sizeof(st.hram)))) return false;
+    if (!R(st.ie)) return false;
+    if (!R(mbcType) || !R(st.romBank) || !R(st.ramBank)) return false;
     uint8_t flags = 0;
     if (!R(flags)) return false;
-    ramEnabled  = (flags & 1) != 0;
-    mbc1RamMode = (flags & 2) != 0;
-    if (!R(rtcRegister)) return false;
-    if (!R(divCounter) || !R(timerCounter)) return false;
+    st.ramEnabled  = (flags & 1) != 0;
+    st.mbc1RamMode = (flags & 2) != 0;
+    if (!R(st.rtcRegister)) return false;
+    if (!R(st.divCounter) || !R(st.timerCounter)) return false;
     uint8_t dma = 0;
-    if (!R(dma) || !R(dmaCycles) || !R(dmaSource)) return false;
-    dmaActive = dma != 0;
-    if (!R(joypadButtons) || !R(joypadDpad)) return false;
+    if (!R(dma) || !R(st.dmaCycles) || !R(st.dmaSource)) return false;
+    st.dmaActive = dma != 0;
+    if (!R(st.joypadButtons) || !R(st.joypadDpad)) return false;
+    uint8_t serial = 0;
+    if (!R(serial) || !R(st.serialCycles)) return false;
+    st.serialActive = serial != 0 && !linkCable;
+    linkStarted = false;
     uint64_t sz = 0;
     if (!R(sz)) return false;
-    if (sz != extRam.size()) {
+    if (sz > 0x20000) return false;  // more than any cartridge has
+    if (sz != extRam->size()) {
         // Resize to match — should normally match ROM's RAM size.
-        extRam.assign(static_cast<size_t>(sz), 0);
+        extRam = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(sz), 0);
     }
     if (sz) {
-        if (!in.read(reinterpret_cast<char*>(extRam.data()),
+        if (!in.read(reinterpret_cast<char*>(own(extRam)),
                      static_cast<std::streamsize>(sz))) return false;
         if (hasBattery) sramDirty = true;
     }
+    markAllVramDirty();
+    rebuildPageTables();
     return true;
 }
 
-bool Memory::saveSRAM() const {
-    if (!hasBattery || savePath.empty() || extRam.empty()) return false;
-    if (!sramDirty) return false;
-    std::ofstream sf(savePath, std::ios::binary | std::ios::trunc);
-    if (!sf) {
-        std::cerr << "Cannot write save: " << savePath << '\n';
-        return false;
+void Memory::forkInto(Memory& child) {
+    child.st = st;
+    child.romFile = romFile;
+    child.rom = rom;
+    child.romSize = romSize;
+    child.mbcType = mbcType;
+    // Cartridge RAM is sized by the game, so it stays outside the state
+    // block and is shared until either side writes to it.
+    child.extRam = extRam;
+    extRam.owned = false;
+    child.extRam.owned = false;
+
+    child.savePath.clear();
+    child.loadedPath = loadedPath;
+    child.hasBattery = hasBattery;
+    child.savePersistence = false;
+    child.sramDirty = false;
+    child.serialOutput = serialOutput;
+    child.linkCable = false;
+    child.linkStarted = false;
+    child.statusPolled = false;
+
+    child.oamDirty = true;
+    child.markAllVramDirty();
+    child.rebuildPageTables();
+}
+
+uint8_t* Memory::own(SharedRam& ram) {
+    if (!ram.owned) {
+        ram.block = std::make_shared<std::vector<uint8_t>>(*ram.block);
+        ram.owned = true;
+        rebuildPageTables();
     }
-    sf.write(reinterpret_cast<const char*>(extRam.data()),
-             static_cast<std::streamsize>(extRam.size()));
-    if (!sf) {
-        std::cerr << "Failed writing save: " << savePath << '\n';
-        return false;
+    return ram.block->data();
+}
+
+void Memory::markAllVramDirty() {
+    for (auto& w : tileDirty) w = ~uint64_t(0);
+    anyTileDirty = true;
+    mapDirty = ~uint64_t(0);
+}
+
+bool Memory::takeDirtyTiles(uint64_t (&out)[TILE_DIRTY_WORDS]) {
+    if (!anyTileDirty) return false;
+    for (int i = 0; i < TILE_DIRTY_WORDS; ++i) {
+        out[i] = tileDirty[i];
+        tileDirty[i] = 0;
     }
+    anyTileDirty = false;
+    return true;
+}
+
+bool Memory::saveSRAM() const {
+    if (!hasBattery || savePath.empty() || extRam->empty()) return false;
+    if (!sramDirty) return false;
+    SaveWriter::instance().submit(savePath, *extRam);
     sramDirty = false;
-    std::cout << "Saved: " << savePath << " (" << extRam.size() << " bytes)\n";
     return true;
 }
 
+bool Memory::flushSRAM() const {
+    bool queued = saveSRAM();
+    if (!savePath.empty()) SaveWriter::instance().flush(savePath);
+    return queued;
+}
+
 int Memory::getTimerFrequency() const {
-    switch (io[0x07] & 0x03) {
+    switch (st.io[0x07] & 0x03) {
         case 0: return 1024;
         case 1: return 16;
         case 2: return 64;
@@ -241,188 +307,363 @@ int Memory::getTimerFrequency() const {
 }
 
 void Memory::updateTimer(int cycles) {
-    divCounter += cycles;
-    while (divCounter >= 256) {
-        divCounter -= 256;
-        io[0x04]++;
+    st.divCounter += cycles;
+    while (st.divCounter >= 256) {
+        st.divCounter -= 256;
+        st.io[0x04]++;
     }
-    if (io[0x07] & 0x04) {
-        timerCounter += cycles;
+    if (st.io[0x07] & 0x04) {
+        st.timerCounter += cycles;
         int freq = getTimerFrequency();
-        while (timerCounter >= freq) {
-            timerCounter -= freq;
-            if (io[0x05] == 0xFF) {
-                io[0x05] = io[0x06];
-                io[0x0F] |= INT_TIMER;
+        while (st.timerCounter >= freq) {
+            st.timerCounter -= freq;
+            if (st.io[0x05] == 0xFF) {
+                st.io[0x05] = st.io[0x06];
+                st.io[0x0F] |= INT_TIMER;
             } else {
-                io[0x05]++;
+                st.io[0x05]++;
             }
         }
     }
 }
 
+uint64_t Memory::accessTime() const {
+    // IO is accessed mid-instruction; subsystems catch up to the start of
+    // that instruction, which is where the old lockstep loop had them.
+    return scheduler ? scheduler->instrStart : 0;
+}
+
+void Memory::scheduleTimer() {
+    if (!scheduler) return;
+    if ((st.io[0x07] & 0x04) == 0) {
+        scheduler->cancel(Scheduler::Event::Timer);
+        return;
+    }
+    // Cycles until TIMA next wraps past 0xFF.
+    uint64_t freq = static_cast<uint64_t>(getTimerFrequency());
+    uint64_t left = (freq - static_cast<uint64_t>(st.timerCounter)) + (0xFF - st.io[0x05]) * freq;
+    scheduler->schedule(Scheduler::Event::Timer, timerSynced + left);
+}
+
+void Memory::syncTimer(uint64_t t) {
+    if (t > timerSynced) {
+        updateTimer(static_cast<int>(t - timerSynced));
+        timerSynced = t;
+    }
+    scheduleTimer();
+}
+
+void Memory::syncDMA(uint64_t t) {
+    if (t > dmaSynced) {
+        updateDMA(static_cast<int>(t - dmaSynced));
+        dmaSynced = t;
+    }
+    if (!scheduler) return;
+    if (st.dmaActive) {
+        scheduler->schedule(Scheduler::Event::Dma,
+                            dmaSynced + static_cast<uint64_t>(640 - st.dmaCycles));
+    } else {
+        scheduler->cancel(Scheduler::Event::Dma);
+    }
+}
+
+void Memory::syncSerial(uint64_t t) {
+    if (t > serialSynced) {
+        updateSerial(static_cast<int>(t - serialSynced));
+        serialSynced = t;
+    }
+    if (!scheduler) return;
+    if (st.serialActive) {
+        scheduler->schedule(Scheduler::Event::Serial,
+                            serialSynced + static_cast<uint64_t>(SERIAL_CYCLES - st.serialCycles));
+    } else {
+        scheduler->cancel(Scheduler::Event::Serial);
+    }
+}
+
+void Memory::resetSync(uint64_t t) {
+    timerSynced = t;
+    dmaSynced = t;
+    serialSynced = t;
+    scheduleTimer();
+    syncDMA(t);
+    syncSerial(t);
+}
+
 void Memory::updateDMA(int cycles) {
-    if (!dmaActive) return;
-    dmaCycles += cycles;
-    if (dmaCycles >= 640) {
+    if (!st.dmaActive) return;
+    st.dmaCycles += cycles;
+    if (st.dmaCycles >= 640) {
         for (int i = 0; i < 0xA0; ++i) {
-            oam[i] = read(static_cast<uint16_t>(dmaSource + i));
+            st.oam[i] = read(static_cast<uint16_t>(st.dmaSource + i));
         }
-        dmaActive = false;
-        dmaCycles = 0;
+        oamDirty = true;
+        st.dmaActive = false;
+        st.dmaCycles = 0;
+    }
+}
+
+void Memory::updateSerial(int cycles) {
+    if (!st.serialActive) return;
+    st.serialCycles += cycles;
+    if (st.serialCycles >= SERIAL_CYCLES) {
+        // Nothing on the other end of the cable: shift in all ones.
+        st.io[0x01] = 0xFF;
+        st.io[0x02] &= 0x7F;
+        st.io[0x0F] |= INT_SERIAL;
+        st.serialActive = false;
+        st.serialCycles = 0;
+    }
+}
+
+void Memory::setLinkCable(bool on) {
+    linkCable = on;
+    linkStarted = false;
+    if (on && st.serialActive) {
+        st.serialActive = false;
+        st.serialCycles = 0;
+        if (scheduler) syncSerial(serialSynced);
+    }
+}
+
+void Memory::linkExchange(uint8_t peerData) {
+    // The shift register is clocked whichever side drives it; only a side
+    // that asked for a transfer gets the interrupt.
+    st.io[0x01] = peerData;
+    if (st.io[0x02] & 0x80) {
+        st.io[0x02] &= 0x7F;
+        st.io[0x0F] |= INT_SERIAL;
     }
 }
 
 void Memory::setJoypadState(uint8_t buttons, uint8_t dpad) {
-    uint8_t oldButtons = joypadButtons;
-    uint8_t oldDpad    = joypadDpad;
-    joypadButtons = buttons & 0x0F;
-    joypadDpad    = dpad & 0x0F;
-    if (((oldButtons & ~joypadButtons) | (oldDpad & ~joypadDpad)) != 0) {
-        io[0x0F] |= INT_JOYPAD;
+    uint8_t oldButtons = st.joypadButtons;
+    uint8_t oldDpad    = st.joypadDpad;
+    st.joypadButtons = buttons & 0x0F;
+    st.joypadDpad    = dpad & 0x0F;
+    if (((oldButtons & ~st.joypadButtons) | (oldDpad & ~st.joypadDpad)) != 0) {
+        st.io[0x0F] |= INT_JOYPAD;
     }
 }
 
 uint8_t Memory::readJoypad() const {
-    uint8_t sel = io[0x00];
+    uint8_t sel = st.io[0x00];
     uint8_t lo = 0x0F;
-    if ((sel & 0x10) == 0) lo &= joypadDpad;
-    if ((sel & 0x20) == 0) lo &= joypadButtons;
+    if ((sel & 0x10) == 0) lo &= st.joypadDpad;
+    if ((sel & 0x20) == 0) lo &= st.joypadButtons;
     return (sel & 0xF0) | lo | 0xC0;
 }
 
 void Memory::handleMBCWrite(uint16_t addr, uint8_t val) {
     if (mbcType == 0x00) return;
+    const auto romBank = st.romBank;
+    const auto ramBank = st.ramBank;
+    const bool ramEnabled = st.ramEnabled;
+    const auto rtcRegister = st.rtcRegister;
 
     if (mbcType >= 0x01 && mbcType <= 0x03) {
         if (addr < 0x2000) {
             bool newEnabled = ((val & 0x0F) == 0x0A);
-            if (ramEnabled && !newEnabled && sramDirty) saveSRAM();
-            ramEnabled = newEnabled;
+            if (st.ramEnabled && !newEnabled && sramDirty) saveSRAM();
+            st.ramEnabled = newEnabled;
         } else if (addr < 0x4000) {
             int lo = val & 0x1F;
             if (lo == 0) lo = 1;
-            romBank = (romBank & 0x60) | lo;
+            st.romBank = (st.romBank & 0x60) | lo;
         } else if (addr < 0x6000) {
             int hi = val & 0x03;
-            if (mbc1RamMode) {
-                ramBank = hi;
+            if (st.mbc1RamMode) {
+                st.ramBank = hi;
             } else {
-                romBank = (romBank & 0x1F) | (hi << 5);
+                st.romBank = (st.romBank & 0x1F) | (hi << 5);
             }
         } else {
-            mbc1RamMode = (val & 0x01) != 0;
+            st.mbc1RamMode = (val & 0x01) != 0;
         }
-        return;
-    }
-
-    if (mbcType >= 0x0F && mbcType <= 0x13) {
+    } else if (mbcType >= 0x0F && mbcType <= 0x13) {
         if (addr < 0x2000) {
             bool newEnabled = ((val & 0x0F) == 0x0A);
-            if (ramEnabled && !newEnabled && sramDirty) saveSRAM();
-            ramEnabled = newEnabled;
+            if (st.ramEnabled && !newEnabled && sramDirty) saveSRAM();
+            st.ramEnabled = newEnabled;
         } else if (addr < 0x4000) {
             int b = val & 0x7F;
             if (b == 0) b = 1;
-            romBank = b;
+            st.romBank = b;
         } else if (addr < 0x6000) {
             if (val <= 0x03) {
-                ramBank = val;
-                rtcRegister = 0;
+                st.ramBank = val;
+                st.rtcRegister = 0;
             } else if (val >= 0x08 && val <= 0x0C) {
-                rtcRegister = val;
+                st.rtcRegister = val;
             }
         } else {
             // RTC latch — ignored (clock not modeled)
         }
+    } else {
         return;
     }
+    // Games reselect the current bank constantly (often in every interrupt
+    // handler), so only remap when the mapping actually changed.
+    if (st.romBank != romBank || st.ramBank != ramBank ||
+        st.ramEnabled != ramEnabled || st.rtcRegister != rtcRegister) {
+        rebuildPageTables();
+    }
 }
 
-uint8_t Memory::read(uint16_t addr) const {
+void Memory::rebuildPageTables() {
+    for (int p = 0; p < PAGE_COUNT; ++p) {
+        readPages[p] = nullptr;
+        writePages[p] = nullptr;
+    }
+    constexpr size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+
+    // ROM: map only pages that lie fully inside the image; anything past the
+    // end goes through readSlow(), which returns open-bus 0xFF.
+    for (int p = 0; p < 0x8000 >> PAGE_SHIFT; ++p) {
+        size_t off = (p < 0x4000 >> PAGE_SHIFT)
+            ? size_t(p) << PAGE_SHIFT
+            : static_cast<size_t>(st.romBank) * 0x4000 + ((size_t(p) << PAGE_SHIFT) - 0x4000);
+        if (off + PAGE_SIZE <= romSize) readPages[p] = rom + off;
+    }
+
+    // VRAM reads map directly; writes take the slow path so the tile dirty
+    // bitmap stays accurate.
+    for (int p = 0x8000 >> PAGE_SHIFT; p < 0xA000 >> PAGE_SHIFT; ++p) {
+        readPages[p] = st.vram + ((size_t(p) << PAGE_SHIFT) - 0x8000);
+    }
+
+    // External RAM reads map directly when enabled; writes stay on the slow
+    // path so sramDirty tracking keeps working.
+    bool rtcSelected = mbcType >= 0x0F && mbcType <= 0x13 && st.rtcRegister != 0;
+    if (st.ramEnabled && !rtcSelected) {
+        for (int p = 0xA000 >> PAGE_SHIFT; p < 0xC000 >> PAGE_SHIFT; ++p) {
+            size_t off = static_cast<size_t>(st.ramBank) * 0x2000 + ((size_t(p) << PAGE_SHIFT) - 0xA000);
+            if (off + PAGE_SIZE <= extRam->size()) readPages[p] = extRam->data() + off;
+        }
+    }
+
+    // WRAM and its echo at 0xE000. 0xF000-0xFFFF mixes echo, OAM, IO and
+    // HRAM and is always handled by the slow path.
+    for (int p = 0xC000 >> PAGE_SHIFT; p < 0xF000 >> PAGE_SHIFT; ++p) {
+        size_t off = ((size_t(p) << PAGE_SHIFT) - 0xC000) & 0x1FFF;
+        readPages[p] = st.wram + off;
+        writePages[p] = st.wram + off;
+    }
+}
+
+uint8_t Memory::peek(uint16_t addr) const {
     if (addr < 0x4000) {
-        return rom[addr];
+        if (addr < romSize) return rom[addr];
+        return 0xFF;
     }
     if (addr < 0x8000) {
-        size_t off = static_cast<size_t>(romBank) * 0x4000 + (addr - 0x4000);
-        if (off < rom.size()) return rom[off];
+        size_t off = static_cast<size_t>(st.romBank) * 0x4000 + (addr - 0x4000);
+        if (off < romSize) return rom[off];
         return 0xFF;
     }
     if (addr < 0xA000) {
-        return vram[addr - 0x8000];
+        return st.vram[addr - 0x8000];
     }
     if (addr < 0xC000) {
-        if (!ramEnabled || extRam.empty()) return 0xFF;
-        if (mbcType >= 0x0F && mbcType <= 0x13 && rtcRegister != 0) {
+        if (!st.ramEnabled || extRam->empty()) return 0xFF;
+        if (mbcType >= 0x0F && mbcType <= 0x13 && st.rtcRegister != 0) {
             return 0x00;
         }
-        size_t off = static_cast<size_t>(ramBank) * 0x2000 + (addr - 0xA000);
-        if (off < extRam.size()) return extRam[off];
+        size_t off = static_cast<size_t>(st.ramBank) * 0x2000 + (addr - 0xA000);
+        if (off < extRam->size()) return (*extRam)[off];
         return 0xFF;
     }
     if (addr < 0xE000) {
-        return wram[addr - 0xC000];
+        return st.wram[addr - 0xC000];
     }
     if (addr < 0xFE00) {
-        return wram[addr - 0xE000];
+        return st.wram[addr - 0xE000];
     }
     if (addr < 0xFEA0) {
-        return oam[addr - 0xFE00];
+        return st.oam[addr - 0xFE00];
     }
     if (addr < 0xFF00) {
         return 0xFF;
     }
     if (addr < 0xFF80) {
-        uint8_t reg = addr & 0x7F;
-        if (reg == 0x00) return readJoypad();
-        if (reg == 0x41) {
-            return ppu ? ppu->readSTAT() : io[0x41];
-        }
-        if (reg == 0x44) {
-            return ppu ? ppu->readLY() : io[0x44];
-        }
-        if (reg >= 0x10 && reg <= 0x3F) {
-            return apu ? apu->readRegister(reg) : 0xFF;
-        }
-        return io[reg];
+        // Registers as last stored, without catching up the timer, PPU or APU.
+        return addr == 0xFF00 ? readJoypad() : st.io[addr & 0x7F];
     }
     if (addr < 0xFFFF) {
-        return hram[addr - 0xFF80];
+        return st.hram[addr - 0xFF80];
     }
-    return ie;
+    return st.ie;
+}
+
+uint8_t Memory::readSlow(uint16_t addr) {
+    if (addr < 0xFF00 || addr >= 0xFF80) return peek(addr);
+    uint8_t reg = addr & 0x7F;
+    if (reg == 0x00) return readJoypad();
+    if (reg == 0x04 || reg == 0x05) {
+        if (scheduler) syncTimer(accessTime());
+        return st.io[reg];
+    }
+    if (reg == 0x01 || reg == 0x02) {
+        if (scheduler) syncSerial(accessTime());
+        return st.io[reg];
+    }
+    if (reg == 0x41) {
+        statusPolled = true;
+        if (!ppu) return st.io[0x41];
+        if (scheduler) ppu->sync(accessTime());
+        return ppu->readSTAT();
+    }
+    if (reg == 0x44) {
+        statusPolled = true;
+        if (!ppu) return st.io[0x44];
+        if (scheduler) ppu->sync(accessTime());
+        return ppu->readLY();
+    }
+    if (reg >= 0x10 && reg <= 0x3F) {
+        if (!apu) return 0xFF;
+        if (scheduler) apu->sync(accessTime());
+        return apu->readRegister(reg);
+    }
+    return st.io[reg];
 }
 
-void Memory::write(uint16_t addr, uint8_t val) {
+void Memory::writeSlow(uint16_t addr, uint8_t val) {
     if (addr < 0x8000) {
         handleMBCWrite(addr, val);
         return;
     }
     if (addr < 0xA000) {
-        vram[addr - 0x8000] = val;
+        uint16_t off = addr - 0x8000;
+        if (st.vram[off] == val) return;
+        if (off < 0x1800) {
+            int tile = off >> 4;
+            tileDirty[tile >> 6] |= uint64_t(1) << (tile & 63);
+            anyTileDirty = true;
+        } else {
+            mapDirty |= uint64_t(1) << ((off - 0x1800) >> 5);
+        }
+        st.vram[off] = val;
         return;
     }
     if (addr < 0xC000) {
-        if (!ramEnabled || extRam.empty()) return;
-        if (mbcType >= 0x0F && mbcType <= 0x13 && rtcRegister != 0) return;
-        size_t off = static_cast<size_t>(ramBank) * 0x2000 + (addr - 0xA000);
-        if (off < extRam.size()) {
-            if (extRam[off] != val) {
-                extRam[off] = val;
+        if (!st.ramEnabled || extRam->empty()) return;
+        if (mbcType >= 0x0F && mbcType <= 0x13 && st.rtcRegister != 0) return;
+        size_t off = static_cast<size_t>(st.ramBank) * 0x2000 + (addr - 0xA000);
+        if (off < extRam->size()) {
+            if ((*extRam)[off] != val) {
+                own(extRam)[off] = val;
                 if (hasBattery) sramDirty = true;
             }
         }
         return;
     }
-    if (addr < 0xE000) {
-        wram[addr - 0xC000] = val;
-        return;
-    }
     if (addr < 0xFE00) {
-        wram[addr - 0xE000] = val;
+        st.wram[(addr - 0xC000) & 0x1FFF] = val;
         return;
     }
     if (addr < 0xFEA0) {
-        oam[addr - 0xFE00] = val;
+        st.oam[addr - 0xFE00] = val;
+        oamDirty = true;
         return;
     }
     if (addr < 0xFF00) {
@@ -430,38 +671,67 @@ void Memory::write(uint16_t addr, uint8_t val) {
     }
     if (addr < 0xFF80) {
         uint8_t reg = addr & 0x7F;
+        // Bring the owning subsystem up to date before the write lands.
+        bool timerReg = reg >= 0x04 && reg <= 0x07;
+        bool ppuReg   = reg >= 0x40 && reg <= 0x4B && reg != 0x46;
+        if (scheduler) {
+            uint64_t t = accessTime();
+            if (timerReg) syncTimer(t);
+            else if (ppuReg && ppu) ppu->sync(t);
+            else if (reg == 0x46) syncDMA(t);
+            else if (reg == 0x01 || reg == 0x02) syncSerial(t);
+            else if (reg >= 0x10 && reg <= 0x3F && apu) apu->sync(t);
+        }
         switch (reg) {
             case 0x00:
-                io[0x00] = (io[0x00] & 0x0F) | (val & 0x30);
+                st.io[0x00] = (st.io[0x00] & 0x0F) | (val & 0x30);
                 return;
-            case 0x04:
-                io[0x04] = 0;
-                divCounter = 0;
+            case 0x02:
+                st.io[0x02] = val;
+                // Internal clock: 8 bits at 8192 Hz. An external-clock
+                // transfer never finishes without a partner.
+                if ((val & 0x81) == 0x81) {
+                    if (serialOutput.size() < SERIAL_LOG_LIMIT) {
+                        serialOutput.push_back(static_cast<char>(st.io[0x01]));
+                    }
+                    // On a cable the exchange comes from linkExchange().
+                    st.serialActive = !linkCable;
+                    st.serialCycles = 0;
+                    if (linkCable) linkStarted = true;
+                } else {
+                    st.serialActive = false;
+                }
+                if (scheduler) syncSerial(accessTime());
                 return;
+            case 0x04:
+                st.io[0x04] = 0;
+                st.divCounter = 0;
+                break;
             case 0x07:
-                if ((io[0x07] & 0x03) != (val & 0x03)) timerCounter = 0;
-                io[0x07] = val | 0xF8;
-                return;
+                if ((st.io[0x07] & 0x03) != (val & 0x03)) st.timerCounter = 0;
+                st.io[0x07] = val | 0xF8;
+                break;
             case 0x0F:
-                io[0x0F] = val | 0xE0;
+                st.io[0x0F] = val | 0xE0;
                 return;
             case 0x40:
                 if (ppu) ppu->writeLCDC(val);
-                io[0x40] = val;
-                return;
+                st.io[0x40] = val;
+                break;
             case 0x41:
                 if (ppu) ppu->writeSTAT(val);
-                io[0x41] = val;
-                return;
+                st.io[0x41] = val;
+                break;
             case 0x44:
                 if (ppu) ppu->writeLY(val);
-                io[0x44] = 0;
-                return;
+                st.io[0x44] = 0;
+                break;
             case 0x46: {
-                io[0x46] = val;
-                dmaActive = true;
-                dmaCycles = 0;
-                dmaSource = static_cast<uint16_t>(val) << 8;
+                st.io[0x46] = val;
+                st.dmaActive = true;
+                st.dmaCycles = 0;
+                st.dmaSource = static_cast<uint16_t>(val) << 8;
+                if (scheduler) syncDMA(accessTime());
                 return;
             }
             default:
@@ -469,13 +739,18 @@ void Memory::write(uint16_t addr, uint8_t val) {
                     if (apu) apu->writeRegister(reg, val);
                     return;
                 }
-                io[reg] = val;
-                return;
+                st.io[reg] = val;
+                break;
         }
+        if (scheduler) {
+            if (timerReg) scheduleTimer();
+            else if (ppuReg && ppu) ppu->reschedule();
+        }
+        return;
     }
     if (addr < 0xFFFF) {
-        hram[addr - 0xFF80] = val;
+        st.hram[addr - 0xFF80] = val;
         return;
     }
-    ie = val;
+    st.ie = val;
 }
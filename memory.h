@@ -1,13 +1,19 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 #include <iosfwd>
 
+#include "profile.h"
+
 class PPU;
 class CPU;
 class APU;
+class Scheduler;
+class RomFile;
 
 class Memory {
 public:
@@ -15,74 +21,212 @@ public:
     ~Memory();
 
     bool loadROM(const std::string& path);
+    // Queues battery RAM for the background SaveWriter if it changed;
+    // flushSRAM() also waits until it is on disk.
     bool saveSRAM() const;
+    bool flushSRAM() const;
     void unloadROM();
+    // Power-on reset of everything but the cartridge: the ROM stays mapped
+    // and battery-backed RAM keeps its contents, as on hardware.
+    void reset();
 
     std::string romTitle() const;
+    // Header fields, for callers that read a ROM header without loading it.
+    static std::string headerTitle(const uint8_t* data, size_t size);
+    static bool mbcHasBattery(uint8_t mbcType);
     const std::string& romPath() const { return loadedPath; }
-    bool hasROM() const { return !rom.empty(); }
+    bool hasROM() const { return rom != nullptr; }
+    // The raw image and the bank mapped at 0x4000, for the CPU's block cache.
+    const uint8_t* getRomData() const { return rom; }
+    size_t getRomSize() const { return romSize; }
+    int getRomBank() const { return st.romBank; }
 
     void saveState(std::ostream& out) const;
     bool loadState(std::istream& in);
 
-    uint8_t read(uint16_t addr) const;
-    void    write(uint16_t addr, uint8_t val);
+    // Make `child` a copy of this machine's memory: one copy of the state
+    // block, with the ROM image and cartridge RAM shared (the latter
+    // copy-on-write). The child keeps its own component links, never
+    // touches the .sav file and has no cable.
+    void forkInto(Memory& child);
+
+    // Fast path: one table lookup per access. Pages without a direct
+    // mapping (MBC registers, RTC, OAM/IO/HRAM) fall through to the
+    // handler-based slow path.
+    uint8_t read(uint16_t addr) {
+        GB_PROF(prof::counters.reads[prof::regionOf(addr)]++);
+        const uint8_t* page = readPages[addr >> PAGE_SHIFT];
+        if (page) return page[addr & PAGE_MASK];
+        return readSlow(addr);
+    }
+    // What read() would return, but with no side effects: I/O registers
+    // come back as last stored, with nothing caught up or marked as polled.
+    uint8_t peek(uint16_t addr) const;
+    void write(uint16_t addr, uint8_t val) {
+        GB_PROF(prof::counters.writes[prof::regionOf(addr)]++);
+        uint8_t* page = writePages[addr >> PAGE_SHIFT];
+        if (page) { page[addr & PAGE_MASK] = val; return; }
+        writeSlow(addr, val);
+    }
 
     void setPPU(PPU* p) { ppu = p; }
     void setCPU(CPU* c) { cpu = c; }
     void setAPU(APU* a) { apu = a; }
+    void setScheduler(Scheduler* s) { scheduler = s; }
 
     void setJoypadState(uint8_t buttons, uint8_t dpad);
 
+    // When off, battery RAM is neither read from nor written to the .sav
+    // next to the ROM, so many instances can run the same cartridge.
+    void setSavePersistence(bool on) { savePersistence = on; }
+
+    // Bytes the game has sent over the link port (SB at each transfer
+    // start), capped at SERIAL_LOG_LIMIT. Without a link cable every
+    // transfer reads back 0xFF.
+    static constexpr size_t SERIAL_LOG_LIMIT = 64 * 1024;
+    const std::string& getSerialOutput() const { return serialOutput; }
+    void clearSerialOutput() { serialOutput.clear(); }
+    // The log is not part of save states; rolling back trims it by hand.
+    void truncateSerialOutput(size_t length) {
+        if (length < serialOutput.size()) serialOutput.resize(length);
+    }
+
+    // With a cable attached, internal-clock transfers no longer complete on
+    // their own: whoever drives the cable (LinkSession) reads this side's
+    // state once per frame and later calls linkExchange() with the peer's
+    // SB, which swaps the byte in and raises the serial interrupt.
+    void setLinkCable(bool on);
+    bool hasLinkCable() const { return linkCable; }
+    // SB now, and whether a transfer was started since the last call.
+    uint8_t linkData() const { return st.io[0x01]; }
+    bool takeLinkStart() { bool s = linkStarted; linkStarted = false; return s; }
+    void linkExchange(uint8_t peerData);
+
     void updateTimer(int cycles);
     void updateDMA(int cycles);
+    void updateSerial(int cycles);
+
+    // Lazy catch-up of the timer, OAM DMA and serial port to cycle `t`; each
+    // reschedules its next event afterwards.
+    void syncTimer(uint64_t t);
+    void syncDMA(uint64_t t);
+    void syncSerial(uint64_t t);
+    void resetSync(uint64_t t);
+
+    // True once since the last call if the CPU has read LY or STAT; the core
+    // uses it to spot polling loops.
+    bool takeStatusPoll() { bool p = statusPolled; statusPolled = false; return p; }
+
+    uint8_t getIF() const { return st.io[0x0F]; }
+    void    setIF(uint8_t v) { st.io[0x0F] = v; }
+    uint8_t getIE() const { return st.ie; }
+
+    const uint8_t* getVRAM() const { return st.vram; }
+    const uint8_t* getWRAM() const { return st.wram; }
+
+    // One bit per 16-byte tile in 0x8000-0x97FF, set whenever its data is
+    // written. The PPU takes the set bits to refresh its decoded tiles.
+    static constexpr int TILE_COUNT       = 384;
+    static constexpr int TILE_DIRTY_WORDS = TILE_COUNT / 64;
+    bool takeDirtyTiles(uint64_t (&out)[TILE_DIRTY_WORDS]);
+    // One bit per 32-byte row of the two tile maps (0x9800-0x9FFF), for
+    // consumers that keep their own copy of VRAM.
+    uint64_t takeDirtyMapRows() { uint64_t rows = mapDirty; mapDirty = 0; return rows; }
+    const uint8_t* getOAM()  const { return st.oam; }
+    // Set by any change to OAM (CPU writes, DMA, reset, state loads). The
+    // PPU takes it to know when its per-line sprite bins are stale.
+    bool takeOamDirty() { bool d = oamDirty; oamDirty = false; return d; }
+    uint8_t readIO(uint8_t reg) const { return st.io[reg]; }
+    void    writeIO(uint8_t reg, uint8_t val) { st.io[reg] = val; }
 
-    uint8_t getIF() const { return io[0x0F]; }
-    void    setIF(uint8_t v) { io[0x0F] = v; }
-    uint8_t getIE() const { return ie; }
+private:
+    static constexpr int      PAGE_SHIFT = 12;            // 4 KiB pages
+    static constexpr int      PAGE_COUNT = 0x10000 >> PAGE_SHIFT;
+    static constexpr uint16_t PAGE_MASK  = (1u << PAGE_SHIFT) - 1;
 
-    const uint8_t* getVRAM() const { return vram.data(); }
-    const uint8_t* getOAM()  const { return oam.data(); }
-    uint8_t readIO(uint8_t reg) const { return io[reg]; }
-    void    writeIO(uint8_t reg, uint8_t val) { io[reg] = val; }
+    const uint8_t* readPages[PAGE_COUNT]{};
+    uint8_t*       writePages[PAGE_COUNT]{};
 
-private:
     PPU* ppu = nullptr;
     CPU* cpu = nullptr;
     APU* apu = nullptr;
-
-    std::vector<uint8_t> rom;
-    std::vector<uint8_t> extRam;
-    std::vector<uint8_t> vram;
-    std::vector<uint8_t> wram;
-    std::vector<uint8_t> oam;
-    std::vector<uint8_t> io;
-    std::vector<uint8_t> hram;
-    uint8_t ie = 0;
-
+    Scheduler* scheduler = nullptr;
+
+    // Everything the emulated program can change, in one fixed block, so
+    // forking or resetting it is a single assignment. IO and HRAM, touched
+    // on nearly every instruction, fill the first four cache lines; the
+    // bulk RAM comes last.
+    struct alignas(64) State {
+        uint8_t io[0x80]{};
+        uint8_t hram[0x7F]{};
+        uint8_t ie = 0;
+
+        int  romBank = 1;
+        int  ramBank = 0;
+        bool ramEnabled = false;
+        bool mbc1RamMode = false;
+        uint8_t rtcRegister = 0;
+        uint8_t joypadButtons = 0x0F;
+        uint8_t joypadDpad    = 0x0F;
+        int divCounter = 0;
+        int timerCounter = 0;
+        bool dmaActive = false;
+        int  dmaCycles = 0;
+        uint16_t dmaSource = 0;
+        bool serialActive = false;
+        int  serialCycles = 0;
+
+        uint8_t oam[0xA0]{};
+        uint8_t vram[0x2000]{};
+        uint8_t wram[0x2000]{};
+    };
+    State st;
+
+    std::shared_ptr<const RomFile> romFile;
+    const uint8_t* rom = nullptr; // romFile's bytes
+    size_t romSize = 0;
     uint8_t mbcType = 0;
-    int  romBank = 1;
-    int  ramBank = 0;
-    bool ramEnabled = false;
-    bool mbc1RamMode = false;
-    uint8_t rtcRegister = 0;
+    // Cartridge RAM, whose size depends on the game. Forks share it:
+    // forkInto() leaves neither side owning the block, and the first write
+    // through own() takes a private copy, so a shared block is only read.
+    struct SharedRam {
+        std::shared_ptr<std::vector<uint8_t>> block;
+        bool owned = true;
+        SharedRam(std::shared_ptr<std::vector<uint8_t>> b) : block(std::move(b)) {}
+        std::vector<uint8_t>* operator->() const { return block.get(); }
+        const std::vector<uint8_t>& operator*() const { return *block; }
+    };
+    SharedRam extRam;
+
+    uint64_t tileDirty[TILE_DIRTY_WORDS]{};
+    bool     anyTileDirty = false;
+    uint64_t mapDirty = ~uint64_t(0);
+    bool     oamDirty = true;
 
     std::string savePath;
     std::string loadedPath;
     bool hasBattery = false;
+    bool savePersistence = true;
     mutable bool sramDirty = false;
 
-    int divCounter = 0;
-    int timerCounter = 0;
-
-    bool dmaActive = false;
-    int  dmaCycles = 0;
-    uint16_t dmaSource = 0;
+    uint64_t timerSynced = 0;
+    uint64_t dmaSynced = 0;
+    static constexpr int SERIAL_CYCLES = 4096;
+    uint64_t serialSynced = 0;
+    std::string serialOutput;
+    bool linkCable = false;
+    bool linkStarted = false;
 
-    uint8_t joypadButtons = 0x0F;
-    uint8_t joypadDpad    = 0x0F;
+    bool statusPolled = false;
 
     uint8_t readJoypad() const;
+    uint8_t readSlow(uint16_t addr);
+    void    writeSlow(uint16_t addr, uint8_t val);
+    void    rebuildPageTables();
+    uint8_t* own(SharedRam& ram);
+    void    markAllVramDirty();
     void    handleMBCWrite(uint16_t addr, uint8_t val);
     int     getTimerFrequency() const;
+    void    scheduleTimer();
+    uint64_t accessTime() const;
 };
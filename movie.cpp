@@ -0,0 +1,158 @@
+#include "movie.h"
+#include "core.h"
+#include "hash.h"
+
+#include <fstream>
+
+namespace {
+constexpr uint32_t kMovieMagic   = 0x564D4247u; // 'GBMV'
+constexpr uint32_t kMovieVersion = 1;
+constexpr uint32_t kFlagHashes   = 0x01;
+constexpr size_t   kTitleSize    = 16;
+// A week at 60 fps; keeps a forged frame count from reserving gigabytes.
+constexpr uint32_t kMaxFrames    = 60u * 60 * 60 * 24 * 7;
+
+// Calls `emit(value, length)` for each run in `runs`; false if one is cut
+// short or the lengths add up to more than `frames`.
+template <typename Emit>
+bool decodeRuns(const std::vector<uint8_t>& runs, uint64_t frames, Emit emit) {
+    uint64_t total = 0;
+    for (size_t p = 0; p < runs.size();) {
+        uint8_t value = runs[p++];
+        size_t len = 0;
+        int shift = 0;
+        uint8_t b = 0x80;
+        while ((b & 0x80) && p < runs.size() && shift < 35) {
+            b = runs[p++];
+            len |= size_t(b & 0x7F) << shift;
+            shift += 7;
+        }
+        if ((b & 0x80) || len > frames - total) return false;
+        total += len;
+        emit(value, len);
+    }
+    return total == frames;
+}
+}
+
+uint64_t Movie::frameHash(const Core& core) {
+    uint64_t h = fnv1a(core.getMemory().getWRAM(), 0x2000);
+    return fnv1a(core.getPPU().getFramebuffer(), SCREEN_WIDTH * SCREEN_HEIGHT, h);
+}
+
+bool Movie::start(const Core& core, bool recordHashes) {
+    startState.clear();
+    size_t n = core.serialize(startState, true);
+    if (n == 0) {
+        startState.clear();
+        return false;
+    }
+    startState.resize(n);
+    inputs.clear();
+    hashes.clear();
+    romTitle = core.getMemory().romTitle();
+    withHashes = recordHashes;
+    return true;
+}
+
+void Movie::record(uint8_t buttons, uint8_t dpad, const Core& core) {
+    inputs.push_back(uint8_t((buttons & 0x0F) | ((dpad & 0x0F) << 4)));
+    if (withHashes) hashes.push_back(frameHash(core));
+}
+
+bool Movie::restoreStart(Core& core) const {
+    return !startState.empty() && core.deserialize(startState.data(), startState.size());
+}
+
+bool Movie::save(const std::string& path) const {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    auto W = [&](const auto& x) {
+        f.write(reinterpret_cast<const char*>(&x), sizeof(x));
+    };
+
+    // Inputs are run-length coded: held buttons repeat for many frames.
+    std::vector<uint8_t> runs;
+    for (size_t i = 0; i < inputs.size();) {
+        size_t j = i;
+        while (j < inputs.size() && inputs[j] == inputs[i]) ++j;
+        size_t len = j - i;
+        runs.push_back(inputs[i]);
+        while (len >= 0x80) {
+            runs.push_back(uint8_t(len | 0x80));
+            len >>= 7;
+        }
+        runs.push_back(uint8_t(len));
+        i = j;
+    }
+
+    char title[kTitleSize] = {};
+    romTitle.copy(title, kTitleSize);
+
+    W(kMovieMagic);
+    W(kMovieVersion);
+    W(withHashes ? kFlagHashes : uint32_t(0));
+    W(static_cast<uint32_t>(inputs.size()));
+    f.write(title, kTitleSize);
+    W(static_cast<uint32_t>(startState.size()));
+    f.write(reinterpret_cast<const char*>(startState.data()),
+            static_cast<std::streamsize>(startState.size()));
+    W(static_cast<uint32_t>(runs.size()));
+    f.write(reinterpret_cast<const char*>(runs.data()),
+            static_cast<std::streamsize>(runs.size()));
+    if (withHashes) {
+        f.write(reinterpret_cast<const char*>(hashes.data()),
+                static_cast<std::streamsize>(hashes.size() * sizeof(uint64_t)));
+    }
+    return static_cast<bool>(f);
+}
+
+bool Movie::load(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    auto R = [&](auto& x) {
+        return static_cast<bool>(
+            f.read(reinterpret_cast<char*>(&x), sizeof(x)));
+    };
+    // Every size read below is checked against what is left of the file
+    // before anything is allocated for it.
+    f.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(f.tellg());
+    f.seekg(0, std::ios::beg);
+    auto remaining = [&] { return fileSize - static_cast<uint64_t>(f.tellg()); };
+
+    uint32_t magic = 0, version = 0, flags = 0, frames = 0;
+    if (!R(magic) || !R(version) || !R(flags) || !R(frames)) return false;
+    if (magic != kMovieMagic || version != kMovieVersion) return false;
+    if (frames > kMaxFrames) return false;
+    char title[kTitleSize + 1] = {};
+    if (!f.read(title, kTitleSize)) return false;
+
+    uint32_t stateSize = 0;
+    if (!R(stateSize) || stateSize > remaining()) return false;
+    std::vector<uint8_t> state(stateSize);
+    if (!f.read(reinterpret_cast<char*>(state.data()), stateSize)) return false;
+
+    uint32_t runSize = 0;
+    if (!R(runSize) || runSize > remaining()) return false;
+    std::vector<uint8_t> runs(runSize);
+    if (!f.read(reinterpret_cast<char*>(runs.data()), runSize)) return false;
+
+    // Check the runs add up to `frames` before reserving that many.
+    if (!decodeRuns(runs, frames, [](uint8_t, size_t) {})) return false;
+    const bool hashed = (flags & kFlagHashes) != 0;
+    if (hashed && uint64_t(frames) * sizeof(uint64_t) > remaining()) return false;
+
+    inputs.clear();
+    inputs.reserve(frames);
+    decodeRuns(runs, frames, [&](uint8_t value, size_t len) { inputs.insert(inputs.end(), len, value); });
+
+    withHashes = hashed;
+    hashes.assign(withHashes ? frames : 0, 0);
+    if (withHashes &&
+        !f.read(reinterpret_cast<char*>(hashes.data()),
+                static_cast<std::streamsize>(hashes.size() * sizeof(uint64_t)))) return false;
+    startState.swap(state);
+    romTitle = title;
+    return true;
+}
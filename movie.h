@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Core;
+
+// Input movie: a start state plus the joypad state for every frame after
+// it, optionally with a per-frame hash of WRAM and the framebuffer so a
+// replay can report the exact frame where it stopped matching.
+class Movie {
+public:
+    // Starts a new recording from the core's current state.
+    bool start(const Core& core, bool recordHashes = true);
+    // Call after each runFrame() with the input that frame ran with.
+    void record(uint8_t buttons, uint8_t dpad, const Core& core);
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    // Loads the start state; frame 0's input is the next to apply.
+    bool restoreStart(Core& core) const;
+
+    size_t  frameCount() const       { return inputs.size(); }
+    uint8_t buttons(size_t i) const  { return inputs[i] & 0x0F; }
+    uint8_t dpad(size_t i) const     { return inputs[i] >> 4; }
+    bool    hasHashes() const        { return withHashes; }
+    uint64_t expectedHash(size_t i) const { return hashes[i]; }
+    const std::string& title() const { return romTitle; }
+
+    // Hash of WRAM and the framebuffer, as recorded per frame.
+    static uint64_t frameHash(const Core& core);
+
+private:
+    std::vector<uint8_t>  startState;
+    std::vector<uint8_t>  inputs; // buttons | dpad << 4, one per frame
+    std::vector<uint64_t> hashes;
+    std::string romTitle;
+    bool withHashes = false;
+};
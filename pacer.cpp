@@ -0,0 +1,127 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <ostream>
+#include <thread>
+
+bool parsePaceMode(const std::string& name, PaceMode& out) {
+    if (name == "audio") { out = PaceMode::Audio; return true; }
+    if (name == "vsync") { out = PaceMode::Vsync; return true; }
+    if (name == "spin")  { out = PaceMode::Spin;  return true; }
+    return false;
+}
+
+const char* paceModeName(PaceMode mode) {
+    switch (mode) {
+        case PaceMode::Audio: return "audio";
+        case PaceMode::Vsync: return "vsync";
+        case PaceMode::Spin:  return "spin";
+    }
+    return "?";
+}
+
+FrameStats::FrameStats(double target) : targetMs(target), buckets(BUCKETS, 0) {}
+
+void FrameStats::reset() {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    count = lateCount = 0;
+    totalMs = worstMs = 0.0;
+    haveLast = false;
+}
+
+void FrameStats::mark(bool counted) {
+    clock::time_point now = clock::now();
+    if (counted && haveLast) {
+        double ms = std::chrono::duration<double, std::milli>(now - last).count();
+        int b = std::min(static_cast<int>(ms / BUCKET_MS), BUCKETS - 1);
+        buckets[b]++;
+        count++;
+        totalMs += ms;
+        worstMs = std::max(worstMs, ms);
+        if (ms > targetMs * 1.5) lateCount++;
+    }
+    last = now;
+    haveLast = true;
+}
+
+double FrameStats::percentile(double p) const {
+    if (count == 0) return 0.0;
+    uint64_t want = static_cast<uint64_t>(std::ceil(p / 100.0 * double(count)));
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= want) return std::min((b + 1) * BUCKET_MS, worstMs);
+    }
+    return worstMs;
+}
+
+void FrameStats::print(std::ostream& out, const char* label) const {
+    out << "pacing=" << label << " frames=" << count
+        << " mean=" << meanMs() << "ms p50=" << percentile(50)
+        << "ms p99=" << percentile(99) << "ms p99.9=" << percentile(99.9)
+        << "ms max=" << worstMs << "ms late=" << lateCount << '\n';
+}
+
+bool FrameStats::writeCSV(const std::string& path) const {
+    std::ofstream f(path, std::ios::trunc);
+    if (!f) return false;
+    f << "bucket_ms,count\n";
+    for (int b = 0; b < BUCKETS; ++b) {
+        if (buckets[b]) f << b * BUCKET_MS << ',' << buckets[b] << '\n';
+    }
+    return static_cast<bool>(f);
+}
+
+bool SpinTimer::wait(double frameMs) {
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double, std::milli>(frameMs));
+    clock::time_point now = clock::now();
+    if (!armed) {
+        deadline = now + period;
+        armed = true;
+    }
+    if (now > deadline + period) {
+        // More than a frame behind (debugger, window drag...): start over
+        // rather than rushing frames out to catch up.
+        deadline = now + period;
+        return false;
+    }
+    const auto spin = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double, std::milli>(SPIN_MS));
+    // Sleep is only accurate to a millisecond or so; spin the remainder.
+    if (deadline - now > spin) std::this_thread::sleep_for(deadline - now - spin);
+    while (clock::now() < deadline) std::this_thread::yield();
+    deadline += period;
+    return true;
+}
+
+void RefreshCadence::setRates(double refreshHz, double frameHz) {
+    refreshMs = 1000.0 / refreshHz;
+    frameMs   = 1000.0 / frameHz;
+    accum = 0.0;
+    phase = 0;
+    // Lock to the display when it runs at (close to) a whole multiple of
+    // the frame rate; the audio resampler absorbs the small speed-up.
+    int every = std::max(1, static_cast<int>(std::lround(refreshHz / frameHz)));
+    double r = refreshHz / (every * frameHz);
+    if (std::fabs(r - 1.0) < 0.01) {
+        lockEvery = every;
+        ratio = r;
+    } else {
+        lockEvery = 0;
+        ratio = 1.0;
+    }
+}
+
+int RefreshCadence::framesThisRefresh() {
+    if (lockEvery) {
+        phase = (phase + 1) % lockEvery;
+        return phase == 0 ? 1 : 0;
+    }
+    accum += refreshMs;
+    int n = static_cast<int>(accum / frameMs);
+    accum -= n * frameMs;
+    return n;
+}
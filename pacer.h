@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// What the SDL frontend locks emulation speed to.
+//   Audio: block until the audio ring drains to its target fill, so the
+//          sound card's clock sets the pace (vsync off).
+//   Vsync: one present per display refresh; the core runs as many frames
+//          as the refresh rate calls for and audio is resampled to match.
+//   Spin:  absolute-deadline timer that sleeps most of the frame and spins
+//          the last stretch.
+enum class PaceMode { Audio, Vsync, Spin };
+
+bool        parsePaceMode(const std::string& name, PaceMode& out);
+const char* paceModeName(PaceMode mode);
+
+// Histogram of frame-to-frame intervals in BUCKET_MS buckets.
+class FrameStats {
+public:
+    static constexpr double BUCKET_MS = 0.1;
+    static constexpr int    BUCKETS   = 1000; // last bucket holds >= 99.9 ms
+
+    explicit FrameStats(double targetMs);
+
+    // Records the interval since the previous mark(). Pass counted = false
+    // for frames after a pause so the gap does not show up as a stall.
+    void mark(bool counted = true);
+    void reset();
+
+    uint64_t frames() const { return count; }
+    // Intervals longer than 1.5x the target: at least one frame was missed.
+    uint64_t late() const { return lateCount; }
+    double   percentile(double p) const;
+    double   maxMs() const { return worstMs; }
+    double   meanMs() const { return count ? totalMs / double(count) : 0.0; }
+
+    void print(std::ostream& out, const char* label) const;
+    bool writeCSV(const std::string& path) const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    double   targetMs;
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t lateCount = 0;
+    double   totalMs = 0.0;
+    double   worstMs = 0.0;
+    clock::time_point last{};
+    bool     haveLast = false;
+};
+
+// High-precision frame timer for PaceMode::Spin (and for idle screens in the
+// other modes). Deadlines are absolute, so oversleeping one frame is made up
+// on the next instead of accumulating as drift.
+class SpinTimer {
+public:
+    void reset() { armed = false; }
+    // Returns false if the deadline had already slipped by a whole frame
+    // (the schedule is then restarted from now).
+    bool wait(double frameMs);
+
+private:
+    using clock = std::chrono::steady_clock;
+    static constexpr double SPIN_MS = 1.5; // final stretch handled by spinning
+
+    clock::time_point deadline{};
+    bool armed = false;
+};
+
+// Vsync mode: how many emulated frames to run per display refresh.
+class RefreshCadence {
+public:
+    void setRates(double refreshHz, double frameHz);
+    int  framesThisRefresh();
+    // How much faster than real hardware emulation runs: above 1.0 when the
+    // display refresh is a near-multiple of the Game Boy rate (e.g. 60 Hz
+    // against 59.73) and frames are locked to it, 1.0 otherwise.
+    double speedRatio() const { return ratio; }
+
+private:
+    double refreshMs = 1000.0 / 60.0;
+    double frameMs   = 1000.0 / 60.0;
+    double ratio     = 1.0;
+    int    lockEvery = 1; // 0: accumulate, else one frame per N refreshes
+    int    phase     = 0;
+    double accum     = 0.0;
+};
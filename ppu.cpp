@@ -1,8 +1,11 @@
 #include "ppu.h"
 #include "memory.h"
 #include "cpu.h"
+#include "scheduler.h"
+#include "colorize.h"
+#include "renderworker.h"
+#include "profile.h"
 
-#include <algorithm>  // std::max
 #include <ostream>
 #include <istream>
 
@@ -18,6 +21,7 @@ struct PpuStateBlob {
 }
 
 void PPU::saveState(std::ostream& out) const {
+    if (worker) worker->finish();
     PpuStateBlob s{};
     s.lcdc = lcdc; s.stat = stat; s.ly = ly;
     s.scanlineCycles = scanlineCycles;
@@ -27,14 +31,31 @@ void PPU::saveState(std::ostream& out) const {
     s.prevStatLine = prevStatLine ? 1 : 0;
     out.write(reinterpret_cast<const char*>(&s), sizeof(s));
     out.write(reinterpret_cast<const char*>(framebuffer.data()),
-              framebuffer.size() * sizeof(uint32_t));
+              framebuffer.size());
 }
 
 void PPU::setPalette(const uint32_t shadesIn[4]) {
     for (int i = 0; i < 4; ++i) shades[i] = shadesIn[i];
 }
 
+const uint8_t* PPU::getFramebuffer() const {
+    if (worker) worker->finish();
+    return framebuffer.data();
+}
+
+void PPU::colorizeFramebuffer(uint32_t* out, int pitch) const {
+    if (worker) worker->finish();
+    if (pitch == SCREEN_WIDTH) {
+        colorize(framebuffer.data(), out, SCREEN_WIDTH * SCREEN_HEIGHT, shades);
+        return;
+    }
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        colorize(framebuffer.data() + y * SCREEN_WIDTH, out + y * pitch, SCREEN_WIDTH, shades);
+    }
+}
+
 bool PPU::loadState(std::istream& in) {
+    if (worker) worker->finish();
     PpuStateBlob s{};
     if (!in.read(reinterpret_cast<char*>(&s), sizeof(s))) return false;
     lcdc = s.lcdc; stat = s.stat; ly = s.ly;
@@ -44,13 +65,16 @@ bool PPU::loadState(std::istream& in) {
     windowLine = s.windowLine;
     prevStatLine = s.prevStatLine != 0;
     if (!in.read(reinterpret_cast<char*>(framebuffer.data()),
-                 framebuffer.size() * sizeof(uint32_t))) return false;
+                 framebuffer.size())) return false;
     return true;
 }
 
 PPU::PPU(Memory& mem) : memory(mem) { reset(); }
 
+PPU::~PPU() = default;
+
 void PPU::reset() {
+    if (worker) worker->finish();
     lcdc = memory.readIO(0x40);
     stat = memory.readIO(0x41);
     ly = 0;
@@ -59,7 +83,7 @@ void PPU::reset() {
     frameReady = false;
     windowLine = 0;
     prevStatLine = false;
-    framebuffer.fill(shades[0]);
+    framebuffer.fill(0);
 }
 
 void PPU::writeLCDC(uint8_t v) {
@@ -108,6 +132,17 @@ void PPU::updateStatLine() {
     prevStatLine = line;
 }
 
+namespace {
+constexpr int modeLength(int mode) {
+    switch (mode) {
+        case 2: return 80;
+        case 3: return 172;
+        case 0: return 204;
+        default: return 456;
+    }
+}
+}
+
 void PPU::step(int cycles) {
     lcdc = memory.readIO(0x40);
     if ((lcdc & 0x80) == 0) {
@@ -116,25 +151,22 @@ void PPU::step(int cycles) {
 
     scanlineCycles += cycles;
 
-    switch (mode) {
-        case 2:
-            if (scanlineCycles >= 80) {
-                scanlineCycles -= 80;
+    // Run every mode change that falls inside this step, so one large
+    // catch-up step ends in the same state as many small ones.
+    while (scanlineCycles >= modeLength(mode)) {
+        scanlineCycles -= modeLength(mode);
+        switch (mode) {
+            case 2:
                 setMode(3);
-                updateStatLine();
-            }
-            break;
-        case 3:
-            if (scanlineCycles >= 172) {
-                scanlineCycles -= 172;
-                renderScanline();
+                break;
+            case 3: {
+                GB_PROF_SCOPE(Scanline);
+                if (renderEnabled) renderScanline();
+                if (windowOnLine()) windowLine++;
                 setMode(0);
-                updateStatLine();
+                break;
             }
-            break;
-        case 0:
-            if (scanlineCycles >= 204) {
-                scanlineCycles -= 204;
+            case 0:
                 ly++;
                 memory.writeIO(0x44, ly);
                 if (ly == 144) {
@@ -145,12 +177,8 @@ void PPU::step(int cycles) {
                 } else {
                     setMode(2);
                 }
-                updateStatLine();
-            }
-            break;
-        case 1:
-            if (scanlineCycles >= 456) {
-                scanlineCycles -= 456;
+                break;
+            case 1:
                 ly++;
                 if (ly > 153) {
                     ly = 0;
@@ -159,161 +187,105 @@ void PPU::step(int cycles) {
                 } else {
                     memory.writeIO(0x44, ly);
                 }
-                updateStatLine();
-            }
-            break;
+                break;
+        }
+        updateStatLine();
     }
 }
 
-void PPU::renderScanline() {
-    std::array<uint8_t, SCREEN_WIDTH> bgIdx{};
-    bgIdx.fill(0);
-
-    if (lcdc & 0x01) {
-        renderBackground(bgIdx);
-        if (lcdc & 0x20) renderWindow(bgIdx);
-    } else {
-        uint32_t row = ly * SCREEN_WIDTH;
-        for (int x = 0; x < SCREEN_WIDTH; ++x) framebuffer[row + x] = shades[0];
+void PPU::sync(uint64_t t) {
+    if (t > synced) {
+        step(static_cast<int>(t - synced));
+        synced = t;
     }
-
-    if (lcdc & 0x02) renderSprites(bgIdx);
+    reschedule();
 }
 
-void PPU::renderBackground(std::array<uint8_t, SCREEN_WIDTH>& bgIdx) {
-    uint8_t scy = memory.readIO(0x42);
-    uint8_t scx = memory.readIO(0x43);
-    uint8_t bgp = memory.readIO(0x47);
-    const uint8_t* vram = memory.getVRAM();
-
-    uint16_t mapBase = (lcdc & 0x08) ? 0x1C00 : 0x1800;
-    bool unsignedIdx = (lcdc & 0x10) != 0;
-    uint16_t tileBase = unsignedIdx ? 0x0000 : 0x1000;
-
-    uint8_t y = uint8_t(ly + scy);
-    int tileRow = (y / 8) & 31;
-
-    uint32_t row = ly * SCREEN_WIDTH;
-    for (int x = 0; x < SCREEN_WIDTH; ++x) {
-        uint8_t px = uint8_t(x + scx);
-        int tileCol = (px / 8) & 31;
-        uint16_t mapAddr = mapBase + tileRow * 32 + tileCol;
-        uint8_t tileIdx = vram[mapAddr];
+void PPU::resetSync(uint64_t t) {
+    synced = t;
+    reschedule();
+}
 
-        uint16_t tileAddr;
-        if (unsignedIdx) {
-            tileAddr = tileBase + tileIdx * 16;
-        } else {
-            tileAddr = uint16_t(tileBase + int16_t(int8_t(tileIdx)) * 16);
-        }
-        int line = (y & 7) * 2;
-        uint8_t lo = vram[tileAddr + line];
-        uint8_t hi = vram[tileAddr + line + 1];
-        int bit = 7 - (px & 7);
-        uint8_t shade = uint8_t(((lo >> bit) & 1) | (((hi >> bit) & 1) << 1));
-        bgIdx[x] = shade;
-        uint8_t color = (bgp >> (shade * 2)) & 0x03;
-        framebuffer[row + x] = shades[color];
+void PPU::reschedule() {
+    if (!scheduler) return;
+    if ((memory.readIO(0x40) & 0x80) == 0) {
+        scheduler->cancel(Scheduler::Event::Ppu);
+        return;
     }
+    int left = modeLength(mode) - scanlineCycles;
+    if (left < 0) left = 0;
+    scheduler->schedule(Scheduler::Event::Ppu, synced + static_cast<uint64_t>(left));
 }
 
-void PPU::renderWindow(std::array<uint8_t, SCREEN_WIDTH>& bgIdx) {
-    uint8_t wy = memory.readIO(0x4A);
-    uint8_t wx = memory.readIO(0x4B);
-    if (ly < wy) return;
-    if (wx >= 167) return;
-    uint8_t bgp = memory.readIO(0x47);
-    const uint8_t* vram = memory.getVRAM();
-
-    uint16_t mapBase = (lcdc & 0x40) ? 0x1C00 : 0x1800;
-    bool unsignedIdx = (lcdc & 0x10) != 0;
-    uint16_t tileBase = unsignedIdx ? 0x0000 : 0x1000;
-
-    int wyLine = windowLine;
-    int tileRow = (wyLine / 8) & 31;
+// Whether the window covers part of the current line, which is also when
+// it advances its internal line counter.
+bool PPU::windowOnLine() const {
+    return (lcdc & 0x21) == 0x21 && ly >= memory.readIO(0x4A) && memory.readIO(0x4B) < 167;
+}
 
-    uint32_t row = ly * SCREEN_WIDTH;
-    int startX = int(wx) - 7;
+LineRegs PPU::latchLine() const {
+    LineRegs r;
+    r.ly = ly;
+    r.lcdc = lcdc;
+    r.scy = memory.readIO(0x42);
+    r.scx = memory.readIO(0x43);
+    r.wy = memory.readIO(0x4A);
+    r.wx = memory.readIO(0x4B);
+    r.bgp = memory.readIO(0x47);
+    r.obp0 = memory.readIO(0x48);
+    r.obp1 = memory.readIO(0x49);
+    r.windowLine = uint8_t(windowLine);
+    return r;
+}
 
-    bool drew = false;
-    for (int x = std::max(0, startX); x < SCREEN_WIDTH; ++x) {
-        int wxPos = x - startX;
-        if (wxPos < 0) continue;
-        int tileCol = (wxPos / 8) & 31;
-        uint16_t mapAddr = mapBase + tileRow * 32 + tileCol;
-        uint8_t tileIdx = vram[mapAddr];
-        uint16_t tileAddr;
-        if (unsignedIdx) tileAddr = tileBase + tileIdx * 16;
-        else             tileAddr = uint16_t(tileBase + int16_t(int8_t(tileIdx)) * 16);
-        int line = (wyLine & 7) * 2;
-        uint8_t lo = vram[tileAddr + line];
-        uint8_t hi = vram[tileAddr + line + 1];
-        int bit = 7 - (wxPos & 7);
-        uint8_t shade = uint8_t(((lo >> bit) & 1) | (((hi >> bit) & 1) << 1));
-        bgIdx[x] = shade;
-        uint8_t color = (bgp >> (shade * 2)) & 0x03;
-        framebuffer[row + x] = shades[color];
-        drew = true;
+void PPU::renderScanline() {
+    LineRegs r = latchLine();
+    if (worker) {
+        queueScanline(r);
+        return;
     }
-    if (drew) windowLine++;
+    uint64_t dirty[Memory::TILE_DIRTY_WORDS];
+    if (memory.takeDirtyTiles(dirty)) raster.refreshTiles(memory.getVRAM(), dirty);
+    if (memory.takeOamDirty()) raster.invalidateSprites();
+    raster.renderLine(r, memory.getVRAM(), memory.getOAM(), framebuffer.data() + ly * SCREEN_WIDTH);
 }
 
-void PPU::renderSprites(const std::array<uint8_t, SCREEN_WIDTH>& bgIdx) {
-    bool tall = (lcdc & 0x04) != 0;
-    int spriteH = tall ? 16 : 8;
-    const uint8_t* oam = memory.getOAM();
-    uint8_t obp0 = memory.readIO(0x48);
-    uint8_t obp1 = memory.readIO(0x49);
-
-    struct Spr { int x, oamIdx; uint8_t y, tile, attr; };
-    Spr visible[10];
-    int count = 0;
-    for (int i = 0; i < 40 && count < 10; ++i) {
-        uint8_t sy = oam[i * 4 + 0];
-        int top = int(sy) - 16;
-        if (int(ly) < top || int(ly) >= top + spriteH) continue;
-        visible[count++] = { int(oam[i * 4 + 1]) - 8, i, sy, oam[i * 4 + 2], oam[i * 4 + 3] };
-    }
-    // Manual insertion sort: draw lower-X last (highest priority); ties → lower OAM idx last
-    for (int i = 1; i < count; ++i) {
-        Spr key = visible[i];
-        int j = i - 1;
-        while (j >= 0 && (visible[j].x < key.x ||
-                          (visible[j].x == key.x && visible[j].oamIdx < key.oamIdx))) {
-            visible[j + 1] = visible[j];
-            --j;
+// Hand the worker what changed in video memory since the last queued line,
+// then the line itself.
+void PPU::queueScanline(const LineRegs& r) {
+    const uint8_t* vram = memory.getVRAM();
+    uint64_t dirty[Memory::TILE_DIRTY_WORDS];
+    if (memory.takeDirtyTiles(dirty)) {
+        for (int w = 0; w < Memory::TILE_DIRTY_WORDS; ++w) {
+            for (uint64_t bits = dirty[w]; bits; bits &= bits - 1) {
+                int tile = w * 64 + __builtin_ctzll(bits);
+                worker->write(uint16_t(tile * 16), vram + tile * 16, 16);
+            }
         }
-        visible[j + 1] = key;
     }
+    for (uint64_t rows = memory.takeDirtyMapRows(); rows; rows &= rows - 1) {
+        int off = 0x1800 + __builtin_ctzll(rows) * 32;
+        worker->write(uint16_t(off), vram + off, 32);
+    }
+    if (memory.takeOamDirty()) {
+        worker->write(RenderWorker::OAM_BASE, memory.getOAM(), RenderWorker::OAM_SIZE);
+    }
+    worker->addLine(r);
+}
 
-    const uint8_t* vram = memory.getVRAM();
-    uint32_t row = ly * SCREEN_WIDTH;
-
-    for (int s = 0; s < count; ++s) {
-        const Spr& sp = visible[s];
-        bool flipY = (sp.attr & 0x40) != 0;
-        bool flipX = (sp.attr & 0x20) != 0;
-        bool bgPrio = (sp.attr & 0x80) != 0;
-        uint8_t palette = (sp.attr & 0x10) ? obp1 : obp0;
-
-        int spriteY = int(ly) - (int(sp.y) - 16);
-        if (flipY) spriteY = spriteH - 1 - spriteY;
-
-        uint8_t tile = sp.tile;
-        if (tall) tile &= 0xFE;
-        uint16_t tileAddr = tile * 16 + spriteY * 2;
-        uint8_t lo = vram[tileAddr];
-        uint8_t hi = vram[tileAddr + 1];
-
-        for (int px = 0; px < 8; ++px) {
-            int sx = sp.x + px;
-            if (sx < 0 || sx >= SCREEN_WIDTH) continue;
-            int bit = flipX ? px : (7 - px);
-            uint8_t shade = uint8_t(((lo >> bit) & 1) | (((hi >> bit) & 1) << 1));
-            if (shade == 0) continue;
-            if (bgPrio && bgIdx[sx] != 0) continue;
-            uint8_t color = (palette >> (shade * 2)) & 0x03;
-            framebuffer[row + sx] = shades[color];
-        }
+void PPU::setThreadedRendering(bool on) {
+    if (on == (worker != nullptr)) return;
+    if (on) {
+        worker = std::make_unique<RenderWorker>(framebuffer.data());
+        // The worker starts from a full copy; later lines only carry changes.
+        worker->write(0, memory.getVRAM(), RenderWorker::VRAM_SIZE);
+        worker->write(RenderWorker::OAM_BASE, memory.getOAM(), RenderWorker::OAM_SIZE);
+        return;
     }
+    worker->finish();
+    worker.reset();
+    // The changes it consumed never reached the inline tile cache.
+    raster.refreshAllTiles(memory.getVRAM());
+    raster.invalidateSprites();
 }
+
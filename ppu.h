@@ -1,25 +1,53 @@
 #pragma once
 
+#include "rasterizer.h"
+
 #include <cstdint>
 #include <array>
 #include <iosfwd>
+#include <memory>
 
 class Memory;
-
-constexpr int SCREEN_WIDTH  = 160;
-constexpr int SCREEN_HEIGHT = 144;
+class Scheduler;
+class RenderWorker;
 
 class PPU {
 public:
     explicit PPU(Memory& mem);
+    ~PPU();
 
     void reset();
     void step(int cycles);
 
-    const uint32_t* getFramebuffer() const { return framebuffer.data(); }
+    // Lazy catch-up against the core's scheduler: advance to cycle `t` and
+    // schedule the next mode change.
+    void setScheduler(Scheduler* s) { scheduler = s; }
+    void sync(uint64_t t);
+    void resetSync(uint64_t t);
+    void reschedule();
+
+    // One shade index (0-3, already mapped through BGP/OBP0/OBP1) per pixel.
+    // The palette is applied only when a frontend asks for ARGB, so palette
+    // changes show up immediately without re-rendering.
+    const uint8_t* getFramebuffer() const;
+    void colorizeFramebuffer(uint32_t* out, int pitch = SCREEN_WIDTH) const;
+    const uint32_t* getPalette() const { return shades; }
     bool isFrameReady() const { return frameReady; }
     void clearFrameReady() { frameReady = false; }
 
+    // With rendering off, modes, LY, STAT and interrupts keep exact timing
+    // but no pixels are drawn: the framebuffer keeps the last rendered
+    // lines. Not part of the save state.
+    void setRenderEnabled(bool on) { renderEnabled = on; }
+    bool isRenderEnabled() const { return renderEnabled; }
+
+    // Draw lines on a worker thread from a log of each line's registers and
+    // the VRAM/OAM changes before it, while emulation carries on. Reading
+    // the framebuffer (or saving state) waits for the queued lines, so the
+    // output is identical to drawing inline. Not part of the save state.
+    void setThreadedRendering(bool on);
+    bool isThreadedRendering() const { return worker != nullptr; }
+
     void writeLCDC(uint8_t v);
     void writeSTAT(uint8_t v);
     void writeLY(uint8_t /*v*/) { ly = 0; }
@@ -33,6 +61,8 @@ public:
 
 private:
     Memory& memory;
+    Scheduler* scheduler = nullptr;
+    uint64_t   synced    = 0;
 
     uint8_t lcdc = 0;
     uint8_t stat = 0;
@@ -43,17 +73,21 @@ private:
     bool frameReady = false;
     int  windowLine = 0;
     bool prevStatLine = false;
+    bool renderEnabled = true;
 
-    std::array<uint32_t, SCREEN_WIDTH * SCREEN_HEIGHT> framebuffer{};
+    std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> framebuffer{};
 
     uint32_t shades[4] = {
         0xFFFFFFFFu, 0xFFAAAAAAu, 0xFF555555u, 0xFF000000u
     };
 
+    Rasterizer raster;
+    std::unique_ptr<RenderWorker> worker;
+
+    LineRegs latchLine() const;
     void renderScanline();
-    void renderBackground(std::array<uint8_t, SCREEN_WIDTH>& bgIdx);
-    void renderWindow(std::array<uint8_t, SCREEN_WIDTH>& bgIdx);
-    void renderSprites(const std::array<uint8_t, SCREEN_WIDTH>& bgIdx);
+    void queueScanline(const LineRegs& r);
+    bool windowOnLine() const;
 
     void setMode(int m);
     void updateStatLine();
@@ -0,0 +1,84 @@
+#include "profile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace prof {
+
+thread_local Counters counters{};
+
+void reset() {
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+Counters difference(const Counters& now, const Counters& then) {
+    Counters d{};
+    for (int i = 0; i < 256; ++i) {
+        d.opcodes[i]   = now.opcodes[i] - then.opcodes[i];
+        d.cbOpcodes[i] = now.cbOpcodes[i] - then.cbOpcodes[i];
+    }
+    d.cycles     = now.cycles - then.cycles;
+    d.haltCycles = now.haltCycles - then.haltCycles;
+    for (int r = 0; r < REGION_COUNT; ++r) {
+        d.reads[r]  = now.reads[r] - then.reads[r];
+        d.writes[r] = now.writes[r] - then.writes[r];
+    }
+    for (int s = 0; s < SECTION_COUNT; ++s) {
+        d.sectionNs[s]    = now.sectionNs[s] - then.sectionNs[s];
+        d.sectionCalls[s] = now.sectionCalls[s] - then.sectionCalls[s];
+    }
+    return d;
+}
+
+const char* regionName(Region r) {
+    switch (r) {
+        case Rom0:   return "ROM0";
+        case RomX:   return "ROMX";
+        case Vram:   return "VRAM";
+        case ExtRam: return "SRAM";
+        case Wram:   return "WRAM";
+        case Echo:   return "ECHO";
+        case Oam:    return "OAM";
+        case Io:     return "IO";
+        case Hram:   return "HRAM";
+        default:     return "?";
+    }
+}
+
+const char* sectionName(Section s) {
+    switch (s) {
+        case Scanline: return "ppu_scanline";
+        case Apu:      return "apu";
+        case Frame:    return "frame";
+        default:       return "?";
+    }
+}
+
+bool writeCSV(const Counters& c, const std::string& path) {
+    std::ofstream f(path, std::ios::trunc);
+    if (!f) return false;
+    char name[8];
+    f << "kind,name,value\n";
+    for (int op = 0; op < 256; ++op) {
+        std::snprintf(name, sizeof(name), "0x%02X", op);
+        if (c.opcodes[op])   f << "opcode," << name << ',' << c.opcodes[op] << '\n';
+    }
+    for (int op = 0; op < 256; ++op) {
+        std::snprintf(name, sizeof(name), "0x%02X", op);
+        if (c.cbOpcodes[op]) f << "cb_opcode," << name << ',' << c.cbOpcodes[op] << '\n';
+    }
+    f << "cycles,total," << c.cycles << '\n';
+    f << "cycles,halt," << c.haltCycles << '\n';
+    for (int r = 0; r < REGION_COUNT; ++r) {
+        f << "read,"  << regionName(Region(r)) << ',' << c.reads[r]  << '\n';
+        f << "write," << regionName(Region(r)) << ',' << c.writes[r] << '\n';
+    }
+    for (int s = 0; s < SECTION_COUNT; ++s) {
+        f << "time_ns," << sectionName(Section(s)) << ',' << c.sectionNs[s] << '\n';
+        f << "calls,"   << sectionName(Section(s)) << ',' << c.sectionCalls[s] << '\n';
+    }
+    return static_cast<bool>(f);
+}
+
+} // namespace prof
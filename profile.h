@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Built-in performance counters. The hot-path hooks (GB_PROF and
+// GB_PROF_SCOPE) only exist in builds made with `make PROFILE=1`
+// (-DGB_PROFILE); otherwise they expand to nothing and the core is
+// unchanged. Counters are per thread, so parallel batch workers never
+// share them.
+namespace prof {
+
+#ifdef GB_PROFILE
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// Memory map regions for the read/write counts.
+enum Region : uint8_t { Rom0, RomX, Vram, ExtRam, Wram, Echo, Oam, Io, Hram, REGION_COUNT };
+
+// Host-time sections.
+enum Section : uint8_t {
+    Scanline, // PPU::renderScanline, plus render-thread drawing (RenderWorker::finish)
+    Apu,      // APU channel stepping and sample synthesis
+    Frame,    // one Core::runFrame
+    SECTION_COUNT
+};
+
+struct Counters {
+    uint64_t opcodes[256];
+    uint64_t cbOpcodes[256];
+    uint64_t cycles;     // emulated cycles in Core::runFrame
+    uint64_t haltCycles; // of which the CPU sat in HALT
+    uint64_t reads[REGION_COUNT];
+    uint64_t writes[REGION_COUNT];
+    uint64_t sectionNs[SECTION_COUNT];
+    uint64_t sectionCalls[SECTION_COUNT];
+};
+
+extern thread_local Counters counters;
+
+void reset();
+// Per-counter `now - then`.
+Counters difference(const Counters& now, const Counters& then);
+const char* regionName(Region r);
+const char* sectionName(Section s);
+// One `kind,name,value` row per counter; opcodes never executed are left out.
+bool writeCSV(const Counters& c, const std::string& path);
+
+inline Region regionOf(uint16_t addr) {
+    static constexpr Region pages[16] = {
+        Rom0, Rom0, Rom0, Rom0, RomX, RomX, RomX, RomX,
+        Vram, Vram, ExtRam, ExtRam, Wram, Wram, Echo, Echo,
+    };
+    if (addr < 0xFE00) return pages[addr >> 12];
+    if (addr < 0xFF00) return Oam;
+    if (addr < 0xFF80 || addr == 0xFFFF) return Io;
+    return Hram;
+}
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Section s) : section(s), start(clock::now()) {}
+    ~ScopedTimer() {
+        counters.sectionNs[section] += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+        counters.sectionCalls[section]++;
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    using clock = std::chrono::steady_clock;
+    Section section;
+    clock::time_point start;
+};
+
+} // namespace prof
+
+#ifdef GB_PROFILE
+#define GB_PROF(stmt)          do { stmt; } while (0)
+#define GB_PROF_SCOPE(section) ::prof::ScopedTimer gbProfScope_(::prof::section)
+#else
+#define GB_PROF(stmt)          do {} while (0)
+#define GB_PROF_SCOPE(section) do {} while (0)
+#endif
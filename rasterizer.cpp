@@ -0,0 +1,180 @@
+#include "rasterizer.h"
+
+#include <algorithm>  // std::copy, std::fill, std::max, std::min, std::sort
+
+void Rasterizer::refreshTiles(const uint8_t* vram, const uint64_t* dirty) {
+    for (int w = 0; w < TILE_COUNT / 64; ++w) {
+        for (uint64_t bits = dirty[w]; bits; bits &= bits - 1) {
+            int tile = w * 64 + __builtin_ctzll(bits);
+            const uint8_t* src = vram + tile * 16;
+            for (int line = 0; line < 8; ++line) {
+                uint8_t lo = src[line * 2];
+                uint8_t hi = src[line * 2 + 1];
+                uint8_t* dst = tileCache[tile][line];
+                for (int px = 0; px < 8; ++px) {
+                    int bit = 7 - px;
+                    dst[px] = uint8_t(((lo >> bit) & 1) | (((hi >> bit) & 1) << 1));
+                }
+            }
+        }
+    }
+}
+
+void Rasterizer::refreshAllTiles(const uint8_t* vram) {
+    uint64_t all[TILE_COUNT / 64];
+    std::fill(all, all + TILE_COUNT / 64, ~uint64_t(0));
+    refreshTiles(vram, all);
+}
+
+// Decoded row for a BG/window map entry, honouring LCDC bit 4 addressing.
+const uint8_t* Rasterizer::bgTileRow(uint8_t lcdc, uint8_t tileIdx, int line) const {
+    int tile = (lcdc & 0x10) ? tileIdx : 256 + int(int8_t(tileIdx));
+    return tileCache[tile][line];
+}
+
+void Rasterizer::renderLine(const LineRegs& r, const uint8_t* vram, const uint8_t* oam,
+                            uint8_t* out) {
+    std::array<uint8_t, SCREEN_WIDTH> bgIdx{};
+    bgIdx.fill(0);
+
+    // Palette-mapped shade (0-3) per pixel for this line.
+    std::array<uint8_t, SCREEN_WIDTH> colorLine{};
+
+    if (r.lcdc & 0x01) {
+        renderBackground(r, vram, bgIdx, colorLine);
+        if (r.lcdc & 0x20) renderWindow(r, vram, bgIdx, colorLine);
+    }
+
+    if (r.lcdc & 0x02) renderSprites(r, oam, bgIdx, colorLine);
+
+    std::copy(colorLine.begin(), colorLine.end(), out);
+}
+
+void Rasterizer::renderBackground(const LineRegs& r, const uint8_t* vram,
+                                  std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                                  std::array<uint8_t, SCREEN_WIDTH>& colorLine) const {
+    uint8_t colors[4];
+    for (int i = 0; i < 4; ++i) colors[i] = uint8_t((r.bgp >> (i * 2)) & 0x03);
+
+    uint16_t mapBase = (r.lcdc & 0x08) ? 0x1C00 : 0x1800;
+    uint8_t y = uint8_t(r.ly + r.scy);
+    const uint8_t* map = vram + mapBase + ((y / 8) & 31) * 32;
+    int line = y & 7;
+
+    // One tile-row span per iteration; only the first and last are partial.
+    uint8_t px = r.scx;
+    for (int x = 0; x < SCREEN_WIDTH;) {
+        const uint8_t* pix = bgTileRow(r.lcdc, map[(px / 8) & 31], line) + (px & 7);
+        int n = std::min(8 - (px & 7), SCREEN_WIDTH - x);
+        for (int i = 0; i < n; ++i) {
+            bgIdx[x + i] = pix[i];
+            colorLine[x + i] = colors[pix[i]];
+        }
+        x += n;
+        px = uint8_t(px + n);
+    }
+}
+
+void Rasterizer::renderWindow(const LineRegs& r, const uint8_t* vram,
+                              std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                              std::array<uint8_t, SCREEN_WIDTH>& colorLine) const {
+    if (r.ly < r.wy || r.wx >= 167) return;
+
+    uint8_t colors[4];
+    for (int i = 0; i < 4; ++i) colors[i] = uint8_t((r.bgp >> (i * 2)) & 0x03);
+
+    uint16_t mapBase = (r.lcdc & 0x40) ? 0x1C00 : 0x1800;
+    int wyLine = r.windowLine;
+    const uint8_t* map = vram + mapBase + ((wyLine / 8) & 31) * 32;
+    int line = wyLine & 7;
+
+    int startX = int(r.wx) - 7;
+
+    int x = std::max(0, startX);
+    int wxPos = x - startX;
+    while (x < SCREEN_WIDTH) {
+        const uint8_t* pix = bgTileRow(r.lcdc, map[(wxPos / 8) & 31], line) + (wxPos & 7);
+        int n = std::min(8 - (wxPos & 7), SCREEN_WIDTH - x);
+        for (int i = 0; i < n; ++i) {
+            bgIdx[x + i] = pix[i];
+            colorLine[x + i] = colors[pix[i]];
+        }
+        x += n;
+        wxPos += n;
+    }
+}
+
+void Rasterizer::binSprites(const uint8_t* oam, bool tall) {
+    int spriteH = tall ? 16 : 8;
+
+    // Pass 1, in OAM order: the first ten sprites touching a line win it.
+    uint64_t chosen[SCREEN_HEIGHT]{};
+    uint8_t  taken[SCREEN_HEIGHT]{};
+    for (int i = 0; i < 40; ++i) {
+        int top = int(oam[i * 4]) - 16;
+        int first = std::max(top, 0);
+        int last  = std::min(top + spriteH, SCREEN_HEIGHT);
+        for (int line = first; line < last; ++line) {
+            if (taken[line] == MAX_LINE_SPRITES) continue;
+            taken[line]++;
+            chosen[line] |= uint64_t(1) << i;
+        }
+    }
+
+    // Pass 2, in draw order: lower X is drawn last (highest priority), ties
+    // go to the lower OAM index.
+    int order[40];
+    for (int i = 0; i < 40; ++i) order[i] = i;
+    std::sort(order, order + 40, [oam](int a, int b) {
+        int xa = oam[a * 4 + 1], xb = oam[b * 4 + 1];
+        return xa != xb ? xa > xb : a > b;
+    });
+
+    for (auto& bin : spriteBins) bin.count = 0;
+    for (int i : order) {
+        const uint8_t* e = oam + i * 4;
+        int top = int(e[0]) - 16;
+        int first = std::max(top, 0);
+        int last  = std::min(top + spriteH, SCREEN_HEIGHT);
+        uint8_t attr = e[3];
+        // Tall sprites use tile|1 for the bottom half, i.e. the next tile.
+        int tile = tall ? (e[2] & 0xFE) : e[2];
+        for (int line = first; line < last; ++line) {
+            if (!(chosen[line] & (uint64_t(1) << i))) continue;
+            int spriteY = line - top;
+            if (attr & 0x40) spriteY = spriteH - 1 - spriteY;
+            SpriteBin& bin = spriteBins[line];
+            bin.sprites[bin.count++] = { int16_t(int(e[1]) - 8),
+                                         uint8_t(tile + spriteY / 8), uint8_t(spriteY & 7),
+                                         attr };
+        }
+    }
+    binsTall  = tall;
+    binsValid = true;
+}
+
+void Rasterizer::renderSprites(const LineRegs& r, const uint8_t* oam,
+                               const std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                               std::array<uint8_t, SCREEN_WIDTH>& colorLine) {
+    bool tall = (r.lcdc & 0x04) != 0;
+    if (!binsValid || tall != binsTall) binSprites(oam, tall);
+
+    const SpriteBin& bin = spriteBins[r.ly];
+    for (int s = 0; s < bin.count; ++s) {
+        const BinnedSprite& sp = bin.sprites[s];
+        bool flipX = (sp.attr & 0x20) != 0;
+        bool bgPrio = (sp.attr & 0x80) != 0;
+        uint8_t palette = (sp.attr & 0x10) ? r.obp1 : r.obp0;
+        const uint8_t* pix = tileCache[sp.tile][sp.line];
+
+        for (int px = 0; px < 8; ++px) {
+            int sx = sp.x + px;
+            if (sx < 0 || sx >= SCREEN_WIDTH) continue;
+            uint8_t shade = pix[flipX ? 7 - px : px];
+            if (shade == 0) continue;
+            if (bgPrio && bgIdx[sx] != 0) continue;
+            uint8_t color = (palette >> (shade * 2)) & 0x03;
+            colorLine[sx] = color;
+        }
+    }
+}
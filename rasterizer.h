@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+constexpr int SCREEN_WIDTH  = 160;
+constexpr int SCREEN_HEIGHT = 144;
+
+// The registers a scanline is drawn with, latched at the end of its mode 3.
+struct LineRegs {
+    uint8_t ly, lcdc;
+    uint8_t scy, scx, wy, wx;
+    uint8_t bgp, obp0, obp1;
+    uint8_t windowLine;   // the window's internal line counter
+};
+
+// Draws one scanline from VRAM, OAM and its LineRegs into shade indices.
+// It owns the decoded tile cache and the per-line sprite bins, but not the
+// video memory, so the PPU can draw inline from Memory while a render
+// worker draws from its own copy.
+class Rasterizer {
+public:
+    static constexpr int TILE_COUNT = 384;
+
+    // Re-decode the tiles whose bits are set, one bit per 16-byte tile.
+    void refreshTiles(const uint8_t* vram, const uint64_t* dirty);
+    void refreshAllTiles(const uint8_t* vram);
+    // OAM changed: re-bin the sprites before the next line that draws them.
+    void invalidateSprites() { binsValid = false; }
+
+    // `out` receives SCREEN_WIDTH shade indices.
+    void renderLine(const LineRegs& r, const uint8_t* vram, const uint8_t* oam, uint8_t* out);
+
+private:
+    // Every tile in 0x8000-0x97FF pre-expanded to one 2-bit color index
+    // per pixel.
+    uint8_t tileCache[TILE_COUNT][8][8]{};
+
+    // Sprites selected for each line (first ten in OAM order), already in
+    // draw order with their tile row resolved. Rebuilt only when OAM or the
+    // 8x16 mode bit changes, instead of rescanning OAM on every line.
+    static constexpr int MAX_LINE_SPRITES = 10;
+    struct BinnedSprite {
+        int16_t x;
+        uint8_t tile, line;   // resolved tileCache row
+        uint8_t attr;
+    };
+    struct SpriteBin {
+        uint8_t      count = 0;
+        BinnedSprite sprites[MAX_LINE_SPRITES];
+    };
+    std::array<SpriteBin, SCREEN_HEIGHT> spriteBins{};
+    bool binsTall  = false;
+    bool binsValid = false;
+
+    void binSprites(const uint8_t* oam, bool tall);
+    const uint8_t* bgTileRow(uint8_t lcdc, uint8_t tileIdx, int line) const;
+
+    void renderBackground(const LineRegs& r, const uint8_t* vram,
+                          std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                          std::array<uint8_t, SCREEN_WIDTH>& colorLine) const;
+    void renderWindow(const LineRegs& r, const uint8_t* vram,
+                      std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                      std::array<uint8_t, SCREEN_WIDTH>& colorLine) const;
+    void renderSprites(const LineRegs& r, const uint8_t* oam,
+                       const std::array<uint8_t, SCREEN_WIDTH>& bgIdx,
+                       std::array<uint8_t, SCREEN_WIDTH>& colorLine);
+};
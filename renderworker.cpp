@@ -0,0 +1,135 @@
+#include "renderworker.h"
+#include "profile.h"
+
+#include <algorithm>  // std::min
+#include <chrono>
+#include <cstring>
+
+void RenderWorker::Batch::clear() {
+    deltas.clear();
+    bytes.clear();
+    lines.clear();
+    lineDeltas = 0;
+}
+
+RenderWorker::RenderWorker(uint8_t* fb)
+    : framebuffer(fb), current(std::make_unique<Batch>()) {
+    thread = std::thread([this] { run(); });
+}
+
+RenderWorker::~RenderWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void RenderWorker::write(uint16_t offset, const uint8_t* data, size_t length) {
+    Batch& b = *current;
+    // Adjacent changes before the same line, such as a run of dirty tiles,
+    // become one copy.
+    if (b.deltas.size() > b.lineDeltas) {
+        Batch::Delta& last = b.deltas.back();
+        if (last.offset + last.length == offset && offset != OAM_BASE) {
+            last.length = uint16_t(last.length + length);
+            b.bytes.insert(b.bytes.end(), data, data + length);
+            return;
+        }
+    }
+    b.deltas.push_back({ offset, uint16_t(length), uint32_t(b.bytes.size()) });
+    b.bytes.insert(b.bytes.end(), data, data + length);
+}
+
+void RenderWorker::addLine(const LineRegs& r) {
+    Batch& b = *current;
+    b.lines.push_back({ r, uint32_t(b.deltas.size()) });
+    b.lineDeltas = b.deltas.size();
+    if (b.lines.size() >= LINES_PER_BATCH || r.ly == SCREEN_HEIGHT - 1) publish();
+}
+
+void RenderWorker::publish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return queue.size() < MAX_QUEUED; });
+    queue.push_back(std::move(current));
+    if (spare.empty()) {
+        current = std::make_unique<Batch>();
+    } else {
+        current = std::move(spare.back());
+        spare.pop_back();
+    }
+    lock.unlock();
+    wake.notify_one();
+}
+
+void RenderWorker::finish() {
+    // Changes with no line after them yet stay queued for the next one.
+    if (!current->lines.empty()) publish();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return queue.empty() && !busy; });
+    // The counters are per thread; hand the drawing time to the caller's.
+    GB_PROF(prof::counters.sectionNs[prof::Scanline] += drawNs);
+    drawNs = 0;
+}
+
+void RenderWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+        std::unique_ptr<Batch> b = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        lock.unlock();
+
+        uint64_t ns = 0;
+        if (prof::enabled) {
+            auto start = std::chrono::steady_clock::now();
+            draw(*b);
+            ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        } else {
+            draw(*b);
+        }
+        b->clear();
+
+        lock.lock();
+        drawNs += ns;
+        spare.push_back(std::move(b));
+        busy = false;
+        done.notify_all();
+    }
+}
+
+void RenderWorker::draw(const Batch& b) {
+    size_t d = 0;
+    for (const Batch::Line& line : b.lines) {
+        for (; d < line.deltaEnd; ++d) {
+            const Batch::Delta& delta = b.deltas[d];
+            apply(delta.offset, b.bytes.data() + delta.data, delta.length);
+        }
+        if (anyTileDirty) {
+            raster.refreshTiles(vram, tileDirty);
+            std::memset(tileDirty, 0, sizeof(tileDirty));
+            anyTileDirty = false;
+        }
+        raster.renderLine(line.regs, vram, oam,
+                          framebuffer + size_t(line.regs.ly) * SCREEN_WIDTH);
+    }
+}
+
+void RenderWorker::apply(uint16_t offset, const uint8_t* data, size_t length) {
+    if (offset >= OAM_BASE) {
+        std::memcpy(oam + (offset - OAM_BASE), data, length);
+        raster.invalidateSprites();
+        return;
+    }
+    std::memcpy(vram + offset, data, length);
+    // Tile data is 0x0000-0x17FF; the maps above it are read directly.
+    size_t end = std::min<size_t>(offset + length, Rasterizer::TILE_COUNT * 16);
+    for (size_t tile = offset / 16; tile * 16 < end; ++tile) {
+        tileDirty[tile / 64] |= uint64_t(1) << (tile % 64);
+        anyTileDirty = true;
+    }
+}
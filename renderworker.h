@@ -0,0 +1,84 @@
+#pragma once
+
+#include "rasterizer.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Draws scanlines on a background thread. The emulation thread logs each
+// line's registers, preceded by whatever VRAM or OAM bytes changed since
+// the line before; the worker replays that log against its own copy of
+// video memory and writes finished rows into the framebuffer it was given.
+// Nothing else is shared, so the emulation thread only pays for copying
+// the changes.
+class RenderWorker {
+public:
+    // Offsets below VRAM_SIZE address VRAM; OAM starts at OAM_BASE.
+    static constexpr uint16_t VRAM_SIZE = 0x2000;
+    static constexpr uint16_t OAM_BASE  = VRAM_SIZE;
+    static constexpr uint16_t OAM_SIZE  = 0xA0;
+
+    explicit RenderWorker(uint8_t* framebuffer);
+    ~RenderWorker();
+    RenderWorker(const RenderWorker&) = delete;
+    RenderWorker& operator=(const RenderWorker&) = delete;
+
+    // Queue a change to video memory; it applies to every later line.
+    void write(uint16_t offset, const uint8_t* data, size_t length);
+    // Queue a line to be drawn into framebuffer row `r.ly`.
+    void addLine(const LineRegs& r);
+    // Frame fence: returns once every queued line is in the framebuffer.
+    // In profiling builds it also adds the worker's drawing time to the
+    // calling thread's scanline counter.
+    void finish();
+
+private:
+    struct Batch {
+        struct Delta { uint16_t offset, length; uint32_t data; }; // data: index into bytes
+        struct Line  { LineRegs regs; uint32_t deltaEnd; };       // deltas applied before it
+        std::vector<Delta>   deltas;
+        std::vector<uint8_t> bytes;
+        std::vector<Line>    lines;
+        size_t lineDeltas = 0; // first delta queued since the last line
+        void clear();
+    };
+
+    // Lines are handed over in groups, so the worker wakes a few times per
+    // frame rather than on every line.
+    static constexpr size_t LINES_PER_BATCH = 16;
+    // Backpressure: the emulation thread waits once this many are queued.
+    static constexpr size_t MAX_QUEUED = 32;
+
+    uint8_t* framebuffer;
+
+    // Emulation-thread side.
+    std::unique_ptr<Batch> current;
+
+    // Worker side.
+    Rasterizer raster;
+    uint8_t  vram[VRAM_SIZE]{};
+    uint8_t  oam[OAM_SIZE]{};
+    uint64_t tileDirty[Rasterizer::TILE_COUNT / 64]{};
+    bool     anyTileDirty = false;
+
+    std::mutex mutex;
+    std::condition_variable wake; // a batch was queued, or shutdown
+    std::condition_variable done; // a batch was drawn
+    std::deque<std::unique_ptr<Batch>>  queue;
+    std::vector<std::unique_ptr<Batch>> spare;
+    bool busy = false;
+    bool stopping = false;
+    uint64_t drawNs = 0; // drawing time finish() has not merged yet (PROFILE=1)
+    std::thread thread;
+
+    void publish();
+    void run();
+    void draw(const Batch& b);
+    void apply(uint16_t offset, const uint8_t* data, size_t length);
+};
@@ -0,0 +1,150 @@
+#include "rewind.h"
+#include "core.h"
+
+#include <cstring>
+#include <utility> // std::swap
+
+namespace {
+// Frames per second of history; close enough to 59.73 Hz for sizing.
+constexpr int FRAMES_PER_SECOND = 60;
+uint8_t* putVarint(uint8_t* p, size_t v) {
+    while (v >= 0x80) {
+        *p++ = uint8_t(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = uint8_t(v);
+    return p;
+}
+
+size_t getVarint(const uint8_t*& p) {
+    size_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *p++;
+        v |= size_t(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+// Deltas work on 8-byte words; the snapshot buffers are zero-padded past
+// the serialized size, so the last partial word compares cleanly.
+size_t wordCount(size_t n) { return (n + 7) / 8; }
+
+uint64_t loadWord(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void storeWord(uint8_t* p, uint64_t v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// Every block but the first and last covers at least as many bytes as it
+// emits, so this is a safe upper bound.
+size_t deltaBound(size_t n) { return wordCount(n) * 8 + 32; }
+
+// Encodes prev ^ cur as (unchanged words, changed words, XOR words) blocks;
+// unchanged words cost nothing beyond the run length.
+size_t encodeDelta(const uint8_t* prev, const uint8_t* cur, size_t n, uint8_t* out) {
+    const size_t words = wordCount(n);
+    uint8_t* p = out;
+    size_t i = 0;
+    while (i < words) {
+        size_t start = i;
+        while (i < words && loadWord(prev + i * 8) == loadWord(cur + i * 8)) ++i;
+        size_t same = i - start;
+        size_t litStart = i;
+        while (i < words && loadWord(prev + i * 8) != loadWord(cur + i * 8)) ++i;
+        p = putVarint(p, same);
+        p = putVarint(p, i - litStart);
+        for (size_t j = litStart; j < i; ++j, p += 8) {
+            storeWord(p, loadWord(prev + j * 8) ^ loadWord(cur + j * 8));
+        }
+    }
+    return size_t(p - out);
+}
+
+// XORs a delta back into `state`, turning the newer snapshot into the older.
+void applyDelta(uint8_t* state, const uint8_t* delta, size_t size) {
+    const uint8_t* p = delta;
+    const uint8_t* end = delta + size;
+    size_t i = 0;
+    while (p < end) {
+        i += getVarint(p);
+        size_t lit = getVarint(p);
+        for (size_t k = 0; k < lit; ++k, ++i, p += 8) {
+            storeWord(state + i * 8, loadWord(state + i * 8) ^ loadWord(p));
+        }
+    }
+}
+}
+
+Rewind::Rewind(int seconds, size_t budgetBytes)
+    : arena(budgetBytes),
+      entries(static_cast<size_t>(seconds > 0 ? seconds : 1) * FRAMES_PER_SECOND) {}
+
+void Rewind::reset(const Core& core) {
+    clear();
+    // Round up so the word-wise delta never reads past the end.
+    size_t size = wordCount(core.serialize(scratch, false)) * 8;
+    scratch.assign(size, 0);
+    head.assign(size, 0);
+}
+
+void Rewind::clear() {
+    first = 0;
+    count = 0;
+    writePos = 0;
+    headSize = 0;
+    haveHead = false;
+}
+
+void Rewind::dropOldest() {
+    first = (first + 1) % int(entries.size());
+    --count;
+}
+
+void Rewind::capture(const Core& core) {
+    if (scratch.empty()) return;
+    size_t n = core.serialize(scratch, false);
+    if (n == 0) return;
+    if (scratch.size() < wordCount(n) * 8) scratch.resize(wordCount(n) * 8);
+    if (!haveHead || n != headSize || deltaBound(n) > arena.size()) {
+        // First snapshot, or the layout changed: start a fresh history.
+        clear();
+        std::swap(head, scratch);
+        headSize = n;
+        haveHead = true;
+        return;
+    }
+
+    size_t bound = deltaBound(n);
+    if (writePos + bound > arena.size()) writePos = 0;
+    // Free the arena range about to be written; it can only hold the
+    // oldest deltas. Also respect the configured history length.
+    while (count > 0) {
+        const Entry& e = entries[first];
+        bool overlaps = e.offset < writePos + bound && e.offset + e.size > writePos;
+        if (!overlaps && count < int(entries.size())) break;
+        dropOldest();
+    }
+
+    size_t size = encodeDelta(scratch.data(), head.data(), n, arena.data() + writePos);
+    entries[(first + count) % int(entries.size())] = { writePos, size };
+    ++count;
+    writePos += size;
+    std::swap(head, scratch);
+}
+
+bool Rewind::stepBack(Core& core) {
+    if (count == 0) return false;
+    int last = (first + count - 1) % int(entries.size());
+    const Entry& e = entries[last];
+    applyDelta(head.data(), arena.data() + e.offset, e.size);
+    writePos = e.offset;
+    --count;
+    return core.deserialize(head.data(), headSize);
+}
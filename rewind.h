@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Core;
+
+// Rewind history built from uncompressed in-memory save states. Only the
+// newest snapshot is kept whole; every older one is an XOR/RLE delta
+// against its successor, packed into an arena allocated once up front, so
+// capturing a frame never allocates and memory never exceeds the budget.
+class Rewind {
+public:
+    explicit Rewind(int seconds = 60, size_t budgetBytes = size_t(64) << 20);
+
+    // Sizes the snapshot buffers for the loaded cartridge and drops any
+    // history. Call after loading or unloading a ROM.
+    void reset(const Core& core);
+    void clear();
+
+    // Records the current state; call once per emulated frame.
+    void capture(const Core& core);
+
+    // Loads the snapshot before the newest one and forgets the newest.
+    // Returns false once the history is exhausted.
+    bool stepBack(Core& core);
+
+    int snapshotCount() const { return haveHead ? count + 1 : 0; }
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<uint8_t> arena;
+    std::vector<Entry>   entries; // ring of deltas, oldest at `first`
+    int    first    = 0;
+    int    count    = 0;
+    size_t writePos = 0;
+
+    std::vector<uint8_t> head;    // newest snapshot, uncompressed
+    std::vector<uint8_t> scratch; // capture target, swapped with head
+    size_t headSize = 0;
+    bool   haveHead = false;
+
+    void dropOldest();
+};
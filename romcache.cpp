@@ -0,0 +1,169 @@
+#include "romcache.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Maps the whole file read-only; returns nullptr (and leaves `size` alone
+// on failure) so the caller can fall back to reading it.
+static const uint8_t* mapFile(const std::string& path, size_t& size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER len;
+    if (!GetFileSizeEx(file, &len) || len.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return nullptr;
+    // The view keeps the mapping object alive after its handle is closed.
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) return nullptr;
+    size = static_cast<size_t>(len.QuadPart);
+    return static_cast<const uint8_t*>(view);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    size = static_cast<size_t>(st.st_size);
+    return static_cast<const uint8_t*>(p);
+#endif
+}
+
+static void unmapFile(const uint8_t* p, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(p);
+#else
+    munmap(const_cast<uint8_t*>(p), size);
+#endif
+}
+
+std::unique_ptr<RomFile> RomFile::open(const std::string& path, std::string& error) {
+    std::unique_ptr<RomFile> rom(new RomFile());
+    size_t size = 0;
+    if (const uint8_t* p = mapFile(path, size)) {
+        rom->bytes = p;
+        rom->length = size;
+        rom->mapped = true;
+    } else {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f) {
+            error = "Cannot open ROM: " + path;
+            return nullptr;
+        }
+        size = static_cast<size_t>(f.tellg());
+        f.seekg(0, std::ios::beg);
+        rom->heap.assign(size, 0);
+        if (!f.read(reinterpret_cast<char*>(rom->heap.data()), size)) {
+            error = "Failed to read ROM";
+            return nullptr;
+        }
+        rom->bytes = rom->heap.data();
+        rom->length = size;
+    }
+    rom->contentHash = fnv1a(rom->bytes, rom->length);
+    return rom;
+}
+
+RomFile::~RomFile() {
+    if (mapped) unmapFile(bytes, length);
+}
+
+namespace {
+
+struct PathEntry {
+    std::weak_ptr<const RomFile> rom;
+    uintmax_t size;
+    fs::file_time_type mtime;
+};
+
+std::mutex cacheMutex;
+std::unordered_map<std::string, PathEntry> byPath;
+std::unordered_multimap<uint64_t, std::weak_ptr<const RomFile>> byHash;
+
+void pruneLocked() {
+    for (auto it = byPath.begin(); it != byPath.end();) {
+        it = it->second.rom.expired() ? byPath.erase(it) : std::next(it);
+    }
+    for (auto it = byHash.begin(); it != byHash.end();) {
+        it = it->second.expired() ? byHash.erase(it) : std::next(it);
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const RomFile> RomCache::open(const std::string& path, std::string& error) {
+    std::error_code ec;
+    fs::path canonical = fs::weakly_canonical(path, ec);
+    std::string key = ec ? path : canonical.string();
+    uintmax_t size = fs::file_size(path, ec);
+    fs::file_time_type mtime{};
+    if (!ec) mtime = fs::last_write_time(path, ec);
+    if (ec) {
+        error = "Cannot open ROM: " + path;
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = byPath.find(key);
+        if (it != byPath.end() && it->second.size == size && it->second.mtime == mtime) {
+            if (auto rom = it->second.rom.lock()) return rom;
+        }
+    }
+
+    // Map and hash outside the lock so parallel loads of different ROMs
+    // don't serialise; a racing load of the same ROM is merged below.
+    std::shared_ptr<const RomFile> rom = RomFile::open(path, error);
+    if (!rom) return nullptr;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    pruneLocked();
+    auto range = byHash.equal_range(rom->hash());
+    bool shared = false;
+    for (auto it = range.first; it != range.second; ++it) {
+        auto other = it->second.lock();
+        if (other && other->size() == rom->size() &&
+            std::equal(other->data(), other->data() + other->size(), rom->data())) {
+            rom = other;
+            shared = true;
+            break;
+        }
+    }
+    if (!shared) byHash.emplace(rom->hash(), rom);
+    byPath[key] = PathEntry{rom, size, mtime};
+    return rom;
+}
+
+size_t RomCache::liveCount() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    pruneLocked();
+    return byHash.size();
+}
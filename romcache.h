@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A read-only cartridge image. Where the platform allows it the file is
+// memory-mapped, so loading costs no copy and banks page in as the game
+// touches them; otherwise it is read into the heap. Contents never change
+// once opened. Rewriting a ROM in place while it is mapped is not
+// supported: the running game may see the new bytes.
+class RomFile {
+public:
+    static std::unique_ptr<RomFile> open(const std::string& path, std::string& error);
+    ~RomFile();
+    RomFile(const RomFile&) = delete;
+    RomFile& operator=(const RomFile&) = delete;
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    uint64_t hash() const { return contentHash; } // FNV-1a of the whole image
+    bool isMapped() const { return mapped; }
+
+private:
+    RomFile() = default;
+
+    const uint8_t* bytes = nullptr;
+    size_t   length = 0;
+    uint64_t contentHash = 0;
+    bool     mapped = false;
+    std::vector<uint8_t> heap; // storage when the file could not be mapped
+};
+
+// Process-wide, thread-safe cache of open ROMs. Opening a path whose size
+// and modification time are unchanged returns the existing image, and a
+// different path with identical contents shares it too, so resets and
+// parallel batch instances of one game hold a single copy. An image is
+// released with its last user.
+class RomCache {
+public:
+    static std::shared_ptr<const RomFile> open(const std::string& path, std::string& error);
+    // Images currently alive; for tests and diagnostics.
+    static size_t liveCount();
+};
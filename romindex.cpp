@@ -0,0 +1,194 @@
+#include "romindex.h"
+#include "memory.h"
+#include "savewriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr const char* INDEX_MAGIC = "gbromindex 1";
+constexpr size_t HEADER_END = 0x150;
+// Entries are published in groups so the UI thread is not woken per file.
+constexpr size_t PUBLISH_EVERY = 32;
+
+bool isRomPath(const fs::path& p) {
+    if (!p.has_extension()) return false;
+    auto ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return ext == ".gb" || ext == ".gbc";
+}
+
+std::string lower(const std::string& s) {
+    std::string out = s;
+    std::transform(out.begin(), out.end(), out.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return out;
+}
+
+uint32_t headerRamSize(uint8_t code) {
+    switch (code) {
+        case 0x01: return 0x800;
+        case 0x02: return 0x2000;
+        case 0x03: return 0x8000;
+        case 0x04: return 0x20000;
+        case 0x05: return 0x10000;
+        default:   return 0;
+    }
+}
+}
+
+bool RomInfo::hasBattery() const {
+    return Memory::mbcHasBattery(mbcType);
+}
+
+bool RomInfo::matches(const std::string& query) const {
+    if (query.empty()) return true;
+    std::string q = lower(query);
+    return lower(fs::path(path).filename().string()).find(q) != std::string::npos ||
+           lower(title).find(q) != std::string::npos;
+}
+
+bool readRomInfo(const std::string& path, RomInfo& info) {
+    std::ifstream f(path, std::ios::binary);
+    uint8_t h[HEADER_END];
+    if (!f.read(reinterpret_cast<char*>(h), sizeof(h))) return false;
+
+    info.path = path;
+    info.title = Memory::headerTitle(h, sizeof(h));
+    info.mbcType = h[0x147];
+    info.cgbFlag = h[0x143];
+    info.ramSize = headerRamSize(h[0x149]);
+    info.globalChecksum = uint16_t((h[0x14E] << 8) | h[0x14F]);
+    uint8_t sum = 0;
+    for (int i = 0x134; i <= 0x14C; ++i) sum = uint8_t(sum - h[i] - 1);
+    info.headerChecksumOk = sum == h[0x14D];
+    return true;
+}
+
+RomIndexer::RomIndexer(std::string path) : indexPath(std::move(path)) {}
+
+RomIndexer::~RomIndexer() {
+    stop();
+}
+
+void RomIndexer::stop() {
+    cancel = true;
+    if (worker.joinable()) worker.join();
+    cancel = false;
+}
+
+void RomIndexer::scan(std::vector<std::string> dirs) {
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        found.clear();
+    }
+    busy = true;
+    worker = std::thread([this, d = std::move(dirs)]() mutable { run(std::move(d)); });
+}
+
+size_t RomIndexer::poll(std::vector<RomInfo>& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t n = found.size();
+    std::move(found.begin(), found.end(), std::back_inserter(out));
+    found.clear();
+    return n;
+}
+
+void RomIndexer::run(std::vector<std::string> dirs) {
+    if (!knownLoaded) {
+        loadIndex();
+        knownLoaded = true;
+    }
+
+    std::map<std::string, RomInfo> seen;
+    std::vector<RomInfo> batch;
+    bool changed = false;
+    auto publish = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::move(batch.begin(), batch.end(), std::back_inserter(found));
+        batch.clear();
+    };
+
+    std::error_code ec;
+    for (const std::string& dir : dirs) {
+        if (!fs::is_directory(dir, ec)) continue;
+        for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator();
+             it.increment(ec)) {
+            if (cancel) {
+                busy = false;
+                return;
+            }
+            const fs::directory_entry& entry = *it;
+            if (!isRomPath(entry.path()) || !entry.is_regular_file(ec)) continue;
+            std::string path = entry.path().lexically_normal().string();
+            if (seen.count(path)) continue;
+
+            RomInfo info;
+            info.fileSize = entry.file_size(ec);
+            if (ec) continue;
+            info.mtime = static_cast<int64_t>(entry.last_write_time(ec).time_since_epoch().count());
+            if (ec) continue;
+
+            auto cached = known.find(path);
+            if (cached != known.end() && cached->second.fileSize == info.fileSize &&
+                cached->second.mtime == info.mtime) {
+                info = cached->second;
+            } else {
+                if (!readRomInfo(path, info)) continue;
+                changed = true;
+            }
+            seen.emplace(path, info);
+            batch.push_back(std::move(info));
+            if (batch.size() >= PUBLISH_EVERY) publish();
+        }
+        ec.clear();
+    }
+    publish();
+
+    if (seen.size() != known.size()) changed = true;
+    known = std::move(seen);
+    if (changed) saveIndex();
+    busy = false;
+}
+
+// One line per ROM, tab-separated, path last:
+// size mtime mbc cgb ram checksum header_ok title path
+void RomIndexer::loadIndex() {
+    std::ifstream f(indexPath);
+    std::string line;
+    if (!f || !std::getline(f, line) || line != INDEX_MAGIC) return;
+    while (std::getline(f, line)) {
+        std::istringstream in(line);
+        RomInfo info;
+        unsigned mbc = 0, cgb = 0, checksum = 0, ok = 0;
+        in >> info.fileSize >> info.mtime >> mbc >> cgb >> info.ramSize >> checksum >> ok;
+        if (!in || in.get() != '\t') continue;
+        if (!std::getline(in, info.title, '\t') || !std::getline(in, info.path)) continue;
+        info.mbcType = uint8_t(mbc);
+        info.cgbFlag = uint8_t(cgb);
+        info.globalChecksum = uint16_t(checksum);
+        info.headerChecksumOk = ok != 0;
+        known[info.path] = std::move(info);
+    }
+}
+
+void RomIndexer::saveIndex() const {
+    std::ostringstream out;
+    out << INDEX_MAGIC << '\n';
+    for (const auto& [path, info] : known) {
+        out << info.fileSize << '\t' << info.mtime << '\t' << unsigned(info.mbcType) << '\t'
+            << unsigned(info.cgbFlag) << '\t' << info.ramSize << '\t' << info.globalChecksum
+            << '\t' << (info.headerChecksumOk ? 1 : 0) << '\t' << info.title << '\t' << path
+            << '\n';
+    }
+    std::string s = out.str();
+    writeFileAtomic(indexPath, std::vector<uint8_t>(s.begin(), s.end()));
+}
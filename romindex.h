@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What the ROM browser knows about one file, read from its cartridge header.
+struct RomInfo {
+    std::string path;
+    std::string title;         // as Memory::romTitle reads it
+    uint8_t  mbcType = 0;      // 0x147
+    uint8_t  cgbFlag = 0;      // 0x143; 0xC0 means Color-only
+    uint32_t ramSize = 0;      // bytes, from 0x149
+    uint16_t globalChecksum = 0;  // 0x14E-0x14F, as stored (not verified)
+    bool     headerChecksumOk = false;  // 0x14D matches bytes 0x134-0x14C
+    uint64_t fileSize = 0;
+    int64_t  mtime = 0;        // filesystem clock ticks
+
+    bool hasBattery() const;
+    bool isColorOnly() const { return cgbFlag == 0xC0; }
+    // Case-insensitive substring match against the file name and title.
+    bool matches(const std::string& query) const;
+};
+
+// Parse the header of the file at `path`; false if it is not a ROM.
+bool readRomInfo(const std::string& path, RomInfo& info);
+
+// Indexes ROM directories on a background thread so a large library on
+// slow storage never blocks the UI. Headers are cached in an index file
+// keyed by path, size and modification time; unchanged files are not
+// opened again. Results are handed over in batches through poll().
+class RomIndexer {
+public:
+    explicit RomIndexer(std::string indexPath);
+    ~RomIndexer();
+    RomIndexer(const RomIndexer&) = delete;
+    RomIndexer& operator=(const RomIndexer&) = delete;
+
+    // Start (or restart) scanning `dirs`, non-recursively. Results of a
+    // scan still running are dropped.
+    void scan(std::vector<std::string> dirs);
+    // Move the entries found since the last call onto the end of `out`.
+    // Returns how many were added.
+    size_t poll(std::vector<RomInfo>& out);
+    bool scanning() const { return busy.load(); }
+
+private:
+    std::string indexPath;
+
+    // Worker-only: the cache as last loaded or written.
+    std::map<std::string, RomInfo> known;
+    bool knownLoaded = false;
+
+    std::mutex mutex;
+    std::vector<RomInfo> found; // needs `mutex`
+    std::atomic<bool> busy{false};
+    std::atomic<bool> cancel{false};
+    std::thread worker;
+
+    void run(std::vector<std::string> dirs);
+    void loadIndex();
+    void saveIndex() const;
+    void stop();
+};
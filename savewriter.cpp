@@ -0,0 +1,137 @@
+#include "savewriter.h"
+
+#include <cstdio>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool writeFileAtomic(const std::string& path, const std::vector<uint8_t>& data) {
+    std::string tmp = path + ".tmp";
+#ifdef _WIN32
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size() &&
+              std::fflush(f) == 0 && _commit(_fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (ok) ok = MoveFileExA(tmp.c_str(), path.c_str(),
+                             MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    size_t done = 0;
+    while (ok && done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) ok = false;
+        else done += static_cast<size_t>(n);
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (ok) {
+        // Make the rename itself durable.
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dfd = ::open(dir.c_str(), O_RDONLY);
+        if (dfd >= 0) {
+            ::fsync(dfd);
+            ::close(dfd);
+        }
+    }
+#endif
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+}
+
+SaveWriter& SaveWriter::instance() {
+    static SaveWriter writer;
+    return writer;
+}
+
+SaveWriter::~SaveWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+void SaveWriter::submit(const std::string& path, std::vector<uint8_t> data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The deadline runs from the first unwritten change, so a game that
+        // saves every frame still reaches disk once per debounce window.
+        auto it = pending.find(path);
+        if (it == pending.end()) it = pending.emplace(path, Pending{{}, clock::now() + debounce}).first;
+        it->second.data = std::move(data);
+        if (!worker.joinable()) worker = std::thread(&SaveWriter::run, this);
+    }
+    wake.notify_all();
+}
+
+bool SaveWriter::idleFor(const std::string* path) const {
+    if (!path) return pending.empty() && inFlight.empty();
+    return pending.find(*path) == pending.end() && inFlight != *path;
+}
+
+void SaveWriter::flush(const std::string& path) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = pending.find(path);
+    if (it != pending.end()) it->second.due = clock::now();
+    wake.notify_all();
+    done.wait(lock, [&] { return idleFor(&path); });
+}
+
+void SaveWriter::flushAll() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto& p : pending) p.second.due = clock::now();
+    wake.notify_all();
+    done.wait(lock, [&] { return idleFor(nullptr); });
+}
+
+void SaveWriter::setDebounce(std::chrono::milliseconds d) {
+    std::lock_guard<std::mutex> lock(mutex);
+    debounce = d;
+}
+
+void SaveWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (pending.empty()) {
+            if (stopping) return;
+            wake.wait(lock);
+            continue;
+        }
+        auto next = pending.begin();
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            if (it->second.due < next->second.due) next = it;
+        }
+        if (!stopping && next->second.due > clock::now()) {
+            wake.wait_until(lock, next->second.due);
+            continue;
+        }
+
+        inFlight = next->first;
+        std::vector<uint8_t> data = std::move(next->second.data);
+        pending.erase(next);
+        lock.unlock();
+        // One write per line so output from other threads can't split it.
+        if (writeFileAtomic(inFlight, data)) {
+            std::cout << "Saved: " + inFlight + " (" + std::to_string(data.size()) + " bytes)\n"
+                      << std::flush;
+        } else {
+            std::cerr << "Failed writing save: " + inFlight + '\n';
+        }
+        lock.lock();
+        inFlight.clear();
+        done.notify_all();
+    }
+}
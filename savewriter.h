@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes battery saves off the emulation thread. submit() only copies the
+// data into a queue; a worker thread writes it after a short debounce, so
+// a burst of saves costs one write. Each write goes to a temp
+// file that is fsynced and renamed over the old save, so a crash leaves
+// either the previous or the new save, never a torn one.
+class SaveWriter {
+public:
+    static SaveWriter& instance();
+    ~SaveWriter();
+
+    // Queue `data` for `path`, replacing anything still pending for it.
+    void submit(const std::string& path, std::vector<uint8_t> data);
+    // Block until nothing for `path` (or for any path) is queued or in flight.
+    void flush(const std::string& path);
+    void flushAll();
+
+    void setDebounce(std::chrono::milliseconds d);
+
+private:
+    using clock = std::chrono::steady_clock;
+    struct Pending {
+        std::vector<uint8_t> data;
+        clock::time_point due;
+    };
+
+    SaveWriter() = default;
+    void run();
+    bool idleFor(const std::string* path) const; // needs `mutex`
+
+    std::mutex mutex;
+    std::condition_variable wake; // new work, a flush request or shutdown
+    std::condition_variable done; // a write finished
+    std::map<std::string, Pending> pending;
+    std::string inFlight;
+    std::chrono::milliseconds debounce{500};
+    bool stopping = false;
+    std::thread worker;
+};
+
+// Replace `path` with `data` via temp file + fsync + rename.
+bool writeFileAtomic(const std::string& path, const std::vector<uint8_t>& data);
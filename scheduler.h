@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Cycle-timestamped events for the subsystems that change CPU-visible state
+// on their own (timer overflow, OAM DMA and serial completion, PPU mode
+// changes). The core runs the CPU until the earliest pending event and only then lets
+// those subsystems catch up; in between they sync lazily when the CPU
+// touches one of their registers.
+class Scheduler {
+public:
+    // Events due at the same instruction boundary are processed in this
+    // order, matching the old per-instruction update order.
+    enum class Event { Timer, Dma, Ppu, Serial, Count };
+
+    static constexpr uint64_t NEVER = ~uint64_t(0);
+
+    uint64_t now        = 0; // cycles elapsed after the last instruction
+    uint64_t instrStart = 0; // cycles elapsed when the current instruction began
+
+    void reset() {
+        now = 0;
+        instrStart = 0;
+        for (auto& t : at) t = NEVER;
+        next = NEVER;
+    }
+
+    void schedule(Event e, uint64_t when) {
+        at[static_cast<int>(e)] = when;
+        recompute();
+    }
+    void cancel(Event e) { schedule(e, NEVER); }
+
+    uint64_t nextEvent() const { return next; }
+
+private:
+    static constexpr int COUNT = static_cast<int>(Event::Count);
+
+    uint64_t at[COUNT] = { NEVER, NEVER, NEVER, NEVER };
+    uint64_t next = NEVER;
+
+    void recompute() {
+        next = at[0];
+        for (int i = 1; i < COUNT; ++i) {
+            if (at[i] < next) next = at[i];
+        }
+    }
+};
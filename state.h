@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+
+// Stream buffers over plain memory so the components' saveState/loadState
+// can serialize without a file or an allocating stringstream.
+
+// Appends to a caller-owned vector; clear() keeps its capacity, so reuse
+// does not allocate once the vector has grown to the largest chunk.
+class VectorWriteBuf : public std::streambuf {
+public:
+    explicit VectorWriteBuf(std::vector<uint8_t>& v) : out(v) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+        out.push_back(static_cast<uint8_t>(ch));
+        return ch;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(s);
+        out.insert(out.end(), p, p + n);
+        return n;
+    }
+
+private:
+    std::vector<uint8_t>& out;
+};
+
+// Reads from a fixed byte range.
+class SpanReadBuf : public std::streambuf {
+public:
+    SpanReadBuf(const uint8_t* data, size_t size) {
+        char* p = const_cast<char*>(reinterpret_cast<const char*>(data));
+        setg(p, p, p + size);
+    }
+};
@@ -0,0 +1,251 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace trace {
+
+thread_local Ring ring{};
+thread_local Coverage coverage{};
+
+namespace {
+thread_local std::vector<uint8_t> romCounts;
+thread_local uint32_t attachedRun = 0;
+
+// Longest line formatEntry() writes: bank, address, opcode, cycles and a
+// symbol cut to SYMBOL_MAX characters.
+constexpr size_t SYMBOL_MAX = 96;
+constexpr size_t LINE_MAX = 32 + SYMBOL_MAX;
+
+// Hex with at least `digits` digits, upper case, no allocation.
+char* putHex(char* p, unsigned v, int digits) {
+    char tmp[8];
+    int n = 0;
+    do {
+        tmp[n++] = "0123456789ABCDEF"[v & 0xF];
+        v >>= 4;
+    } while (v && n < 8);
+    while (n < digits) tmp[n++] = '0';
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+// Where code at (bank, addr) is counted, or nullptr outside the ROM.
+const uint8_t* hitsAt(int bank, uint32_t addr) {
+    if (addr >= 0x8000) return &coverage.ram[(addr - 0x8000) % RAM_SLOTS];
+    size_t off = addr < 0x4000 ? addr : size_t(bank) * 0x4000 + (addr - 0x4000);
+    return off < coverage.romSize ? &coverage.rom[off] : nullptr;
+}
+
+// One ring line, as written by writeRing() and the crash handler.
+size_t formatEntry(const Entry& e, const SymbolTable* symbols, char* out) {
+    char* p = out;
+    p = putHex(p, e.bank, 2);
+    *p++ = ':';
+    p = putHex(p, e.pc, 4);
+    *p++ = ' ';
+    p = putHex(p, e.opcode, 2);
+    *p++ = ' ';
+    int c = e.cycles;
+    if (c >= 10) *p++ = char('0' + c / 10);
+    *p++ = char('0' + c % 10);
+    if (symbols && symbols->lookup(e.bank, e.pc, p + 1, SYMBOL_MAX)) {
+        *p = ' ';
+        p += 1 + std::strlen(p + 1);
+    }
+    *p++ = '\n';
+    return size_t(p - out);
+}
+
+// Calls `emit(line, length)` for every entry in the ring, oldest first.
+template <typename Emit>
+void forEachLine(const SymbolTable* symbols, Emit emit) {
+    uint64_t end = ring.count;
+    uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+    char line[LINE_MAX];
+    for (uint64_t i = begin; i < end; ++i) {
+        emit(line, formatEntry(ring.entries[i & (RING_SIZE - 1)], symbols, line));
+    }
+}
+
+void put16(std::string& out, unsigned v) {
+    out.push_back(char(v & 0xFF));
+    out.push_back(char(v >> 8));
+}
+
+// One run per stretch of executed addresses in [begin, end) of `bank`.
+void appendRuns(std::string& out, int bank, uint32_t begin, uint32_t end, int fileBank) {
+    for (uint32_t a = begin; a < end;) {
+        const uint8_t* h = hitsAt(bank, a);
+        if (!h) return;
+        if (*h == 0) {
+            ++a;
+            continue;
+        }
+        uint32_t start = a;
+        while (a < end && *hitsAt(bank, a) != 0) ++a;
+        put16(out, unsigned(fileBank));
+        put16(out, start);
+        put16(out, a - start);
+        for (uint32_t i = start; i < a; ++i) out.push_back(char(*hitsAt(bank, i)));
+    }
+}
+}
+
+uint32_t newRun() {
+    static std::atomic<uint32_t> last{0};
+    return ++last;
+}
+
+void attach(uint32_t run, size_t romSize) {
+    if (run == attachedRun) return;
+    attachedRun = run;
+    ring.count = 0;
+    romCounts.assign(enabled ? romSize : 0, 0);
+    coverage.rom = romCounts.data();
+    coverage.romSize = romCounts.size();
+    std::memset(coverage.ram, 0, sizeof(coverage.ram));
+}
+
+bool SymbolTable::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    symbols.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t semi = line.find(';');
+        if (semi != std::string::npos) line.resize(semi);
+        std::istringstream fields(line);
+        std::string where, name;
+        if (!(fields >> where >> name)) continue;
+        size_t colon = where.find(':');
+        if (colon == std::string::npos) continue;
+        char* end = nullptr;
+        unsigned long bank = std::strtoul(where.c_str(), &end, 16);
+        if (end != where.c_str() + colon) continue;
+        unsigned long addr = std::strtoul(where.c_str() + colon + 1, &end, 16);
+        if (*end != '\0' || bank > 0xFFFF || addr > 0xFFFF) continue;
+        // ROM0 and RAM labels may come with any bank; only ROMX has real ones.
+        if (addr < 0x4000 || addr >= 0x8000) bank = 0;
+        symbols.push_back({ uint32_t(bank << 16 | addr), name });
+    }
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](const Symbol& a, const Symbol& b) { return a.key < b.key; });
+    return true;
+}
+
+bool SymbolTable::lookup(int bank, uint16_t addr, char* out, size_t capacity) const {
+    if (capacity == 0) return false;
+    if (addr < 0x4000 || addr >= 0x8000) bank = 0;
+    uint32_t key = uint32_t(bank) << 16 | addr;
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), key,
+                               [](uint32_t k, const Symbol& s) { return k < s.key; });
+    if (it == symbols.begin()) return false;
+    const Symbol& s = *--it;
+    uint16_t base = uint16_t(s.key & 0xFFFF);
+    if ((s.key >> 16) != uint32_t(bank)) return false;
+    // Never name RAM code after a ROM label, or one RAM area after another.
+    if ((base >= 0x8000) != (addr >= 0x8000)) return false;
+    if (addr >= 0x8000 && (base >> 13) != (addr >> 13)) return false;
+
+    size_t n = std::min(s.name.size(), capacity - 1);
+    std::memcpy(out, s.name.data(), n);
+    if (addr != base && n + 8 < capacity) {
+        char* p = out + n;
+        *p++ = '+';
+        *p++ = '0';
+        *p++ = 'x';
+        p = putHex(p, unsigned(addr - base), 1);
+        n = size_t(p - out);
+    }
+    out[n] = '\0';
+    return true;
+}
+
+bool writeRing(const std::string& path, const SymbolTable* symbols) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    forEachLine(symbols, [&](const char* line, size_t n) { std::fwrite(line, 1, n, f); });
+    return std::fclose(f) == 0;
+}
+
+bool writeCoverage(const std::string& path) {
+    std::string out = "GBCV";
+    out.push_back(1); // version
+    out.append(3, '\0');
+    size_t banks = (coverage.romSize + 0x3FFF) / 0x4000;
+    for (size_t b = 0; b < banks; ++b) {
+        if (b == 0) appendRuns(out, 0, 0x0000, 0x4000, 0);
+        else        appendRuns(out, int(b), 0x4000, 0x8000, int(b));
+    }
+    appendRuns(out, 0, 0x8000, 0x10000, 0xFFFF);
+    std::ofstream f(path, std::ios::binary);
+    f.write(out.data(), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(f);
+}
+
+bool writeCoverageSummary(const std::string& path, const SymbolTable& symbols) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    const auto& all = symbols.all();
+    for (size_t i = 0; i < all.size(); ++i) {
+        int bank = int(all[i].key >> 16);
+        uint32_t begin = all[i].key & 0xFFFF;
+        // Up to the next label in the same bank, within the label's area.
+        uint32_t end = begin < 0x4000 ? 0x4000 : begin < 0x8000 ? 0x8000 : 0x10000;
+        if (i + 1 < all.size() && int(all[i + 1].key >> 16) == bank) {
+            end = std::min(end, all[i + 1].key & 0xFFFF);
+        }
+        unsigned ran = 0;
+        for (uint32_t a = begin; a < end; ++a) {
+            const uint8_t* h = hitsAt(bank, a);
+            if (!h) break;
+            if (*h) ++ran;
+        }
+        if (ran) std::fprintf(f, "%02X:%04X %s %u\n", unsigned(bank), unsigned(begin),
+                              all[i].name.c_str(), ran);
+    }
+    return std::fclose(f) == 0;
+}
+
+#ifdef _WIN32
+void dumpOnCrash(const std::string&, const SymbolTable*) {}
+#else
+namespace {
+char crashPath[4096];
+const SymbolTable* crashSymbols = nullptr;
+
+void onCrash(int sig) {
+    // Only async-signal-safe calls from here: no stdio, no allocation.
+    int fd = ::open(crashPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        forEachLine(crashSymbols, [fd](const char* line, size_t n) {
+            ssize_t ignored = ::write(fd, line, n);
+            (void)ignored;
+        });
+        ::close(fd);
+    }
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+}
+
+void dumpOnCrash(const std::string& path, const SymbolTable* symbols) {
+    if (path.size() >= sizeof(crashPath)) return;
+    std::memcpy(crashPath, path.c_str(), path.size() + 1);
+    crashSymbols = symbols;
+    for (int sig : { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT }) std::signal(sig, onCrash);
+}
+#endif
+
+} // namespace trace
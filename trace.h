@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Execution trace and code coverage. The hook in CPU::step only exists in
+// builds made with `make TRACE=1` (-DGB_TRACING); otherwise GB_TRACE expands
+// to nothing and the core is unchanged. Like the profiler's counters, the
+// ring and coverage are per thread.
+namespace trace {
+
+#ifdef GB_TRACING
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// One executed instruction. `bank` is the ROM bank mapped at 0x4000-0x7FFF
+// for code there, and 0 for code anywhere else.
+struct Entry {
+    uint16_t pc;
+    uint16_t bank;
+    uint8_t  opcode;
+    uint8_t  cycles;
+};
+
+// The last RING_SIZE instructions. Recording is one store and one index
+// bump with no lock; only the thread that runs the core writes it, and a
+// dump on that thread (hotkey, exit, crash handler) reads it in place.
+// Builds without tracing keep a token size so no thread pays for it.
+constexpr size_t RING_SIZE = enabled ? size_t(1) << 16 : 1;
+struct Ring {
+    Entry    entries[RING_SIZE];
+    uint64_t count; // instructions recorded since attach() last cleared it
+};
+extern thread_local Ring ring;
+
+// Saturating 8-bit execution counts per instruction start: one per ROM
+// byte, indexed by file offset, and one per address in 0x8000-0xFFFF for
+// code run from RAM.
+constexpr size_t RAM_SLOTS = enabled ? 0x8000 : 1;
+struct Coverage {
+    uint8_t* rom;   // romSize counts, owned by trace.cpp
+    size_t   romSize;
+    uint8_t  ram[RAM_SLOTS];
+};
+extern thread_local Coverage coverage;
+
+// Each loaded ROM gets a run id (Core::loadROM). The core attaches its run
+// at the start of every frame, which clears this thread's ring and counts
+// when the thread last ran something else; loading on one thread and
+// running on another (the windowed frontend) then just works.
+uint32_t newRun();
+void attach(uint32_t run, size_t romSize);
+
+inline void record(uint16_t pc, int bank, uint8_t opcode, int cycles) {
+    ring.entries[ring.count++ & (RING_SIZE - 1)] =
+        Entry{ pc, uint16_t(bank), opcode, uint8_t(cycles) };
+    uint8_t* hits;
+    if (pc >= 0x8000) {
+        hits = &coverage.ram[(pc - 0x8000) % RAM_SLOTS];
+    } else {
+        size_t off = pc < 0x4000 ? pc : size_t(bank) * 0x4000 + (pc - 0x4000);
+        if (off >= coverage.romSize) return;
+        hits = &coverage.rom[off];
+    }
+    if (*hits != 0xFF) ++*hits;
+}
+
+// Labels from an RGBDS-style .sym file: one "BB:AAAA Name" per line, ';'
+// starting a comment.
+class SymbolTable {
+public:
+    bool load(const std::string& path);
+    bool empty() const { return symbols.empty(); }
+    // Writes the nearest label at or before (bank, addr), as "Name" or
+    // "Name+0x1F", into `out` (NUL-terminated, cut to `capacity`). Labels
+    // only match within their own bank; below 0x4000 and in RAM the bank
+    // is 0. Does not allocate, so the crash handler can use it.
+    bool lookup(int bank, uint16_t addr, char* out, size_t capacity) const;
+
+    struct Symbol {
+        uint32_t    key; // bank << 16 | address
+        std::string name;
+    };
+    const std::vector<Symbol>& all() const { return symbols; }
+
+private:
+    std::vector<Symbol> symbols; // sorted by key
+};
+
+// The ring, oldest first, one "BB:AAAA op cycles symbol" line each.
+bool writeRing(const std::string& path, const SymbolTable* symbols = nullptr);
+
+// Coverage as a compact binary file: "GBCV", a version byte and three
+// reserved bytes, then one run per stretch of executed addresses:
+// bank, start address and length (uint16 little-endian each) followed by
+// `length` counts. ROM runs use their bank number (0 for 0x0000-0x3FFF),
+// RAM runs bank 0xFFFF.
+bool writeCoverage(const std::string& path);
+// One "BB:AAAA name instructions" line per label that ran, counting the
+// distinct instruction addresses executed before the next label.
+bool writeCoverageSummary(const std::string& path, const SymbolTable& symbols);
+
+// On SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT, write the crashing
+// thread's ring to `path` in writeRing()'s format, then let the signal
+// take its default action. The handler sticks to open() and write(); the
+// file is only created if a crash happens. No-op on Windows.
+void dumpOnCrash(const std::string& path, const SymbolTable* symbols = nullptr);
+
+} // namespace trace
+
+#ifdef GB_TRACING
+#define GB_TRACE(stmt) do { stmt; } while (0)
+#else
+#define GB_TRACE(stmt) do {} while (0)
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer handoff of the latest value.
+// The producer fills writeSlot() and publish()es it; the consumer calls
+// update() and, if it returns true, reads the newest value from readSlot().
+// Neither side ever waits for the other: a producer that runs ahead simply
+// overwrites frames the consumer never saw.
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer side.
+    T&   writeSlot() { return slots[writeIdx]; }
+    void publish() {
+        writeIdx = shared.exchange(writeIdx | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Consumer side.
+    bool hasUpdate() const { return (shared.load(std::memory_order_acquire) & FRESH) != 0; }
+    bool update() {
+        if (!hasUpdate()) return false;
+        readIdx = shared.exchange(readIdx, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& readSlot() const { return slots[readIdx]; }
+
+private:
+    static constexpr uint8_t INDEX = 0x03;
+    static constexpr uint8_t FRESH = 0x04; // shared slot holds an unread value
+
+    T slots[3]{};
+    alignas(64) std::atomic<uint8_t> shared{1};
+    alignas(64) uint8_t writeIdx = 0; // producer only
+    alignas(64) uint8_t readIdx  = 2; // consumer only
+};
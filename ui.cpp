@@ -29,7 +29,7 @@ constexpr SDL_Color rgbaToSdl(uint32_t c) {
 }
 }
 
-UI::UI(SDL_Renderer* r) : renderer(r) {
+UI::UI(SDL_Renderer* r) : renderer(r), indexer("romindex.tsv") {
     buildFontTexture();
     rescanRoms();
 }
@@ -109,28 +109,36 @@ std::string UI::basename(const std::string& path) {
 }
 
 void UI::rescanRoms() {
-    romList.clear();
+    library.clear();
+    visible.clear();
+    browserSel = 0;
     std::error_code ec;
-    auto isRom = [](const fs::path& p) {
-        if (!p.has_extension()) return false;
-        auto ext = p.extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        return ext == ".gb" || ext == ".gbc";
-    };
-    auto scan = [&](const fs::path& dir) {
-        if (!fs::exists(dir, ec) || !fs::is_directory(dir, ec)) return;
-        for (auto& entry : fs::directory_iterator(dir, ec)) {
-            if (ec) break;
-            if (entry.is_regular_file(ec) && isRom(entry.path())) {
-                romList.push_back(entry.path().string());
-            }
-        }
-    };
-    scan(fs::current_path(ec));
-    scan(fs::current_path(ec) / "roms");
-    std::sort(romList.begin(), romList.end());
-    romList.erase(std::unique(romList.begin(), romList.end()), romList.end());
+    fs::path cwd = fs::current_path(ec);
+    indexer.scan({ cwd.string(), (cwd / "roms").string() });
+}
+
+void UI::pullIndexed() {
+    if (indexer.poll(library) == 0) return;
+    std::string selected = browserSel < int(visible.size()) ? library[visible[browserSel]].path : "";
+    std::sort(library.begin(), library.end(),
+              [](const RomInfo& a, const RomInfo& b) { return a.path < b.path; });
+    refreshVisible();
+    // Keep the cursor on the same ROM while more arrive above it.
+    for (int i = 0; i < int(visible.size()); ++i) {
+        if (library[visible[i]].path == selected) browserSel = i;
+    }
+}
+
+void UI::refreshVisible() {
+    visible.clear();
+    for (int i = 0; i < int(library.size()); ++i) {
+        const RomInfo& rom = library[i];
+        if (browserFilter == RomFilter::Monochrome && rom.isColorOnly()) continue;
+        if (browserFilter == RomFilter::Battery && !rom.hasBattery()) continue;
+        if (rom.matches(browserQuery)) visible.push_back(i);
+    }
+    int N = static_cast<int>(visible.size());
+    browserSel = std::max(0, std::min(browserSel, N - 1));
 }
 
 void UI::openTitleMenu() {
@@ -151,6 +159,31 @@ void UI::closeMenu() {
     current = Screen::None;
 }
 
+void UI::toggleProfiler() {
+    if (current == Screen::Profiler) {
+        current = Screen::None;
+        return;
+    }
+    if (current != Screen::None) return;
+    current = Screen::Profiler;
+    profBaseTicks = 0; // restart the window
+    profWindowSec = 0.0;
+}
+
+void UI::setProfile(const prof::Counters& c) {
+    Uint32 now = SDL_GetTicks();
+    if (profBaseTicks == 0) {
+        profBase = c;
+        profBaseTicks = now;
+        return;
+    }
+    if (now - profBaseTicks < PROFILE_WINDOW_MS) return;
+    profWindow = prof::difference(c, profBase);
+    profWindowSec = (now - profBaseTicks) / 1000.0;
+    profBase = c;
+    profBaseTicks = now;
+}
+
 void UI::toast(const std::string& msg, double durationSec) {
     toastMsg = msg;
     toastEnd = SDL_GetTicks() + static_cast<Uint32>(durationSec * 1000.0);
@@ -168,6 +201,7 @@ bool UI::handleKey(SDL_Keycode key) {
         case Screen::RomBrowser:  handleKeyBrowser(key);  return true;
         case Screen::InGameMenu:  handleKeyInGame(key);   return true;
         case Screen::Settings:    handleKeySettings(key); return true;
+        case Screen::Profiler:    return false;
         case Screen::None:        return false;
     }
     return false;
@@ -197,7 +231,7 @@ void UI::handleKeyTitle(SDL_Keycode key) {
 }
 
 void UI::handleKeyBrowser(SDL_Keycode key) {
-    int N = static_cast<int>(romList.size());
+    int N = static_cast<int>(visible.size());
     switch (key) {
         case SDLK_UP:
             if (N > 0) browserSel = (browserSel + N - 1) % N;
@@ -209,23 +243,49 @@ void UI::handleKeyBrowser(SDL_Keycode key) {
             browserSel = std::max(0, browserSel - 10);
             break;
         case SDLK_PAGEDOWN:
-            browserSel = std::min(N - 1, browserSel + 10);
+            browserSel = std::max(0, std::min(N - 1, browserSel + 10));
             break;
         case SDLK_HOME:    browserSel = 0; break;
         case SDLK_END:     browserSel = std::max(0, N - 1); break;
-        case SDLK_F5:      rescanRoms(); browserSel = 0; break;
+        case SDLK_F5:      rescanRoms(); break;
+        case SDLK_TAB:
+            browserFilter = RomFilter((int(browserFilter) + 1) % int(RomFilter::COUNT));
+            refreshVisible();
+            break;
         case SDLK_RETURN:
         case SDLK_KP_ENTER:
             if (browserSel >= 0 && browserSel < N) {
-                pending.loadRomPath = romList[browserSel];
+                pending.loadRomPath = library[visible[browserSel]].path;
                 current = Screen::None;
             }
             break;
         case SDLK_BACKSPACE:
+            if (!browserQuery.empty()) {
+                browserQuery.pop_back();
+                refreshVisible();
+            } else {
+                current = Screen::TitleMenu;
+            }
+            break;
         case SDLK_ESCAPE:
-            current = Screen::TitleMenu;
+            if (!browserQuery.empty()) {
+                browserQuery.clear();
+                refreshVisible();
+            } else {
+                current = Screen::TitleMenu;
+            }
+            break;
+        default:
+            // Typing narrows the list by file name or header title.
+            if ((key >= SDLK_a && key <= SDLK_z) || (key >= SDLK_0 && key <= SDLK_9) ||
+                key == SDLK_SPACE || key == SDLK_MINUS || key == SDLK_PERIOD) {
+                if (browserQuery.size() < 24) {
+                    browserQuery += static_cast<char>(key);
+                    browserSel = 0;
+                    refreshVisible();
+                }
+            }
             break;
-        default: break;
     }
 }
 
@@ -309,12 +369,15 @@ void UI::render(SDL_Texture* gameTexture, int winW, int winH) {
         case Screen::RomBrowser: renderBrowser(winW, winH); break;
         case Screen::InGameMenu: renderInGame(winW, winH); break;
         case Screen::Settings:   renderSettings(winW, winH); break;
+        case Screen::Profiler:   renderProfiler(winW, winH); break;
         case Screen::None:       break;
     }
 
     renderToast(winW, winH);
 
-    if (current == Screen::None && fastForwardView && romLoaded) {
+    if (!isMenuOpen() && rewindView && romLoaded) {
+        drawText(winW - textWidth("<<", 2) - 16, 12, "<<", COLOR_TEXT_HL, 2);
+    } else if (!isMenuOpen() && fastForwardView && romLoaded) {
         drawText(winW - textWidth(">>", 2) - 16, 12, ">>", COLOR_TEXT_HL, 2);
     }
 
@@ -351,6 +414,8 @@ void UI::renderTitle(int w, int h) {
 }
 
 void UI::renderBrowser(int w, int h) {
+    pullIndexed();
+
     const int panelW = std::min(760, w - 40);
     const int panelH = std::min(540, h - 40);
     const int px = (w - panelW) / 2;
@@ -360,35 +425,56 @@ void UI::renderBrowser(int w, int h) {
     const std::string title = "SELECT ROM";
     drawText(px + 20, py + 16, title, COLOR_TITLE, 2);
 
+    static const char* const filterNames[] = { "ALL", "NO COLOR-ONLY", "BATTERY SAVES" };
+    char status[96];
+    SDL_snprintf(status, sizeof(status), "%s  %d/%d%s", filterNames[int(browserFilter)],
+                 int(visible.size()), int(library.size()), indexer.scanning() ? "  SCANNING..." : "");
+    drawText(px + panelW - 20 - textWidth(status, 1), py + 20, status, COLOR_TEXT_DIM, 1);
+    if (!browserQuery.empty()) {
+        drawText(px + 20, py + 40, "SEARCH: " + browserQuery + "_", COLOR_TEXT_HL, 1);
+    }
+
     int listX = px + 20;
     int listY = py + 60;
     int rowH = 24;
     int rows = (panelH - 100) / rowH;
-    int N = static_cast<int>(romList.size());
+    int N = static_cast<int>(visible.size());
 
-    if (N == 0) {
+    if (library.empty() && indexer.scanning()) {
+        drawText(listX, listY, "SCANNING FOR ROMS...", COLOR_TEXT_DIM, 2);
+    } else if (library.empty()) {
         drawText(listX, listY,
                  "NO .GB FILES FOUND IN CURRENT DIRECTORY",
                  COLOR_TEXT_DIM, 2);
         drawText(listX, listY + 40,
                  "PLACE ROMS HERE OR IN ./ROMS/ AND PRESS F5",
                  COLOR_TEXT_DIM, 1);
+    } else if (N == 0) {
+        drawText(listX, listY, "NO MATCHES", COLOR_TEXT_DIM, 2);
     } else {
         if (browserSel < browserScroll) browserScroll = browserSel;
         if (browserSel >= browserScroll + rows) browserScroll = browserSel - rows + 1;
+        browserScroll = std::max(0, std::min(browserScroll, std::max(0, N - rows)));
 
         for (int i = 0; i < rows; ++i) {
             int idx = browserScroll + i;
             if (idx >= N) break;
+            const RomInfo& rom = library[visible[idx]];
             bool selected = (idx == browserSel);
-            std::string name = basename(romList[idx]);
+            std::string name = basename(rom.path);
             std::string line = (selected ? "> " : "  ") + name;
             uint32_t col = selected ? COLOR_TEXT_HL : COLOR_TEXT;
             drawText(listX, listY + i * rowH, line, col, 2);
+            // Header title on the right, unless the name already runs into it.
+            int titleW = textWidth(rom.title, 1);
+            int titleX = px + panelW - 20 - titleW;
+            if (!rom.title.empty() && titleX > listX + textWidth(line, 2) + 16) {
+                drawText(titleX, listY + i * rowH + 4, rom.title, COLOR_TEXT_DIM, 1);
+            }
         }
     }
 
-    const std::string foot = "ENTER LOAD   ESC BACK   F5 RESCAN";
+    const std::string foot = "ENTER LOAD   ESC BACK   TYPE TO SEARCH   TAB FILTER   F5 RESCAN";
     int fw = textWidth(foot, 1);
     drawText(px + (panelW - fw) / 2, py + panelH - 24, foot, COLOR_TEXT_DIM, 1);
 }
@@ -469,6 +555,91 @@ void UI::renderSettings(int w, int h) {
     drawText(px + (panelW - fw) / 2, py + panelH - 24, foot, COLOR_TEXT_DIM, 1);
 }
 
+void UI::renderProfiler(int w, int h) {
+    (void)h;
+    const int panelW = std::min(520, w - 20);
+    const int px = 10, py = 10;
+    const int rowH = 12;
+    char buf[128];
+
+    if (!prof::enabled) {
+        drawPanel(px, py, panelW, 56);
+        drawText(px + 12, py + 10, "PROFILER", COLOR_TITLE, 1);
+        drawText(px + 12, py + 30, "BUILD WITH MAKE PROFILE=1", COLOR_TEXT_DIM, 1);
+        return;
+    }
+
+    const prof::Counters& c = profWindow;
+    const double sec = profWindowSec;
+    const int panelH = 14 * rowH + 24;
+    drawPanel(px, py, panelW, panelH);
+    int y = py + 10;
+    auto line = [&](uint32_t col) { drawText(px + 12, y, buf, col, 1); y += rowH; };
+
+    SDL_snprintf(buf, sizeof(buf), "PROFILER  F3 CLOSE");
+    line(COLOR_TITLE);
+    if (sec <= 0.0) {
+        SDL_snprintf(buf, sizeof(buf), "SAMPLING...");
+        line(COLOR_TEXT_DIM);
+        return;
+    }
+
+    auto perCall = [&](prof::Section s) {
+        return c.sectionCalls[s] ? double(c.sectionNs[s]) / double(c.sectionCalls[s]) : 0.0;
+    };
+    const uint64_t framesRun = c.sectionCalls[prof::Frame];
+    const double perFrame = framesRun ? 1.0 / double(framesRun) : 0.0;
+
+    SDL_snprintf(buf, sizeof(buf), "FRAMES %5.1f/S   HOST %6.3f MS/FRAME",
+                 framesRun / sec, perCall(prof::Frame) / 1e6);
+    line(COLOR_TEXT);
+    SDL_snprintf(buf, sizeof(buf), "PPU    %6.3f MS/FRAME  %5.2f US/LINE",
+                 c.sectionNs[prof::Scanline] * perFrame / 1e6, perCall(prof::Scanline) / 1e3);
+    line(COLOR_TEXT);
+    SDL_snprintf(buf, sizeof(buf), "APU    %6.3f MS/FRAME",
+                 c.sectionNs[prof::Apu] * perFrame / 1e6);
+    line(COLOR_TEXT);
+
+    uint64_t instr = 0;
+    for (uint64_t n : c.opcodes) instr += n;
+    SDL_snprintf(buf, sizeof(buf), "CPU    %6.2f MINSTR/S  HALT %4.1f%%",
+                 instr / sec / 1e6, c.cycles ? 100.0 * c.haltCycles / c.cycles : 0.0);
+    line(COLOR_TEXT);
+
+    // Hottest opcodes; CB-prefixed ones are listed as CBxx.
+    int top[5];
+    int nTop = 0;
+    bool used[512] = {};
+    auto countOf = [&](int i) { return i < 256 ? c.opcodes[i] : c.cbOpcodes[i - 256]; };
+    for (; nTop < 5; ++nTop) {
+        int best = -1;
+        for (int i = 0; i < 512; ++i) {
+            if (!used[i] && countOf(i) && (best < 0 || countOf(i) > countOf(best))) best = i;
+        }
+        if (best < 0) break;
+        used[best] = true;
+        top[nTop] = best;
+    }
+    for (int i = 0; i < nTop; ++i) {
+        int op = top[i];
+        SDL_snprintf(buf, sizeof(buf), "  %s%02X  %5.1f%%", op < 256 ? "  " : "CB", op & 0xFF,
+                     instr ? 100.0 * countOf(op) / instr : 0.0);
+        line(COLOR_TEXT_DIM);
+    }
+
+    SDL_snprintf(buf, sizeof(buf), "MEMORY  READS/S   WRITES/S");
+    line(COLOR_TEXT);
+    for (int r = 0; r < prof::REGION_COUNT; r += 3) {
+        int n = 0;
+        for (int k = r; k < r + 3 && k < prof::REGION_COUNT; ++k) {
+            n += SDL_snprintf(buf + n, sizeof(buf) - n, "  %-4s %5.2fM/%5.2fM",
+                              prof::regionName(prof::Region(k)),
+                              c.reads[k] / sec / 1e6, c.writes[k] / sec / 1e6);
+        }
+        line(COLOR_TEXT_DIM);
+    }
+}
+
 void UI::renderToast(int w, int h) {
     if (toastMsg.empty()) return;
     Uint32 now = SDL_GetTicks();
@@ -5,6 +5,9 @@
 #include <vector>
 #include <cstdint>
 
+#include "profile.h"
+#include "romindex.h"
+
 class UI {
 public:
     enum class Screen {
@@ -13,6 +16,7 @@ public:
         RomBrowser,  // file picker
         InGameMenu,  // pause overlay
         Settings,    // settings page
+        Profiler,    // performance counters over the running game
     };
 
     struct Action {
@@ -33,11 +37,13 @@ public:
     ~UI();
 
     Screen screen() const { return current; }
-    bool   isMenuOpen() const { return current != Screen::None; }
+    // The profiler overlay is not a menu: the game keeps running under it.
+    bool   isMenuOpen() const { return current != Screen::None && current != Screen::Profiler; }
 
     void openTitleMenu();
     void openInGameMenu();
     void closeMenu();
+    void toggleProfiler();
 
     bool handleKey(SDL_Keycode key);
 
@@ -55,6 +61,10 @@ public:
     void setRomLoaded(bool b)         { romLoaded = b; }
     void setPaletteName(const std::string& s) { paletteName = s; }
     void setFastForwardView(bool f)   { fastForwardView = f; }
+    void setRewindView(bool r)        { rewindView = r; }
+    // Latest counters from the emulation thread; the overlay shows the
+    // difference over each PROFILE_WINDOW_MS.
+    void setProfile(const prof::Counters& c);
 
 private:
     SDL_Renderer* renderer = nullptr;
@@ -69,6 +79,7 @@ private:
     bool fullscreenView = false;
     bool romLoaded = false;
     bool fastForwardView = false;
+    bool rewindView = false;
     std::string paletteName = "GREEN";
 
     int titleSel = 0;
@@ -77,12 +88,27 @@ private:
     int ingameSel = 0;
     int settingsSel = 0;
 
-    std::vector<std::string> romList;
+    // The browser's library streams in from the background indexer; the
+    // visible rows are the entries passing the search text and filter.
+    enum class RomFilter { All, Monochrome, Battery, COUNT };
+    RomIndexer           indexer;
+    std::vector<RomInfo> library;   // sorted by path
+    std::vector<int>     visible;   // indices into library
+    std::string          browserQuery;
+    RomFilter            browserFilter = RomFilter::All;
+
+    static constexpr Uint32 PROFILE_WINDOW_MS = 1000;
+    prof::Counters profBase{};   // counters at the start of the window
+    prof::Counters profWindow{}; // change over the last full window
+    Uint32 profBaseTicks = 0;
+    double profWindowSec = 0.0;
 
     std::string toastMsg;
     Uint32 toastEnd = 0;
 
     void rescanRoms();
+    void pullIndexed();
+    void refreshVisible();
 
     void buildFontTexture();
     void drawText(int x, int y, const std::string& s, uint32_t rgba, int scale = 2);
@@ -100,6 +126,7 @@ private:
     void renderBrowser(int w, int h);
     void renderInGame(int w, int h);
     void renderSettings(int w, int h);
+    void renderProfiler(int w, int h);
     void renderToast(int w, int h);
 
     static std::string basename(const std::string& path);